@@ -0,0 +1,24 @@
+#ifndef TOPT_CLEANUP_CLEANUP_H
+#define TOPT_CLEANUP_CLEANUP_H
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm {
+class Function;
+
+namespace trainOpt {
+/**
+ *  Cleanup - Runs SCCP, LVN and dead code removal in turns until none of
+ *  them changes the function any more, or until the iteration limit set by
+ *  -topt-cleanup-max-iterations is reached. A step is only repeated after
+ *  another step made a change, so the last round stops as soon as every step
+ *  has seen the final state once.
+ */
+class CleanupPass : public PassInfoMixin<CleanupPass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_CLEANUP_CLEANUP_H
@@ -0,0 +1,33 @@
+#ifndef TOPT_DATAFLOW_ADCE_H
+#define TOPT_DATAFLOW_ADCE_H
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm {
+class Function;
+
+namespace trainOpt {
+class Solver;
+
+/**
+ *  eliminateDeadCode - Delete every instruction of F that nothing with an
+ *  effect depends on. Terminators, instructions with side effects and EH
+ *  pads are live, so is every operand of a live instruction. All other
+ *  instructions are deleted in one sweep, also cycles of dead PHIs. With a
+ *  solved Solver, blocks it did not find executable end in unreachable
+ *  and nothing in them keeps a value alive. Returns whether F changed.
+ */
+bool eliminateDeadCode(Function &F, Solver *Solver);
+
+/**
+ *  ADCE - Aggressive Dead Code Elimination pass. Runs the SCCP solver for
+ *  block executability first, unless -topt-adce-use-sccp=false.
+ */
+class ADCEPass : public PassInfoMixin<ADCEPass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_DATAFLOW_ADCE_H
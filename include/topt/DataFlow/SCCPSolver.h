@@ -7,10 +7,13 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/BitVector.h>
 #include <llvm/ADT/Statistic.h>
 #include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/ValueLattice.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/InstVisitor.h>
@@ -146,15 +149,132 @@ public:
   }
 };
 
-class Solver : public InstVisitor<Solver> {
-  friend InstVisitor<Solver>;
+/**
+ *  UserGraph - The def-use graph of a function in compressed sparse row
+ *  form. The arguments and then the instructions are numbered densely, so
+ *  the instructions of a block have consecutive IDs, and the blocks are
+ *  numbered too. The users of value ID are Edges[Offsets[ID]..Offsets[ID +
+ *  1]), each with its own ID and the ID of its block; operand i of
+ *  instruction ID has ID OperandIDs[OperandOffsets[ID] + i], NoID if it is
+ *  not numbered. Propagation walks these arrays instead of the use lists and
+ *  the value map, and checks executability by block ID.
+ */
+class UserGraph {
+public:
+  struct UserEdge {
+    Instruction *Inst;
+    unsigned ID;
+    unsigned BlockID;
+  };
+
+  void build(Function &F);
+
+  /** Forget the function, keeping the memory for the next one. */
+  void clear();
+
+  bool empty() const { return Values.empty(); }
+
+  /** Whether values like V are numbered. */
+  static bool isNumbered(const Value *V) {
+    return isa<Instruction>(V) || isa<Argument>(V);
+  }
+
+  unsigned getNumValues() const { return Values.size(); }
+  unsigned getNumBlocks() const { return Blocks.size(); }
+
+  /** The ID of an argument or instruction of the function, or NoID. */
+  unsigned getID(const Value *V) const {
+    auto It = IDs.find(V);
+    return It == IDs.end() ? NoID : It->second;
+  }
+
+  unsigned getBlockID(const BasicBlock *BB) const {
+    return BlockIDs.lookup(BB);
+  }
+
+  Value *getValue(unsigned ID) const { return Values[ID]; }
+  Instruction *getInstruction(unsigned ID) const {
+    return cast<Instruction>(Values[ID]);
+  }
+  /** The block of an instruction, NoID for arguments. */
+  unsigned getBlockIDOf(unsigned ID) const { return ValueBlockIDs[ID]; }
+  BasicBlock *getBlock(unsigned BlockID) const { return Blocks[BlockID]; }
+
+  /** The IDs of the instructions of a block are [begin, end). */
+  unsigned getBlockBegin(unsigned BlockID) const {
+    return BlockBegins[BlockID];
+  }
+  unsigned getBlockEnd(unsigned BlockID) const {
+    return BlockBegins[BlockID + 1];
+  }
+
+  unsigned getOperandID(unsigned ID, unsigned OpNo) const {
+    return OperandIDs[OperandOffsets[ID] + OpNo];
+  }
+
+  ArrayRef<UserEdge> users(unsigned ID) const {
+    return ArrayRef<UserEdge>(Edges.data() + Offsets[ID],
+                              Edges.data() + Offsets[ID + 1]);
+  }
+
+  static constexpr unsigned NoID = ~0u;
+
+private:
+  /** A use found while numbering, by the ID of the used value. */
+  struct FoundUse {
+    unsigned ID;
+    UserEdge Edge;
+  };
+
+  /** A use of a value numbered later, and where its ID goes. */
+  struct ForwardUse {
+    Value *Used;
+    unsigned Slot;
+    UserEdge Edge;
+  };
+
+  DenseMap<const Value *, unsigned> IDs;
+  DenseMap<const BasicBlock *, unsigned> BlockIDs;
+  std::vector<Value *> Values;
+  std::vector<unsigned> ValueBlockIDs;
+  std::vector<BasicBlock *> Blocks;
+  std::vector<unsigned> BlockBegins;
+  std::vector<unsigned> OperandOffsets;
+  std::vector<unsigned> OperandIDs;
+  std::vector<unsigned> Offsets;
+  std::vector<UserEdge> Edges;
+  std::vector<FoundUse> Found;
+  std::vector<ForwardUse> Forward;
+};
+
+class Solver {
+  friend class ParallelSolve;
 
 public:
   Solver(const DataLayout &DL, const TargetLibraryInfo *TLI)
-      : DL(DL), TLI(TLI) {}
+      : DL(&DL), TLI(TLI) {}
+
+  /**
+   *  reset - Forget everything about the previous function and prepare for
+   *  one using DL and TLI. The maps and worklists are cleared, not freed, so
+   *  once they have grown to the size of the functions at hand, solving
+   *  another function allocates nothing.
+   */
+  void reset(const DataLayout &DL, const TargetLibraryInfo *TLI);
 
   void solve();
 
+  /**
+   *  solveParallel - Experimental. Computes what solve() computes for F with
+   *  NumThreads threads, for functions too large for one core. Each thread
+   *  owns the worklist of a region of consecutive blocks and steals from the
+   *  others when its own runs dry. Lattice values are lowered by atomic
+   *  compare and swap only, and since the transfer functions are monotone
+   *  the fixed point does not depend on the order of the visits. It has not
+   *  been measured to be faster than solve() yet.
+   */
+  void solveParallel(Function &F, unsigned NumThreads);
+
   /**
    *  markBlockExecutable - This method can be used by clients to mark all of
    *  the blocks that are known to be intrinsically live in the processed unit.
@@ -173,47 +293,117 @@ public:
 
   const LatticeVal &getLatticeValueFor(Value *V) const;
 
+  /**
+   *  addPredicateInfo - Record what the conditional branches of F imply
+   *  about their operands in the blocks they dominate. In the region of
+   *  the true edge of br (icmp eq %x, C), uses of %x are C and uses of the
+   *  condition are true; likewise for the false edge of icmp ne, for the
+   *  false edge and for the cases of a switch. An edge only has a region if
+   *  it is the single way into its target. Must be called before solve().
+   */
+  void addPredicateInfo(Function &F, DominatorTree &DT);
+
+  /**
+   *  getPredicateConstant - The constant U is known to be from a
+   *  dominating branch, or null.
+   */
+  Constant *getPredicateConstant(const Use &U) const;
+
 private:
-  void visitBinaryOperator(Instruction &I);
-  void visitCmpInst(CmpInst &I);
-  void visitTerminator(Instruction &I);
-  void visitPHINode(PHINode &PN);
-  void visitReturnInst(ReturnInst &I);
+  /**
+   *  The visitors of the instructions, by their ID in Users. The ID spares
+   *  looking up the state of the instruction and its operands.
+   */
+  void visit(Instruction &I, unsigned ID);
+  void visitBlock(BasicBlock *BB);
+  void visitBinaryOperator(Instruction &I, unsigned ID);
+  void visitCmpInst(CmpInst &I, unsigned ID);
+  void visitTerminator(Instruction &I, unsigned ID);
+  void visitPHINode(PHINode &PN, unsigned ID);
+  void visitCallBase(CallBase &CB, unsigned ID);
+  void visitInstruction(Instruction &I, unsigned ID);
+
+  /**
+   *  foldConstants - The constant the binary operator or compare I computes
+   *  from the constants LHS and RHS, or null if it does not fold to one.
+   */
+  static Constant *foldConstants(Instruction &I, Constant *LHS, Constant *RHS,
+                                 const DataLayout &DL);
 
   bool isEdgeFeasible(BasicBlock *From, BasicBlock *To);
-  void getFeasibleSuccessors(Instruction &I, SmallVector<bool, 16> &Succs);
+  void getFeasibleSuccessors(Instruction &I, unsigned ID,
+                             SmallVector<bool, 16> &Succs);
   bool markEdgeExecutable(BasicBlock *Source, BasicBlock *Dest);
+  /** V is numbered and IV is its state. */
   void pushToWorkList(LatticeVal &IV, Value *V);
 
   bool markConstant(LatticeVal &IV, Value *V, Constant *C);
-  bool markConstant(Value *V, Constant *C);
 
   bool markOverdefined(LatticeVal &IV, Value *V);
-  void markUsersAsChanged(Value *I);
+  void markUsersAsChanged(unsigned ID);
+
+  /**
+   *  buildUserGraph - Number the values and blocks of F and build Users.
+   *  Done the first time a block or a numbered value of F is marked or
+   *  looked at.
+   */
+  void buildUserGraph(Function &F);
 
   /**
    *  getValueState - Return the LatticeVal object that corresponds to the
    *  value.  This function handles the case when the value hasn't been seen yet
-   *  by properly seeding constants etc.
+   *  by properly seeding constants etc. The states of numbered values do not
+   *  move, those of other values may on the next call.
    */
   LatticeVal &getValueState(Value *V);
 
+  /**
+   *  getOperandState - The LatticeVal of operand OpNo of instruction I with
+   *  the given ID, refined by the predicate info of its position.
+   */
+  LatticeVal getOperandState(Instruction &I, unsigned ID, unsigned OpNo);
+
+  /** The LatticeVal of a value that is not numbered. */
+  static LatticeVal getConstantState(Value *V);
+
+  void addEqualityFact(Value *V, Constant *C, BasicBlock *Region,
+                       DominatorTree &DT);
+
 private:
-  const DataLayout &DL;
+  const DataLayout *DL;
   const TargetLibraryInfo *TLI;
+
+  /** The state of the values numbered by Users, by ID. */
+  std::vector<LatticeVal> NumberedState;
+  /** The state of constants and other values not numbered. */
   DenseMap<Value *, LatticeVal> ValueState;
 
   /**
-   *  The worklists
+   *  Uses dominated by a branch that decides their value. Edge specific
+   *  copies of the values would serve as well, but would have to be
+   *  inserted into and removed from the function around every solve.
+   */
+  DenseMap<const Use *, Constant *> PredicateConstants;
+
+  /**
+   *  The worklists, values by ID.
    */
   SmallVector<BasicBlock *, 64> BBWorkList;
-  SmallVector<Value *, 64> OverdefinedInstWorkList;
-  SmallVector<Value *, 64> InstWorkList;
+  SmallVector<unsigned, 64> OverdefinedInstWorkList;
+  SmallVector<unsigned, 64> InstWorkList;
 
   /**
    *  The BBs that are executable.
    */
   SmallPtrSet<BasicBlock *, 8> BBExecutable;
+
+  /**
+   *  The users of every value, and the executable blocks again by block
+   *  ID.
+   */
+  UserGraph Users;
+  BitVector ExecutableBlocks;
+
   /**
    * KnownFeasibleEdges - Entries in this set are edges which have already had
    * PHI nodes retriggered.
@@ -222,4 +412,12 @@ private:
   DenseSet<Edge> KnownFeasibleEdges;
 };
 
+/**
+ *  getThreadSolver - The Solver of the calling thread, reset for a new
+ *  function. Passes use it instead of a Solver of their own so the memory
+ *  of its containers is reused from function to function. Only one user at
+ *  a time: the previous one has to be done with the results.
+ */
+Solver &getThreadSolver(const DataLayout &DL, const TargetLibraryInfo *TLI);
+
 } // namespace llvm::trainOpt
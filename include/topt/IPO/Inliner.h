@@ -0,0 +1,25 @@
+#ifndef TOPT_IPO_INLINER_H
+#define TOPT_IPO_INLINER_H
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm {
+class Module;
+
+namespace trainOpt {
+/**
+ *  Inliner - Inlines calls to small leaf functions: defined functions that
+ *  call nothing but intrinsics and have at most -topt-inline-threshold
+ *  instructions. Functions are visited bottom-up over the call graph, so a
+ *  function that becomes a small leaf once its own callees are inlined is
+ *  inlined into its callers in turn. Local functions left without callers
+ *  are deleted.
+ */
+class InlinerPass : public PassInfoMixin<InlinerPass> {
+public:
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &AM);
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_IPO_INLINER_H
@@ -0,0 +1,26 @@
+#ifndef TOPT_LOOPOPT_LICM_H
+#define TOPT_LOOPOPT_LICM_H
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm {
+class Function;
+
+namespace trainOpt {
+/**
+ *  LICM - Loop Invariant Code Motion.
+ *  Visits the loops of a function innermost first. Side effect free
+ *  instructions whose operands are all defined outside the loop are hoisted
+ *  into the preheader, which is created if the loop has none. Instructions
+ *  only used after the loop are sunk into its exit block if the loop has a
+ *  single exit block reached from nowhere else. Memory is never read by a
+ *  moved instruction, there is no alias analysis to prove it unchanged.
+ */
+class LICMPass : public PassInfoMixin<LICMPass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_LOOPOPT_LICM_H
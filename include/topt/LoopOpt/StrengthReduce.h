@@ -0,0 +1,25 @@
+#ifndef TOPT_LOOPOPT_STRENGTHREDUCE_H
+#define TOPT_LOOPOPT_STRENGTHREDUCE_H
+
+#include <llvm/IR/PassManager.h>
+
+namespace llvm {
+class Function;
+
+namespace trainOpt {
+/**
+ *  StrengthReduce - Replace expensive arithmetic by cheaper one.
+ *  A product of an affine induction variable and a loop invariant factor
+ *  becomes an induction variable of its own, advanced by an add in every
+ *  iteration. Division and remainder by a power of two become lshr and
+ *  and, the divisor may be any value the SCCP solver proves constant.
+ *  Signed ones only when the dividend is known to be non-negative.
+ */
+class StrengthReducePass : public PassInfoMixin<StrengthReducePass> {
+public:
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM);
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_LOOPOPT_STRENGTHREDUCE_H
@@ -0,0 +1,16 @@
+#ifndef TOPT_PASSES_PASSES_H
+#define TOPT_PASSES_PASSES_H
+
+namespace llvm {
+class PassBuilder;
+
+namespace trainOpt {
+/**
+ *  registerPassBuilderCallbacks - Make the topt passes known to the textual
+ *  pipeline parser of PB, under names like "topt-sccp".
+ */
+void registerPassBuilderCallbacks(PassBuilder &PB);
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_PASSES_PASSES_H
@@ -0,0 +1,28 @@
+#ifndef TOPT_SUPPORT_ALLOCATIONCOUNTER_H
+#define TOPT_SUPPORT_ALLOCATIONCOUNTER_H
+
+#include <cstdint>
+
+namespace llvm {
+namespace trainOpt {
+/**
+ *  Heap allocation counters.
+ *
+ *  Configured with TOPT_ENABLE_ALLOCATION_COUNTER, linking this library
+ *  replaces malloc, calloc, realloc and the aligned allocation functions of
+ *  glibc with versions that count each call (operator new ends up in malloc,
+ *  so it is counted too). Counting costs one thread local increment per
+ *  allocation. Without the option, on other C libraries and under the
+ *  sanitizers the counters stay at zero, see isAllocationCountingSupported.
+ *  Totals over threads are summed by whoever reports them.
+ */
+
+/** Number of allocations made by the calling thread so far. */
+uint64_t getThreadAllocationCount();
+
+/** Whether this build actually counts allocations. */
+bool isAllocationCountingSupported();
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_SUPPORT_ALLOCATIONCOUNTER_H
@@ -0,0 +1,118 @@
+//===- Cleanup.cpp - Fixed point of SCCP, LVN and dead code removal -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/ValueHandle.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include "topt/Cleanup/Cleanup.h"
+#include "topt/DataFlow/SCCP.h"
+#include "topt/LocalOpt/LVN.h"
+
+#include <iterator>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-cleanup"
+
+STATISTIC(NumIterations, "Number of cleanup iterations over all functions");
+STATISTIC(NumCappedFunctions,
+          "Number of functions that hit the cleanup iteration limit");
+STATISTIC(NumDeadInstRemoved, "Number of dead instructions removed");
+
+static cl::opt<unsigned> MaxIterations(
+    "topt-cleanup-max-iterations",
+    cl::desc("Maximum number of SCCP, LVN and dead code removal rounds "
+             "topt-cleanup runs on one function"),
+    cl::init(8));
+
+namespace llvm::trainOpt {
+/**
+ *  runStep - Run P on F and drop the analyses it did not preserve. Returns
+ *  whether P reported a change.
+ */
+template <typename PassT>
+static bool runStep(PassT P, Function &F, FunctionAnalysisManager &AM) {
+  PreservedAnalyses PA = P.run(F, AM);
+  if (PA.areAllPreserved()) {
+    return false;
+  }
+  AM.invalidate(F, PA);
+  return true;
+}
+
+static bool removeDeadCode(Function &F, FunctionAnalysisManager &AM) {
+  SmallVector<WeakTrackingVH, 16> Dead;
+  for (Instruction &I : instructions(F)) {
+    if (isInstructionTriviallyDead(&I)) {
+      Dead.push_back(&I);
+    }
+  }
+  if (Dead.empty()) {
+    return false;
+  }
+  unsigned Before = F.getInstructionCount();
+  RecursivelyDeleteTriviallyDeadInstructions(Dead);
+  NumDeadInstRemoved += Before - F.getInstructionCount();
+
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  AM.invalidate(F, PA);
+  return true;
+}
+
+static bool runSCCPStep(Function &F, FunctionAnalysisManager &AM) {
+  return runStep(SCCPPass{}, F, AM);
+}
+
+static bool runLVNStep(Function &F, FunctionAnalysisManager &AM) {
+  return runStep(LVNPass{}, F, AM);
+}
+
+PreservedAnalyses CleanupPass::run(Function &F, FunctionAnalysisManager &AM) {
+  using StepFn = bool (*)(Function &, FunctionAnalysisManager &);
+  static constexpr StepFn Steps[] = {runSCCPStep, runLVNStep, removeDeadCode};
+  constexpr size_t NumSteps = std::size(Steps);
+
+  bool Changed = false;
+  unsigned Iterations = 0;
+  // The step that made the last change has already seen its own result, so
+  // the fixed point is reached once the other steps ran without a change.
+  size_t QuietSteps = 0;
+  size_t Index = 0;
+  while (QuietSteps < NumSteps) {
+    if (Index == 0) {
+      if (Iterations == MaxIterations) {
+        ++NumCappedFunctions;
+        break;
+      }
+      ++Iterations;
+    }
+    if (Steps[Index](F, AM)) {
+      Changed = true;
+      QuietSteps = 1;
+    } else {
+      ++QuietSteps;
+    }
+    Index = (Index + 1) % NumSteps;
+  }
+
+  NumIterations += Iterations;
+  LLVM_DEBUG(dbgs() << "topt-cleanup: " << F.getName() << " took "
+                    << Iterations << " iteration(s)\n");
+  if (!Changed) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,121 @@
+//===- ADCE.cpp - Aggressive dead code elimination ------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Assumes every instruction dead until something live uses it, so unlike
+// removing trivially dead instructions one at a time it also deletes values
+// that only feed each other, such as the PHIs of a loop counter nobody
+// reads.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Local.h>
+
+#include "topt/DataFlow/ADCE.h"
+#include "topt/DataFlow/SCCPSolver.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-adce"
+
+STATISTIC(NumDeadInstRemoved, "Number of dead instructions removed");
+STATISTIC(NumDeadBlocks, "Number of non-executable blocks made unreachable");
+
+static cl::opt<bool> UseSCCP(
+    "topt-adce-use-sccp",
+    cl::desc("Let topt-adce run the SCCP solver to find blocks that are "
+             "never executed"),
+    cl::init(true));
+
+namespace llvm::trainOpt {
+/** isRoot - Whether I is live no matter who uses its value. */
+static bool isRoot(const Instruction &I) {
+  return I.isTerminator() || I.mayHaveSideEffects() || I.isEHPad();
+}
+
+bool eliminateDeadCode(Function &F, Solver *Solver) {
+  bool Changed = false;
+  if (Solver) {
+    for (BasicBlock &BB : F) {
+      // The terminator of a dead block is all that is left of it, and the
+      // block can only be one already.
+      if (Solver->isBlockExecutable(&BB) || isa<UnreachableInst>(BB.front())) {
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "topt-adce: block not executable: "
+                        << BB.getName() << "\n");
+      NumDeadInstRemoved += changeToUnreachable(&BB.front());
+      ++NumDeadBlocks;
+      Changed = true;
+    }
+  }
+
+  // Mark, from the roots through the operands.
+  SmallPtrSet<Instruction *, 32> Live;
+  SmallVector<Instruction *, 64> WorkList;
+  for (Instruction &I : instructions(F)) {
+    if (isRoot(I) && Live.insert(&I).second) {
+      WorkList.push_back(&I);
+    }
+  }
+  while (!WorkList.empty()) {
+    Instruction *I = WorkList.pop_back_val();
+    for (Value *Op : I->operands()) {
+      auto *OpI = dyn_cast<Instruction>(Op);
+      if (OpI && Live.insert(OpI).second) {
+        WorkList.push_back(OpI);
+      }
+    }
+  }
+
+  // Sweep. The references go first, dead values may use each other.
+  SmallVector<Instruction *, 64> Dead;
+  for (Instruction &I : instructions(F)) {
+    if (!Live.count(&I)) {
+      Dead.push_back(&I);
+      I.dropAllReferences();
+    }
+  }
+  for (Instruction *I : Dead) {
+    LLVM_DEBUG(dbgs() << "topt-adce: deleting " << *I << "\n");
+    I->eraseFromParent();
+  }
+  NumDeadInstRemoved += Dead.size();
+  return Changed || !Dead.empty();
+}
+
+PreservedAnalyses ADCEPass::run(Function &F, FunctionAnalysisManager &AM) {
+  bool Changed;
+  if (UseSCCP) {
+    const DataLayout &DL = F.getDataLayout();
+    auto &TLI = AM.getResult<TargetLibraryAnalysis>(F);
+    Solver &Solver = getThreadSolver(DL, &TLI);
+    for (Argument &AI : F.args()) {
+      Solver.markOverdefined(&AI);
+    }
+    Solver.markBlockExecutable(&F.front());
+    Solver.solve();
+    Changed = eliminateDeadCode(F, &Solver);
+  } else {
+    Changed = eliminateDeadCode(F, nullptr);
+  }
+
+  if (!Changed) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,500 @@
+//===- ParallelSolve.cpp - Multi threaded SCCP solving --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The lattice of a value only ever goes down, from unknown to a constant to
+// overdefined, and so do the executable flags of blocks and edges. Every
+// visit computes a value that is at least as high as the final one, so
+// lowering the state to the meet of what the visits compute, and visiting
+// again whenever an input changes, reaches the same fixed point as the
+// sequential solver in any order and from any number of threads.
+//
+// Folding constants creates new ones in the LLVMContext, which is not thread
+// safe, so that part runs under a lock. Everything else only reads the IR.
+//
+// This mode is experimental: no speedup over the sequential solver has been
+// measured yet, see -topt-sccp-threads.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "topt/DataFlow/SCCPSolver.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#define DEBUG_TYPE "SCCPSolver"
+
+STATISTIC(NumParallelSolves, "Number of functions solved by several threads");
+STATISTIC(NumStolenItems, "Number of work items taken from another thread");
+
+namespace llvm::trainOpt {
+/**
+ *  ParallelSolve - The state of one solveParallel call. Values and blocks are
+ *  numbered by the user graph of the Solver, the lattice of value i lives in
+ *  States[i] as a Constant * with the kind in its low bits.
+ */
+class ParallelSolve {
+public:
+  ParallelSolve(Solver &S, Function &F, unsigned NumThreads);
+
+  void run();
+
+private:
+  enum : uintptr_t {
+    Unknown = 0,
+    IsConstant = 1,
+    Overdefined = 2,
+    KindMask = 3
+  };
+
+  /** Items are instruction IDs, or block IDs with BlockItem set. */
+  static constexpr uint32_t BlockItem = 1u << 31;
+
+  struct alignas(64) WorkQueue {
+    std::mutex Lock;
+    std::deque<uint32_t> Items;
+  };
+
+  static LatticeVal decode(uintptr_t Bits);
+  static uintptr_t encode(const LatticeVal &LV);
+
+  LatticeVal getOperandState(Instruction &I, unsigned Idx,
+                             unsigned OpNo) const;
+  bool isEdgeFeasible(BasicBlock *From, BasicBlock *To) const;
+
+  void lower(unsigned Idx, const LatticeVal &New);
+  void markEdgeExecutable(BasicBlock *From, BasicBlock *To);
+  void push(uint32_t Item, unsigned Owner);
+  void pushInstruction(unsigned Idx);
+
+  void visit(Instruction &I, unsigned Idx);
+  void visitPHI(PHINode &PN, unsigned Idx);
+  void visitTerminator(Instruction &I, unsigned Idx);
+  void process(uint32_t Item);
+  bool takeWork(unsigned Thread, uint32_t &Item);
+  void work(unsigned Thread);
+  void writeBack();
+
+  Solver &S;
+  const UserGraph &Users;
+  Function &F;
+  unsigned NumThreads;
+
+  std::vector<unsigned> BlockOwner;
+  DenseMap<std::pair<const BasicBlock *, const BasicBlock *>, unsigned>
+      EdgeNumber;
+
+  std::unique_ptr<std::atomic<uintptr_t>[]> States;
+  std::unique_ptr<std::atomic<bool>[]> Queued;
+  std::unique_ptr<std::atomic<bool>[]> Executable;
+  std::unique_ptr<std::atomic<bool>[]> Feasible;
+
+  std::unique_ptr<WorkQueue[]> Queues;
+  /** Items pushed but not processed yet, zero once the solve is done. */
+  std::atomic<int64_t> Pending{0};
+  /** Items in the queues, not taken by a thread yet. */
+  std::atomic<int64_t> Available{0};
+  std::mutex FoldLock;
+
+  /** Threads without work wait here for new items or the end of the solve. */
+  std::mutex IdleLock;
+  std::condition_variable WorkOrDone;
+  std::atomic<unsigned> Sleeping{0};
+};
+
+ParallelSolve::ParallelSolve(Solver &S, Function &F, unsigned NumThreads)
+    : S(S), Users(S.Users), F(F), NumThreads(NumThreads) {
+  unsigned NumValues = Users.getNumValues();
+  unsigned NumBlocks = Users.getNumBlocks();
+
+  // Regions are runs of consecutive blocks with about the same number of
+  // instructions, generated code keeps related blocks close.
+  size_t PerThread = NumValues / NumThreads + 1;
+  BlockOwner.reserve(NumBlocks);
+  for (unsigned i = 0; i < NumBlocks; ++i) {
+    BlockOwner.push_back(std::min<size_t>(Users.getBlockBegin(i) / PerThread,
+                                          NumThreads - 1));
+  }
+  for (BasicBlock &BB : F) {
+    for (BasicBlock *Succ : successors(&BB)) {
+      EdgeNumber.try_emplace({&BB, Succ}, EdgeNumber.size());
+    }
+  }
+
+  States.reset(new std::atomic<uintptr_t>[NumValues]);
+  Queued.reset(new std::atomic<bool>[NumValues]);
+  for (unsigned i = 0; i < NumValues; ++i) {
+    // Clients may have marked values before solving.
+    States[i] = encode(S.NumberedState[i]);
+    Queued[i] = false;
+  }
+  Executable.reset(new std::atomic<bool>[NumBlocks]);
+  for (unsigned i = 0; i < NumBlocks; ++i) {
+    Executable[i] = S.ExecutableBlocks.test(i);
+  }
+  Feasible.reset(new std::atomic<bool>[EdgeNumber.size()]);
+  for (auto &[E, Idx] : EdgeNumber) {
+    Feasible[Idx] =
+        S.KnownFeasibleEdges.count({const_cast<BasicBlock *>(E.first),
+                                    const_cast<BasicBlock *>(E.second)});
+  }
+  Queues.reset(new WorkQueue[NumThreads]);
+}
+
+LatticeVal ParallelSolve::decode(uintptr_t Bits) {
+  LatticeVal LV;
+  switch (Bits & KindMask) {
+  case IsConstant:
+    LV.markConstant(reinterpret_cast<Constant *>(Bits & ~uintptr_t(KindMask)));
+    break;
+  case Overdefined:
+    LV.markOverdefined();
+    break;
+  default:
+    break;
+  }
+  return LV;
+}
+
+uintptr_t ParallelSolve::encode(const LatticeVal &LV) {
+  if (LV.isOverdefined()) {
+    return Overdefined;
+  }
+  if (LV.isConstant()) {
+    return reinterpret_cast<uintptr_t>(LV.getConstant()) | IsConstant;
+  }
+  return Unknown;
+}
+
+/** Like Solver::getOperandState, with the states of this solve. */
+LatticeVal ParallelSolve::getOperandState(Instruction &I, unsigned Idx,
+                                          unsigned OpNo) const {
+  if (Constant *C = S.getPredicateConstant(I.getOperandUse(OpNo))) {
+    LatticeVal Refined;
+    Refined.markConstant(C);
+    return Refined;
+  }
+  unsigned OpIdx = Users.getOperandID(Idx, OpNo);
+  if (OpIdx != UserGraph::NoID) {
+    return decode(States[OpIdx].load());
+  }
+  return Solver::getConstantState(I.getOperand(OpNo));
+}
+
+bool ParallelSolve::isEdgeFeasible(BasicBlock *From, BasicBlock *To) const {
+  auto It = EdgeNumber.find({From, To});
+  return It != EdgeNumber.end() && Feasible[It->second].load();
+}
+
+/**
+ *  lower - Meet the state of instruction Idx with New. Two different
+ *  constants computed from different snapshots of the operands meet in
+ *  overdefined, the final value is below both.
+ */
+void ParallelSolve::lower(unsigned Idx, const LatticeVal &New) {
+  if (New.isUnknown()) {
+    return;
+  }
+  uintptr_t Target = encode(New);
+  uintptr_t Cur = States[Idx].load();
+  while (true) {
+    if (Cur == Overdefined || Cur == Target) {
+      return;
+    }
+    uintptr_t Lowered = Cur == Unknown ? Target : uintptr_t(Overdefined);
+    if (States[Idx].compare_exchange_weak(Cur, Lowered)) {
+      break;
+    }
+  }
+  for (const UserGraph::UserEdge &E : Users.users(Idx)) {
+    if (Executable[E.BlockID].load()) {
+      pushInstruction(E.ID);
+    }
+  }
+}
+
+void ParallelSolve::markEdgeExecutable(BasicBlock *From, BasicBlock *To) {
+  auto It = EdgeNumber.find({From, To});
+  if (Feasible[It->second].exchange(true)) {
+    return;
+  }
+  unsigned BlockIdx = Users.getBlockID(To);
+  if (!Executable[BlockIdx].exchange(true)) {
+    push(BlockIdx | BlockItem, BlockOwner[BlockIdx]);
+    return;
+  }
+  // Only the PHIs see the new edge, they come first.
+  for (unsigned Idx = Users.getBlockBegin(BlockIdx),
+                End = Users.getBlockEnd(BlockIdx);
+       Idx != End && isa<PHINode>(Users.getValue(Idx)); ++Idx) {
+    pushInstruction(Idx);
+  }
+}
+
+void ParallelSolve::push(uint32_t Item, unsigned Owner) {
+  // Counted before it can be taken, so Pending never drops to zero early.
+  Pending.fetch_add(1);
+  {
+    WorkQueue &Q = Queues[Owner];
+    std::lock_guard<std::mutex> Guard(Q.Lock);
+    Q.Items.push_back(Item);
+    Available.fetch_add(1);
+  }
+  // Sleeping is raised before a waiter checks Available, so either it sees
+  // the item or it is counted here.
+  if (Sleeping.load() != 0) {
+    {
+      std::lock_guard<std::mutex> Guard(IdleLock);
+    }
+    WorkOrDone.notify_one();
+  }
+}
+
+void ParallelSolve::pushInstruction(unsigned Idx) {
+  // Already queued and not visited yet, that visit will see the change.
+  if (Queued[Idx].exchange(true)) {
+    return;
+  }
+  push(Idx, BlockOwner[Users.getBlockIDOf(Idx)]);
+}
+
+void ParallelSolve::visitPHI(PHINode &PN, unsigned Idx) {
+  if (PN.getType()->isStructTy() || PN.getNumIncomingValues() > 64) {
+    LatticeVal Over;
+    Over.markOverdefined();
+    return lower(Idx, Over);
+  }
+  LatticeVal PhiState;
+  for (unsigned i = 0; i < PN.getNumIncomingValues(); i++) {
+    LatticeVal IV = getOperandState(PN, Idx, i);
+    if (IV.isUnknown() ||
+        !isEdgeFeasible(PN.getIncomingBlock(i), PN.getParent())) {
+      continue;
+    }
+    if (IV.isOverdefined() ||
+        (PhiState.isConstant() && PhiState.getConstant() != IV.getConstant())) {
+      PhiState.markOverdefined();
+      break;
+    }
+    PhiState.markConstant(IV.getConstant());
+  }
+  lower(Idx, PhiState);
+}
+
+/** Same successors as Solver::getFeasibleSuccessors. */
+void ParallelSolve::visitTerminator(Instruction &I, unsigned Idx) {
+  BasicBlock *BB = I.getParent();
+  auto *BI = dyn_cast<BranchInst>(&I);
+  if (BI && BI->isConditional()) {
+    LatticeVal BCValue = getOperandState(I, Idx, 0);
+    if (ConstantInt *CI = BCValue.getConstantInt()) {
+      markEdgeExecutable(BB, BI->getSuccessor(CI->isZero()));
+    } else if (!BCValue.isUnknown()) {
+      markEdgeExecutable(BB, BI->getSuccessor(0));
+      markEdgeExecutable(BB, BI->getSuccessor(1));
+    }
+    return;
+  }
+  for (BasicBlock *Succ : successors(BB)) {
+    markEdgeExecutable(BB, Succ);
+  }
+}
+
+void ParallelSolve::visit(Instruction &I, unsigned Idx) {
+  // Fast exit, nothing goes below overdefined.
+  if (States[Idx].load() == Overdefined && !I.isTerminator()) {
+    return;
+  }
+  if (auto *PN = dyn_cast<PHINode>(&I)) {
+    return visitPHI(*PN, Idx);
+  }
+  if (isa<BinaryOperator>(I) || isa<CmpInst>(I)) {
+    LatticeVal V1State = getOperandState(I, Idx, 0);
+    LatticeVal V2State = getOperandState(I, Idx, 1);
+    LatticeVal Result;
+    if (V1State.isConstant() && V2State.isConstant()) {
+      // A constant operand stays that constant or becomes overdefined, so a
+      // constant result was folded from these operands already.
+      if ((States[Idx].load() & KindMask) == IsConstant) {
+        return;
+      }
+      std::lock_guard<std::mutex> Guard(FoldLock);
+      Constant *C = Solver::foldConstants(I, V1State.getConstant(),
+                                          V2State.getConstant(), *S.DL);
+      if (C) {
+        Result.markConstant(C);
+      } else {
+        Result.markOverdefined();
+      }
+    } else if (V1State.isOverdefined() || V2State.isOverdefined()) {
+      Result.markOverdefined();
+    }
+    return lower(Idx, Result);
+  }
+  // Everything not modelled above may produce any value, invoke and callbr
+  // continue in their successors as well.
+  if (!I.getType()->isVoidTy()) {
+    LatticeVal Over;
+    Over.markOverdefined();
+    lower(Idx, Over);
+  }
+  if (I.isTerminator()) {
+    visitTerminator(I, Idx);
+  }
+}
+
+void ParallelSolve::process(uint32_t Item) {
+  if (Item & BlockItem) {
+    unsigned BlockIdx = Item & ~BlockItem;
+    for (unsigned Idx = Users.getBlockBegin(BlockIdx),
+                  End = Users.getBlockEnd(BlockIdx);
+         Idx != End; ++Idx) {
+      visit(*Users.getInstruction(Idx), Idx);
+    }
+    return;
+  }
+  // Cleared before the operands are read, a change after that queues the
+  // instruction again.
+  Queued[Item].store(false);
+  visit(*Users.getInstruction(Item), Item);
+}
+
+bool ParallelSolve::takeWork(unsigned Thread, uint32_t &Item) {
+  {
+    WorkQueue &Own = Queues[Thread];
+    std::lock_guard<std::mutex> Guard(Own.Lock);
+    if (!Own.Items.empty()) {
+      Item = Own.Items.back();
+      Own.Items.pop_back();
+      Available.fetch_sub(1);
+      return true;
+    }
+  }
+  // Steal the oldest item of another region, the owner works on its newest.
+  for (unsigned i = 1; i < NumThreads; ++i) {
+    WorkQueue &Victim = Queues[(Thread + i) % NumThreads];
+    std::lock_guard<std::mutex> Guard(Victim.Lock);
+    if (!Victim.Items.empty()) {
+      Item = Victim.Items.front();
+      Victim.Items.pop_front();
+      Available.fetch_sub(1);
+      ++NumStolenItems;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ParallelSolve::work(unsigned Thread) {
+  while (true) {
+    uint32_t Item;
+    if (takeWork(Thread, Item)) {
+      process(Item);
+      if (Pending.fetch_sub(1) == 1) {
+        {
+          std::lock_guard<std::mutex> Guard(IdleLock);
+        }
+        WorkOrDone.notify_all();
+      }
+      continue;
+    }
+    // Nothing queued anywhere, but items being processed may push more.
+    if (Pending.load() == 0) {
+      return;
+    }
+    std::unique_lock<std::mutex> Lock(IdleLock);
+    Sleeping.fetch_add(1);
+    WorkOrDone.wait(Lock, [this] {
+      return Available.load() > 0 || Pending.load() == 0;
+    });
+    Sleeping.fetch_sub(1);
+  }
+}
+
+/**
+ *  getHelperPool - The threads that help the calling thread solve, kept for
+ *  the next call. Each calling thread has its own, so waiting for the pool
+ *  only waits for its own solve, also when topt -batch solves several
+ *  functions at once.
+ */
+static DefaultThreadPool &getHelperPool(unsigned NumHelpers) {
+  static thread_local std::unique_ptr<DefaultThreadPool> Pool;
+  if (!Pool || Pool->getMaxConcurrency() != NumHelpers) {
+    Pool = std::make_unique<DefaultThreadPool>(
+        hardware_concurrency(NumHelpers));
+  }
+  return *Pool;
+}
+
+void ParallelSolve::run() {
+  // What the sequential solver would visit first: the blocks already marked
+  // executable, in full.
+  S.BBWorkList.clear();
+  S.InstWorkList.clear();
+  S.OverdefinedInstWorkList.clear();
+  for (unsigned i = 0; i < Users.getNumBlocks(); ++i) {
+    if (Executable[i].load()) {
+      push(i | BlockItem, BlockOwner[i]);
+    }
+  }
+
+  DefaultThreadPool &Pool = getHelperPool(NumThreads - 1);
+  for (unsigned Thread = 1; Thread < NumThreads; ++Thread) {
+    Pool.async([this, Thread] { work(Thread); });
+  }
+  work(0);
+  Pool.wait();
+  writeBack();
+}
+
+/** Hand the result to the Solver, so the usual queries answer it. */
+void ParallelSolve::writeBack() {
+  for (unsigned i = 0; i < Users.getNumBlocks(); ++i) {
+    if (!Executable[i].load()) {
+      continue;
+    }
+    S.BBExecutable.insert(Users.getBlock(i));
+    S.ExecutableBlocks.set(i);
+  }
+  // Values never visited still have the state they started with.
+  for (unsigned i = 0; i < Users.getNumValues(); ++i) {
+    S.NumberedState[i] = decode(States[i].load());
+  }
+  for (auto &[E, Idx] : EdgeNumber) {
+    if (Feasible[Idx].load()) {
+      S.KnownFeasibleEdges.insert({const_cast<BasicBlock *>(E.first),
+                                   const_cast<BasicBlock *>(E.second)});
+    }
+  }
+}
+
+void Solver::solveParallel(Function &F, unsigned NumThreads) {
+  if (NumThreads <= 1) {
+    return solve();
+  }
+  LLVM_DEBUG(dbgs() << "Solving " << F.getName() << " with " << NumThreads
+                    << " threads.\n");
+  if (Users.empty()) {
+    buildUserGraph(F);
+  }
+  ParallelSolve(*this, F, NumThreads).run();
+  ++NumParallelSolves;
+}
+} // namespace llvm::trainOpt
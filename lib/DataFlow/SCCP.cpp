@@ -15,6 +15,7 @@
 #include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/ValueLattice.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/InstVisitor.h>
@@ -24,6 +25,7 @@
 #include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/CommandLine.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/Local.h>
 
@@ -38,8 +40,34 @@ STATISTIC(NumInstRemoved, "Number of instructions removed");
 STATISTIC(NumDeadBlocks , "Number of basic blocks unreachable");
 STATISTIC(NumInstReplaced,
           "Number of instructions replaced with (simpler) instruction");
+STATISTIC(NumUsesRefined,
+          "Number of uses replaced with a constant implied by a branch");
+
+static cl::opt<bool> UsePredicateInfo(
+    "topt-sccp-predicate-info",
+    cl::desc("Let topt-sccp use what dominating branch conditions imply "
+             "about their operands"),
+    cl::init(true));
+
+static cl::opt<unsigned> SolverThreads(
+    "topt-sccp-threads",
+    cl::desc("Experimental, not measured to be faster than one thread: "
+             "threads solving one large function in topt-sccp, see "
+             "-topt-sccp-parallel-threshold"),
+    cl::init(1));
+
+static cl::opt<unsigned> ParallelThreshold(
+    "topt-sccp-parallel-threshold",
+    cl::desc("Minimum number of instructions of a function topt-sccp solves "
+             "with -topt-sccp-threads threads"),
+    cl::init(100000));
+
 namespace llvm::trainOpt {
 static bool tryToReplaceWithConstant(Solver &Solver, Value *V) {
+  // Nothing to replace, do not report a change.
+  if (V->use_empty()) {
+    return false;
+  }
   assert(!V->getType()->isStructTy() && "Structure type is not supported!");
   const LatticeVal &val = Solver.getLatticeValueFor(V);
   if (val.isOverdefined()) {
@@ -54,32 +82,67 @@ static bool tryToReplaceWithConstant(Solver &Solver, Value *V) {
   return true;
 }
 
+/**
+ *  refineUses - Replace the uses in executable blocks that a dominating
+ *  branch decides by the constant it implies. Done before anything is
+ *  erased, the predicate info refers to the uses by address.
+ */
+static bool refineUses(Function &F, Solver &Solver) {
+  bool Changed = false;
+  for (BasicBlock &BB : F) {
+    if (!Solver.isBlockExecutable(&BB)) {
+      continue;
+    }
+    for (Instruction &I : BB) {
+      for (Use &U : I.operands()) {
+        Constant *C = Solver.getPredicateConstant(U);
+        if (C && U.get() != C) {
+          U.set(C);
+          NumUsesRefined++;
+          Changed = true;
+        }
+      }
+    }
+  }
+  return Changed;
+}
+
 static bool runSCCP(Function &F, const DataLayout &DL,
-                    const TargetLibraryInfo *TLI) {
-  Solver Solver(DL, TLI);
+                    const TargetLibraryInfo *TLI, DominatorTree *DT) {
+  Solver &Solver = getThreadSolver(DL, TLI);
 
   for (Argument &AI : F.args()) {
     Solver.markOverdefined(&AI);
   }
+  if (DT) {
+    Solver.addPredicateInfo(F, *DT);
+  }
   Solver.markBlockExecutable(&F.front());
 
-  Solver.solve();
+  if (SolverThreads > 1 && F.getInstructionCount() >= ParallelThreshold) {
+    Solver.solveParallel(F, SolverThreads);
+  } else {
+    Solver.solve();
+  }
 
-  bool MadeChanges = false;
+  bool MadeChanges = DT && refineUses(F, Solver);
 
   for (auto &BB : F) {
     if (!Solver.isBlockExecutable(&BB)) {
+      // A block that is only an unreachable is what an earlier run left.
+      if (isa<UnreachableInst>(BB.front())) {
+        continue;
+      }
       LLVM_DEBUG(dbgs() << "  BasicBlock Dead:" << BB);
       NumDeadBlocks++;
-      for (Instruction &I : BB) {
-        I.eraseFromParent();
-        NumInstRemoved++;
-      }
+      // The block has to keep a terminator, and PHIs of the successors must
+      // forget it as a predecessor.
+      NumInstRemoved += changeToUnreachable(&BB.front());
       MadeChanges = true;
       continue;
     }
 
-    for (Instruction &I : BB) {
+    for (Instruction &I : make_early_inc_range(BB)) {
       if (!I.isTerminator() && tryToReplaceWithConstant(Solver, &I)) {
         NumInstReplaced++;
         MadeChanges = true;
@@ -99,7 +162,10 @@ PreservedAnalyses SCCPPass::run(Function &F, FunctionAnalysisManager &AM) {
   const DataLayout &DL = F.getDataLayout();
   auto &TLI = AM.getResult<TargetLibraryAnalysis>(F);
 
-  if (!runSCCP(F, DL, &TLI))
+  DominatorTree *DT =
+      UsePredicateInfo ? &AM.getResult<DominatorTreeAnalysis>(F) : nullptr;
+
+  if (!runSCCP(F, DL, &TLI, DT))
     return PreservedAnalyses::all();
 
   return PreservedAnalyses::none();
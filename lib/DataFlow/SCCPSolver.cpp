@@ -2,6 +2,7 @@
 #include <llvm/Analysis/ConstantFolding.h>
 #include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/Analysis/ValueLattice.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/InstVisitor.h>
@@ -11,6 +12,7 @@
 #include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/Debug.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include "llvm/Analysis/InstructionSimplify.h"
@@ -21,202 +23,446 @@
 
 namespace llvm {
 namespace trainOpt {
+void Solver::reset(const DataLayout &NewDL, const TargetLibraryInfo *NewTLI) {
+  DL = &NewDL;
+  TLI = NewTLI;
+  NumberedState.clear();
+  ValueState.clear();
+  PredicateConstants.clear();
+  BBWorkList.clear();
+  OverdefinedInstWorkList.clear();
+  InstWorkList.clear();
+  BBExecutable.clear();
+  KnownFeasibleEdges.clear();
+  Users.clear();
+  ExecutableBlocks.clear();
+}
+
+Solver &getThreadSolver(const DataLayout &DL, const TargetLibraryInfo *TLI) {
+  static thread_local Solver ThreadSolver(DL, TLI);
+  ThreadSolver.reset(DL, TLI);
+  return ThreadSolver;
+}
+
+void UserGraph::build(Function &F) {
+  // Not reserved, counting the instructions is a walk over all of them.
+  // The maps keep their memory from function to function anyway.
+  clear();
+  for (Argument &A : F.args()) {
+    IDs[&A] = Values.size();
+    Values.push_back(&A);
+    ValueBlockIDs.push_back(NoID);
+    OperandOffsets.push_back(OperandIDs.size());
+  }
+  // The uses are collected from the operands while numbering, the operands
+  // are next to their instruction in memory and mostly numbered just
+  // before. Uses of values not numbered yet are resolved at the end.
+  for (BasicBlock &BB : F) {
+    unsigned BlockID = Blocks.size();
+    BlockIDs[&BB] = BlockID;
+    Blocks.push_back(&BB);
+    BlockBegins.push_back(Values.size());
+    for (Instruction &I : BB) {
+      unsigned ID = Values.size();
+      IDs[&I] = ID;
+      Values.push_back(&I);
+      ValueBlockIDs.push_back(BlockID);
+      OperandOffsets.push_back(OperandIDs.size());
+      UserEdge Edge = {&I, ID, BlockID};
+      for (Value *Op : I.operand_values()) {
+        unsigned OpID = isNumbered(Op) ? getID(Op) : NoID;
+        if (OpID != NoID) {
+          Found.push_back({OpID, Edge});
+        } else if (isNumbered(Op)) {
+          Forward.push_back({Op, unsigned(OperandIDs.size()), Edge});
+        }
+        OperandIDs.push_back(OpID);
+      }
+    }
+  }
+  BlockBegins.push_back(Values.size());
+  OperandOffsets.push_back(OperandIDs.size());
+  for (const ForwardUse &U : Forward) {
+    unsigned OpID = getID(U.Used);
+    OperandIDs[U.Slot] = OpID;
+    Found.push_back({OpID, U.Edge});
+  }
+
+  // Counting sort by the used value, filling each range from its back.
+  Offsets.assign(Values.size() + 1, 0);
+  for (const FoundUse &U : Found) {
+    ++Offsets[U.ID + 1];
+  }
+  for (unsigned ID = 0; ID < Values.size(); ++ID) {
+    Offsets[ID + 1] += Offsets[ID];
+  }
+  Edges.resize(Found.size());
+  for (const FoundUse &U : llvm::reverse(Found)) {
+    Edges[--Offsets[U.ID + 1]] = U.Edge;
+  }
+  // Offsets[ID + 1] is the start of range ID now, shift them back.
+  for (unsigned ID = 0; ID < Values.size(); ++ID) {
+    Offsets[ID] = Offsets[ID + 1];
+  }
+  Offsets.back() = Edges.size();
+
+  // The uses of one user are next to each other in a range, a user using a
+  // value twice is its user once. Ranges move to the front.
+  unsigned Out = 0;
+  for (unsigned ID = 0; ID < Values.size(); ++ID) {
+    unsigned Begin = Offsets[ID];
+    unsigned End = Offsets[ID + 1];
+    Offsets[ID] = Out;
+    for (unsigned i = Begin; i < End; ++i) {
+      if (Out == Offsets[ID] || Edges[Out - 1].ID != Edges[i].ID) {
+        Edges[Out++] = Edges[i];
+      }
+    }
+  }
+  Offsets.back() = Out;
+  Edges.resize(Out);
+}
+
+void UserGraph::clear() {
+  IDs.clear();
+  BlockIDs.clear();
+  Values.clear();
+  ValueBlockIDs.clear();
+  Blocks.clear();
+  BlockBegins.clear();
+  OperandOffsets.clear();
+  OperandIDs.clear();
+  Offsets.clear();
+  Edges.clear();
+  Found.clear();
+  Forward.clear();
+}
+
+void Solver::buildUserGraph(Function &F) {
+  Users.build(F);
+  NumberedState.assign(Users.getNumValues(), LatticeVal());
+  ExecutableBlocks.clear();
+  ExecutableBlocks.resize(Users.getNumBlocks());
+  for (BasicBlock *BB : BBExecutable) {
+    ExecutableBlocks.set(Users.getBlockID(BB));
+  }
+}
+
 void Solver::solve() {
   while (!BBWorkList.empty() || !InstWorkList.empty() ||
          !OverdefinedInstWorkList.empty()) {
 
     while (!OverdefinedInstWorkList.empty()) {
-      auto *I = OverdefinedInstWorkList.pop_back_val();
-      markUsersAsChanged(I);
-      outs() << "Marked users of overdefined instruction ";
-      I->print(outs());
-      outs() << " as changed." << "\n";
+      unsigned ID = OverdefinedInstWorkList.pop_back_val();
+      markUsersAsChanged(ID);
+      LLVM_DEBUG(dbgs() << "Marked users of overdefined instruction "
+                        << *Users.getValue(ID) << " as changed.\n");
     }
 
     while (!InstWorkList.empty()) {
-      auto *I = InstWorkList.pop_back_val();
-      
-      if (I->getType()->isStructTy() || !getValueState(I).isOverdefined())
-        markUsersAsChanged(I);
-        outs() << "Marked users of ";
-        I->print(outs());
-        outs() << " as changed.\n";
+      unsigned ID = InstWorkList.pop_back_val();
+
+      // Otherwise the users were visited from the overdefined worklist.
+      if (!NumberedState[ID].isOverdefined())
+        markUsersAsChanged(ID);
+      LLVM_DEBUG(dbgs() << "Marked users of " << *Users.getValue(ID)
+                        << " as changed.\n");
     }
 
     while (!BBWorkList.empty()) {
       auto *BB = BBWorkList.pop_back_val();
       
-      visit(BB);
-      outs() << "Visited basic block ";
-      BB->print(outs());
-      outs() << "\n";
+      visitBlock(BB);
+      LLVM_DEBUG(dbgs() << "Visited basic block " << *BB << "\n");
     }
   }
 }
 
 bool Solver::markBlockExecutable(BasicBlock *BB) {
   if (!BBExecutable.insert(BB).second) {
-    outs() << "Basic block ";
-    BB->print(outs());
-    outs() << " is not marked as executable (already is).\n";
+    LLVM_DEBUG(dbgs() << "Basic block " << *BB
+                      << " is not marked as executable (already is).\n");
     return false;
   }
   BBWorkList.push_back(BB); // Add the block to the worklist!
-  outs() << "Marked basic block ";
-  BB->print(outs());
-  outs() << " as executable.\n";
+  if (Users.empty()) {
+    buildUserGraph(*BB->getParent());
+  }
+  ExecutableBlocks.set(Users.getBlockID(BB));
+  LLVM_DEBUG(dbgs() << "Marked basic block " << *BB << " as executable.\n");
   return true;
 }
 
 void Solver::markOverdefined(Value *V) {
   if (auto *STy = dyn_cast<StructType>(V->getType())) {
     assert(false && "StructType is unsupported!");
-    outs() << "StructType is unsupported!\n";
   } else {
-    markOverdefined(ValueState[V], V);
-    outs() << "Marked value ";
-    V->print(outs());
-    outs() << " as overdefined.\n";
+    markOverdefined(getValueState(V), V);
+    LLVM_DEBUG(dbgs() << "Marked value " << *V << " as overdefined.\n");
   }
 }
 
 bool Solver::isBlockExecutable(BasicBlock *BB) {
   if (BBExecutable.count(BB)) {
-    outs() << "Basic block ";
-    BB->print(outs());
-    outs() << " is executable.\n";
+    LLVM_DEBUG(dbgs() << "Basic block " << *BB << " is executable.\n");
     return true;
   }
-  outs() << "Basic block ";
-  BB->print(outs());
-  outs() << " is not executable.\n";
+  LLVM_DEBUG(dbgs() << "Basic block " << *BB << " is not executable.\n");
   return false;
 }
 
 const LatticeVal &Solver::getLatticeValueFor(Value *V) const {
-  const auto I = ValueState.find(V);
-  if (I == ValueState.end()) {
-    V->print(outs());
+  if (UserGraph::isNumbered(V)) {
+    // Instructions created after solving were never seen.
+    static const LatticeVal Unknown;
+    unsigned ID = Users.getID(V);
+    return ID == UserGraph::NoID ? Unknown : NumberedState[ID];
   }
-  outs() << "Got lattice value " << I->getSecond().getConstantInt() << " for value ";
-  V->print(outs());
-  outs() << "\n";
+  const auto I = ValueState.find(V);
   assert(I != ValueState.end() && "V is not found in ValueState");
+  LLVM_DEBUG(dbgs() << "Got lattice value " << I->getSecond().getConstantInt()
+                    << " for value " << *V << "\n");
   return I->second;
 }
 
+void Solver::addPredicateInfo(Function &F, DominatorTree &DT) {
+  for (BasicBlock &BB : F) {
+    if (!DT.isReachableFromEntry(&BB)) {
+      continue;
+    }
+    Instruction *Term = BB.getTerminator();
+    if (auto *SI = dyn_cast<SwitchInst>(Term)) {
+      for (auto &Case : SI->cases()) {
+        BasicBlock *To = Case.getCaseSuccessor();
+        if (To->getSinglePredecessor() == &BB) {
+          addEqualityFact(SI->getCondition(), Case.getCaseValue(), To, DT);
+        }
+      }
+      continue;
+    }
+    auto *BI = dyn_cast<BranchInst>(Term);
+    if (!BI || BI->isUnconditional()) {
+      continue;
+    }
+    Value *Cond = BI->getCondition();
+    auto *Cmp = dyn_cast<ICmpInst>(Cond);
+    for (unsigned i = 0; i < 2; ++i) {
+      BasicBlock *To = BI->getSuccessor(i);
+      // Otherwise To is also entered from somewhere else, or along the other
+      // edge of the same branch.
+      if (To->getSinglePredecessor() != &BB) {
+        continue;
+      }
+      bool Taken = i == 0;
+      addEqualityFact(Cond, ConstantInt::getBool(Cond->getType(), Taken), To,
+                      DT);
+      if (!Cmp || !Cmp->isEquality() ||
+          (Cmp->getPredicate() == CmpInst::ICMP_EQ) != Taken) {
+        continue;
+      }
+      Value *LHS = Cmp->getOperand(0);
+      Value *RHS = Cmp->getOperand(1);
+      // Pointers equal by comparison may still point to different objects.
+      if (!LHS->getType()->isIntegerTy()) {
+        continue;
+      }
+      if (auto *C = dyn_cast<ConstantInt>(RHS)) {
+        addEqualityFact(LHS, C, To, DT);
+      } else if (auto *C = dyn_cast<ConstantInt>(LHS)) {
+        addEqualityFact(RHS, C, To, DT);
+      }
+    }
+  }
+}
+
+Constant *Solver::getPredicateConstant(const Use &U) const {
+  return PredicateConstants.lookup(&U);
+}
+
 /**
  *  Private methods!
  */
 
-void Solver::visitBinaryOperator(Instruction &I) {
-  outs() << "Visited binary operator instruction ";
-  I.print(outs());
-  outs() << "\n";
-  LatticeVal V1State = getValueState(I.getOperand(0));
-  LatticeVal V2State = getValueState(I.getOperand(1));
+void Solver::addEqualityFact(Value *V, Constant *C, BasicBlock *Region,
+                             DominatorTree &DT) {
+  if (isa<Constant>(V)) {
+    return;
+  }
+  for (const Use &U : V->uses()) {
+    auto *UI = dyn_cast<Instruction>(U.getUser());
+    if (!UI) {
+      continue;
+    }
+    // A PHI uses its value at the end of the incoming block.
+    BasicBlock *UseBB = UI->getParent();
+    if (auto *PN = dyn_cast<PHINode>(UI)) {
+      UseBB = PN->getIncomingBlock(U);
+    }
+    // Nested branches on the same value agree, or the inner region is never
+    // executed. Either fact will do.
+    if (DT.dominates(Region, UseBB)) {
+      PredicateConstants.try_emplace(&U, C);
+    }
+  }
+}
+
+LatticeVal Solver::getOperandState(Instruction &I, unsigned ID,
+                                   unsigned OpNo) {
+  if (!PredicateConstants.empty()) {
+    if (Constant *C = getPredicateConstant(I.getOperandUse(OpNo))) {
+      // Only the region of a feasible edge is executable, and there the
+      // value is C whatever the solver knows about it elsewhere.
+      LatticeVal Refined;
+      Refined.markConstant(C);
+      return Refined;
+    }
+  }
+  unsigned OpID = Users.getOperandID(ID, OpNo);
+  if (OpID != UserGraph::NoID) {
+    return NumberedState[OpID];
+  }
+  return getConstantState(I.getOperand(OpNo));
+}
+
+LatticeVal Solver::getConstantState(Value *V) {
+  LatticeVal LV;
+  if (auto *C = dyn_cast<Constant>(V)) {
+    // Undef values remain unknown.
+    if (!isa<UndefValue>(V)) {
+      LV.markConstant(C);
+    }
+  }
+  // All others are underdefined by default.
+  return LV;
+}
+
+Constant *Solver::foldConstants(Instruction &I, Constant *LHS, Constant *RHS,
+                                const DataLayout &DL) {
+  Value *R;
+  if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+    R = simplifyCmpInst(Cmp->getPredicate(), LHS, RHS, SimplifyQuery(DL, &I));
+  } else {
+    R = simplifyBinOp(I.getOpcode(), LHS, RHS, SimplifyQuery(DL, &I));
+  }
+  return dyn_cast_or_null<Constant>(R);
+}
+
+void Solver::visit(Instruction &I, unsigned ID) {
+  if (auto *PN = dyn_cast<PHINode>(&I)) {
+    return visitPHINode(*PN, ID);
+  }
+  if (isa<BinaryOperator>(I)) {
+    return visitBinaryOperator(I, ID);
+  }
+  if (auto *Cmp = dyn_cast<CmpInst>(&I)) {
+    return visitCmpInst(*Cmp, ID);
+  }
+  if (auto *CB = dyn_cast<CallBase>(&I)) {
+    return visitCallBase(*CB, ID);
+  }
+  // A return has no value and no successors.
+  if (isa<ReturnInst>(I)) {
+    return;
+  }
+  if (I.isTerminator()) {
+    return visitTerminator(I, ID);
+  }
+  visitInstruction(I, ID);
+}
 
-  LatticeVal &IV = ValueState[&I];
+void Solver::visitBlock(BasicBlock *BB) {
+  unsigned BlockID = Users.getBlockID(BB);
+  for (unsigned ID = Users.getBlockBegin(BlockID),
+                End = Users.getBlockEnd(BlockID);
+       ID != End; ++ID) {
+    visit(*Users.getInstruction(ID), ID);
+  }
+}
+
+void Solver::visitBinaryOperator(Instruction &I, unsigned ID) {
+  LLVM_DEBUG(dbgs() << "Visited binary operator instruction " << I << "\n");
+  LatticeVal V1State = getOperandState(I, ID, 0);
+  LatticeVal V2State = getOperandState(I, ID, 1);
+
+  LatticeVal &IV = NumberedState[ID];
   if (IV.isOverdefined()) {
-    outs() << "Instruction already marked as overdefined\n";
+    LLVM_DEBUG(dbgs() << "Instruction already marked as overdefined\n");
     // Fast exit
     return;
   }
 
   if (V1State.isConstant() && V2State.isConstant()) {
     // Try to calculate value from two constants
-    Value *R = simplifyBinOp(
-      I.getOpcode(),
-      V1State.getConstant(),
-      V2State.getConstant(),\
-      SimplifyQuery(DL, &I)
-    );
-    Constant *C = dyn_cast<Constant>(R);
-    markConstant(&I, C);
-    outs() << "Calculated new constant value ";
-    C->print(outs());
-    outs() << " for instruction.\n";
+    Constant *C =
+        foldConstants(I, V1State.getConstant(), V2State.getConstant(), *DL);
+    if (!C) {
+      markOverdefined(IV, &I);
+      return;
+    }
+    markConstant(IV, &I, C);
+    LLVM_DEBUG(dbgs() << "Calculated new constant value " << *C
+                      << " for instruction.\n");
 
     return;
   }
 
   if (!V1State.isOverdefined() && !V2State.isOverdefined()) {
-    // One of operand is a constant, another is unknown
-    // Treat resulting value as constant then
-    if (V1State.isConstant()) {
-      markConstant(&I, V1State.getConstant());
-      outs() << "Marked instruction as constant " << V1State.getConstantInt() << "\n";
-    } else {
-      markConstant(&I, V2State.getConstant());
-      outs() << "Marked instruction as constant " << V2State.getConstantInt() << "\n";
-    }
-
+    // One of operands is still unknown, the instruction is visited again
+    // once it gets a value.
+    LLVM_DEBUG(dbgs() << "Operand is unknown, instruction stays unknown.\n");
     return;
   }
   // One of operands is overdefined
   // Resultring value is overdefined also then
-  markOverdefined(&I);
-  outs() << "Marked instruction as overdefined.\n";
+  markOverdefined(IV, &I);
+  LLVM_DEBUG(dbgs() << "Marked instruction as overdefined.\n");
 }
 
-void Solver::visitCmpInst(CmpInst &I) {
-  outs() << "Visited cmp operator instruction ";
-  I.print(outs());
-  outs() << ".\n";
+void Solver::visitCmpInst(CmpInst &I, unsigned ID) {
+  LLVM_DEBUG(dbgs() << "Visited cmp operator instruction " << I << ".\n");
 
-  LatticeVal V1State = getValueState(I.getOperand(0));
-  LatticeVal V2State = getValueState(I.getOperand(1));
+  LatticeVal V1State = getOperandState(I, ID, 0);
+  LatticeVal V2State = getOperandState(I, ID, 1);
 
-  LatticeVal &IV = ValueState[&I];
+  LatticeVal &IV = NumberedState[ID];
   if (IV.isOverdefined()) {
-    outs() << "Instruction already marked as overdefined.\n";
+    LLVM_DEBUG(dbgs() << "Instruction already marked as overdefined.\n");
     // Fast exit
     return;
   }
  
   if (V1State.isConstant() && V2State.isConstant()) {
     // Try to calculate instruction from 2 constants
-    Value *R = simplifyCmpInst(
-      I.getPredicate(),
-      V1State.getConstant(),
-      V2State.getConstant(),\
-      SimplifyQuery(DL, &I)
-    );
-    Constant *C = dyn_cast<Constant>(R);
-    markConstant(&I, C);
-    outs() << "Calculated new constant value ";
-    C->print(outs());
-    outs() << " for instruction.\n";
+    Constant *C =
+        foldConstants(I, V1State.getConstant(), V2State.getConstant(), *DL);
+    if (!C) {
+      markOverdefined(IV, &I);
+      return;
+    }
+    markConstant(IV, &I, C);
+    LLVM_DEBUG(dbgs() << "Calculated new constant value " << *C
+                      << " for instruction.\n");
 
     return;
   }
  
   if (!V1State.isOverdefined() && !V2State.isOverdefined()) {
-    // One of operand is a constant, another is unknown
-    // Treat resulting value as constant then
-    if (V1State.isConstant()) {
-      markConstant(&I, V1State.getConstant());
-      outs() << "Marked instruction as constant " << V1State.getConstantInt() << "\n";
-    } else {
-      markConstant(&I, V2State.getConstant());
-      outs() << "Marked instruction as constant " << V2State.getConstantInt() << "\n";
-    }
-
+    // One of operands is still unknown, the instruction is visited again
+    // once it gets a value.
+    LLVM_DEBUG(dbgs() << "Operand is unknown, instruction stays unknown.\n");
     return;
   }
 
   // One of operands is overdefined
   // Resultring value is overdefined also then
-  markOverdefined(&I);
-  outs() << "Marked instruction as overdefined.\n";
+  markOverdefined(IV, &I);
+  LLVM_DEBUG(dbgs() << "Marked instruction as overdefined.\n");
 }
 
-void Solver::visitTerminator(Instruction &I) {
-  outs() << "Visited terminator instruction ";
-  I.print(outs());
-  outs() << "\n";
+void Solver::visitTerminator(Instruction &I, unsigned ID) {
+  LLVM_DEBUG(dbgs() << "Visited terminator instruction " << I << "\n");
   SmallVector<bool, 16> SuccFeasible;
-  getFeasibleSuccessors(I, SuccFeasible);
+  getFeasibleSuccessors(I, ID, SuccFeasible);
  
   BasicBlock *BB = I.getParent();
  
@@ -224,48 +470,46 @@ void Solver::visitTerminator(Instruction &I) {
   for (unsigned i = 0, e = SuccFeasible.size(); i != e; ++i)
     if (SuccFeasible[i]) {
       markEdgeExecutable(BB, I.getSuccessor(i));
-      outs() << "Marked edge ";
-      I.getSuccessor(i)->print(outs());
-      outs() << " as executable.\n";
+      LLVM_DEBUG(dbgs() << "Marked edge " << *I.getSuccessor(i)
+                        << " as executable.\n");
     }
 }
 
-void Solver::visitPHINode(PHINode &PN) {
-  outs() << "Visited phi instruction ";
-  PN.print(outs());
-  outs() << ".\n";
+void Solver::visitPHINode(PHINode &PN, unsigned ID) {
+  LLVM_DEBUG(dbgs() << "Visited phi instruction " << PN << ".\n");
 
   // Structs are not supported
   if (PN.getType()->isStructTy()) {
-    outs() << "Structs are not supported.";
+    LLVM_DEBUG(dbgs() << "Structs are not supported.");
     return (void)markOverdefined(&PN);
   }
   
   // Fast exit
-  if (getValueState(&PN).isOverdefined()) {
-    outs() << "Instruction already marked as overdefined\n";
+  LatticeVal &State = NumberedState[ID];
+  if (State.isOverdefined()) {
+    LLVM_DEBUG(dbgs() << "Instruction already marked as overdefined\n");
     return;
   }
   
   // Super-extra-high-degree PHI nodes are unlikely to ever be marked constant,
   // and slow us down a lot.  Just mark them overdefined. (Taken from orig llvm code)
   if (PN.getNumIncomingValues() > 64)
-    return (void)markOverdefined(&PN);
+    return (void)markOverdefined(State, &PN);
  
-  LatticeVal PhiState = getValueState(&PN);
+  // Merge the values of the feasible incoming edges and only then update the
+  // state of the PHI, so its users are revisited on a change.
+  LatticeVal PhiState;
   for (unsigned i = 0; i < PN.getNumIncomingValues(); i++) {
-    LatticeVal &IV = getValueState(PN.getIncomingValue(i));
+    LatticeVal IV = getOperandState(PN, ID, i);
     if (IV.isUnknown()) {
-      outs() << "Skipped edge ";
-      PN.getIncomingBlock(i)->print(outs());
-      outs() << " as it's value is unknown.";
+      LLVM_DEBUG(dbgs() << "Skipped edge " << *PN.getIncomingBlock(i)
+                        << " as it's value is unknown.");
       continue;
     }
     // Skip all not executable operands
     if (!isEdgeFeasible(PN.getIncomingBlock(i), PN.getParent())) {
-      outs() << "Skipped edge ";
-      PN.getIncomingBlock(i)->print(outs());
-      outs() << " as it is not feasible.";
+      LLVM_DEBUG(dbgs() << "Skipped edge " << *PN.getIncomingBlock(i)
+                        << " as it is not feasible.");
       continue;
     }
 
@@ -273,21 +517,44 @@ void Solver::visitPHINode(PHINode &PN) {
     // then the phi-node value is also overdefined (conservative way)
     // Stop calculation - we know for sure it is not a constant
     if (IV.isOverdefined()) {
-      PhiState.markOverdefined();
-      outs() << "Marked instruction as overdefined.\n";
-      break;
+      markOverdefined(State, &PN);
+      LLVM_DEBUG(dbgs() << "Marked instruction as overdefined.\n");
+      return;
     }
 
-    // If incoming value is constant -
-    // then mark phi-node value is constant also
-    if (IV.isConstant()) {
-      PhiState.markConstant(IV.getConstant());
-      outs() << "Marked instruction as constant " << IV.getConstantInt() << "\n";
+    // Two different constants on feasible edges, not a constant either.
+    if (PhiState.isConstant() && PhiState.getConstant() != IV.getConstant()) {
+      markOverdefined(State, &PN);
+      LLVM_DEBUG(dbgs() << "Marked instruction as overdefined.\n");
+      return;
     }
+    PhiState.markConstant(IV.getConstant());
+  }
+
+  // If all feasible incoming values are the same constant -
+  // then mark phi-node value is constant also
+  if (PhiState.isConstant()) {
+    markConstant(State, &PN, PhiState.getConstant());
+    LLVM_DEBUG(dbgs() << "Marked instruction as constant "
+                      << PhiState.getConstantInt() << "\n");
   }
 }
 
-void Solver::visitReturnInst(ReturnInst &I) {}
+void Solver::visitCallBase(CallBase &CB, unsigned ID) {
+  visitInstruction(CB, ID);
+  // invoke and callbr continue in their successors.
+  if (CB.isTerminator()) {
+    visitTerminator(CB, ID);
+  }
+}
+
+void Solver::visitInstruction(Instruction &I, unsigned ID) {
+  // Everything not modelled above (loads, calls, casts, ...) may produce any
+  // value.
+  if (!I.getType()->isVoidTy()) {
+    markOverdefined(NumberedState[ID], &I);
+  }
+}
 
 bool Solver::isEdgeFeasible(BasicBlock *From, BasicBlock *To) {
   if (KnownFeasibleEdges.count(Edge(From, To))) {
@@ -296,7 +563,7 @@ bool Solver::isEdgeFeasible(BasicBlock *From, BasicBlock *To) {
   return false;
 }
 
-void Solver::getFeasibleSuccessors(Instruction &I,
+void Solver::getFeasibleSuccessors(Instruction &I, unsigned ID,
                                    SmallVector<bool, 16> &Succs) {
   Succs.resize(I.getNumSuccessors());
   if (auto *BI = dyn_cast<BranchInst>(&I)) {
@@ -305,7 +572,8 @@ void Solver::getFeasibleSuccessors(Instruction &I,
       return;
     }
 
-    LatticeVal BCValue = getValueState(BI->getCondition());
+    // The condition is the first operand of a conditional branch.
+    LatticeVal BCValue = getOperandState(I, ID, 0);
     ConstantInt *CI = BCValue.getConstantInt();
     if (!CI) {
       if (!BCValue.isUnknown()) {
@@ -316,7 +584,8 @@ void Solver::getFeasibleSuccessors(Instruction &I,
     Succs[CI->isZero()] = true;
     return;
   }
-  assert(false && "Unsupported Terminator!");
+  // Other terminators are not evaluated, all of their successors may run.
+  Succs.assign(I.getNumSuccessors(), true);
 }
 
 bool Solver::markEdgeExecutable(BasicBlock *Source, BasicBlock *Dest) {
@@ -324,19 +593,30 @@ bool Solver::markEdgeExecutable(BasicBlock *Source, BasicBlock *Dest) {
     return false;
   }
   if (!markBlockExecutable(Dest)) {
-    for (PHINode &PN : Dest->phis()) {
-      visitPHINode(PN);
+    // Only the PHIs see the new edge, they come first.
+    unsigned BlockID = Users.getBlockID(Dest);
+    for (unsigned ID = Users.getBlockBegin(BlockID),
+                  End = Users.getBlockEnd(BlockID);
+         ID != End; ++ID) {
+      auto *PN = dyn_cast<PHINode>(Users.getInstruction(ID));
+      if (!PN) {
+        break;
+      }
+      visitPHINode(*PN, ID);
     }
   }
   return true;
 }
 
 void Solver::pushToWorkList(LatticeVal &IV, Value *V) {
+  unsigned ID = &IV - NumberedState.data();
+  assert(ID < NumberedState.size() && Users.getValue(ID) == V &&
+         "Only numbered values get into the work list");
   if (IV.isOverdefined()) {
-    OverdefinedInstWorkList.push_back(V);
+    OverdefinedInstWorkList.push_back(ID);
     return;
   }
-  InstWorkList.push_back(V);
+  InstWorkList.push_back(ID);
 }
 
 bool Solver::markConstant(LatticeVal &IV, Value *V, Constant *C) {
@@ -347,10 +627,6 @@ bool Solver::markConstant(LatticeVal &IV, Value *V, Constant *C) {
   return true;
 }
 
-bool Solver::markConstant(Value *V, Constant *C) {
-  return markConstant(ValueState[V], V, C);
-}
-
 bool Solver::markOverdefined(LatticeVal &IV, Value *V) {
   if (!IV.markOverdefined()) {
     return false;
@@ -360,35 +636,40 @@ bool Solver::markOverdefined(LatticeVal &IV, Value *V) {
   return true;
 }
 
-void Solver::markUsersAsChanged(Value *I) {
-  for (User *U : I->users()) {
-    if (auto *UI = dyn_cast<Instruction>(U)) {
-      if (BBExecutable.count(UI->getParent())) {
-        visit(*UI);
-      }
+void Solver::markUsersAsChanged(unsigned ID) {
+  ArrayRef<UserGraph::UserEdge> Edges = Users.users(ID);
+  for (size_t i = 0, e = Edges.size(); i != e; ++i) {
+#if defined(__GNUC__)
+    // The visit is what misses the cache, the next user is already known.
+    if (i + 1 != e) {
+      __builtin_prefetch(Edges[i + 1].Inst);
+      __builtin_prefetch(&NumberedState[Edges[i + 1].ID]);
+    }
+#endif
+    if (ExecutableBlocks.test(Edges[i].BlockID)) {
+      visit(*Edges[i].Inst, Edges[i].ID);
     }
   }
 }
 
 LatticeVal &Solver::getValueState(Value *V) {
+  if (UserGraph::isNumbered(V)) {
+    if (Users.empty()) {
+      Function *F = isa<Argument>(V) ? cast<Argument>(V)->getParent()
+                                     : cast<Instruction>(V)->getFunction();
+      buildUserGraph(*F);
+    }
+    return NumberedState[Users.getID(V)];
+  }
   assert(!V->getType()->isStructTy() && "StructType is unsupported");
 
   std::pair<DenseMap<Value *, LatticeVal>::iterator, bool> I =
       ValueState.insert(std::make_pair(V, LatticeVal()));
   LatticeVal &LV = I.first->second;
 
-  if (!I.second) {
-    return LV; // Common case, already in the map.
+  if (I.second) {
+    LV = getConstantState(V);
   }
-
-  if (auto *C = dyn_cast<Constant>(V)) {
-    // Undef values remain unknown.
-    if (!isa<UndefValue>(V)) {
-      LV.markConstant(C);
-    }
-  }
-
-  // All others are underdefined by default.
   return LV;
 }
 } // namespace trainOpt
@@ -0,0 +1,147 @@
+//===- Inliner.cpp - Bottom-up inlining of small leaf functions -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SCCIterator.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/CallGraph.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "topt/IPO/Inliner.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-inline"
+
+STATISTIC(NumInlined, "Number of call sites inlined");
+STATISTIC(NumDeleted, "Number of local functions deleted after inlining");
+
+static cl::opt<unsigned> InlineThreshold(
+    "topt-inline-threshold",
+    cl::desc("Maximum number of instructions of a function topt-inline "
+             "inlines"),
+    cl::init(24));
+
+namespace llvm::trainOpt {
+/** isLeaf - Whether F calls nothing but intrinsics. */
+static bool isLeaf(const Function &F) {
+  for (const Instruction &I : instructions(F)) {
+    if (const auto *CB = dyn_cast<CallBase>(&I)) {
+      const Function *Callee = CB->getCalledFunction();
+      if (!Callee || !Callee->isIntrinsic()) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ *  isInlineCandidate - Whether calls to F are replaced by its body. Memoized
+ *  in Candidates: bottom-up, a function is done changing before the first
+ *  of its callers asks.
+ */
+static bool isInlineCandidate(const Function &F,
+                              DenseMap<const Function *, bool> &Candidates) {
+  auto [It, Inserted] = Candidates.try_emplace(&F, false);
+  if (!Inserted) {
+    return It->second;
+  }
+  // Interposable bodies may be replaced at link time.
+  if (F.isDeclaration() || F.isInterposable() || F.isVarArg() ||
+      F.hasFnAttribute(Attribute::NoInline)) {
+    return false;
+  }
+  It->second = F.getInstructionCount() <= InlineThreshold && isLeaf(F);
+  return It->second;
+}
+
+static bool inlineCallsIn(Function &F,
+                          DenseMap<const Function *, bool> &Candidates) {
+  SmallVector<CallBase *, 8> Calls;
+  for (Instruction &I : instructions(F)) {
+    auto *CB = dyn_cast<CallBase>(&I);
+    if (!CB) {
+      continue;
+    }
+    // InlineFunction does not look at the attributes of the call site.
+    if (CB->isNoInline()) {
+      continue;
+    }
+    Function *Callee = CB->getCalledFunction();
+    if (Callee && Callee != &F &&
+        Callee->getFunctionType() == CB->getFunctionType() &&
+        isInlineCandidate(*Callee, Candidates)) {
+      Calls.push_back(CB);
+    }
+  }
+
+  bool Changed = false;
+  for (CallBase *CB : Calls) {
+    // Only read by the debug output, CB is gone once it is inlined.
+    [[maybe_unused]] Function *Callee = CB->getCalledFunction();
+    // Splits the block at the call and joins multiple returns with a PHI in
+    // the block after it.
+    InlineFunctionInfo IFI;
+    InlineResult Result = InlineFunction(*CB, IFI);
+    if (!Result.isSuccess()) {
+      LLVM_DEBUG(dbgs() << "topt-inline: not inlining " << Callee->getName()
+                        << " into " << F.getName() << ": "
+                        << Result.getFailureReason() << "\n");
+      continue;
+    }
+    LLVM_DEBUG(dbgs() << "topt-inline: inlined " << Callee->getName()
+                      << " into " << F.getName() << "\n");
+    ++NumInlined;
+    Changed = true;
+  }
+  return Changed;
+}
+
+PreservedAnalyses InlinerPass::run(Module &M, ModuleAnalysisManager &AM) {
+  // The order is taken up front, inlining leaves the call graph stale.
+  CallGraph CG(M);
+  SmallVector<Function *, 16> BottomUp;
+  for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I) {
+    for (CallGraphNode *N : *I) {
+      Function *F = N->getFunction();
+      if (F && !F->isDeclaration()) {
+        BottomUp.push_back(F);
+      }
+    }
+  }
+
+  DenseMap<const Function *, bool> Candidates;
+  bool Changed = false;
+  for (Function *F : BottomUp) {
+    Changed |= inlineCallsIn(*F, Candidates);
+  }
+
+  // Top-down, so callers are gone before their callees are looked at.
+  for (Function *F : llvm::reverse(BottomUp)) {
+    F->removeDeadConstantUsers();
+    if (F->hasLocalLinkage() && F->use_empty()) {
+      F->eraseFromParent();
+      ++NumDeleted;
+      Changed = true;
+    }
+  }
+
+  if (!Changed) {
+    return PreservedAnalyses::all();
+  }
+  return PreservedAnalyses::none();
+}
+} // namespace llvm::trainOpt
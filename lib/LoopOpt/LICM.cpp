@@ -0,0 +1,151 @@
+//===- LICM.cpp - Loop invariant code motion ------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/LoopIterator.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/LoopUtils.h>
+
+#include "topt/LoopOpt/LICM.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-licm"
+
+STATISTIC(NumHoisted, "Number of instructions hoisted into preheaders");
+STATISTIC(NumSunk, "Number of instructions sunk into exit blocks");
+STATISTIC(NumPreheadersCreated, "Number of loop preheaders created");
+
+namespace llvm::trainOpt {
+/**
+ *  canMove - Whether I may run somewhere else than where it is, also when
+ *  the original block would not have run it.
+ */
+static bool canMove(Instruction &I) {
+  // PHIs belong to their block, terminators and EH pads to the CFG.
+  if (isa<PHINode>(I) || isa<AllocaInst>(I) || I.isTerminator() ||
+      I.isEHPad()) {
+    return false;
+  }
+  return !I.mayReadOrWriteMemory() && isSafeToSpeculativelyExecute(&I);
+}
+
+static bool hoistInvariants(Loop &L, LoopInfo &LI, BasicBlock &Preheader) {
+  bool Changed = false;
+  // Dominators first, so operands are hoisted before their users are looked
+  // at. Blocks of inner loops were done when the inner loop was.
+  LoopBlocksRPO RPOT(&L);
+  RPOT.perform(&LI);
+  for (BasicBlock *BB : RPOT) {
+    if (LI.getLoopFor(BB) != &L) {
+      continue;
+    }
+    for (Instruction &I : make_early_inc_range(*BB)) {
+      if (!canMove(I) || !L.hasLoopInvariantOperands(&I)) {
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "topt-licm: hoisting " << I << "\n");
+      // The preheader always runs, the original block maybe not.
+      I.dropUBImplyingAttrsAndMetadata();
+      I.moveBefore(Preheader.getTerminator());
+      ++NumHoisted;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+static bool sinkToExit(Loop &L, LoopInfo &LI, DominatorTree &DT) {
+  // Only an exit block reached from nowhere but the loop sees the values of
+  // the last iteration.
+  BasicBlock *Exit = L.getUniqueExitBlock();
+  if (!Exit || Exit->isEHPad() ||
+      !all_of(predecessors(Exit),
+              [&L](BasicBlock *Pred) { return L.contains(Pred); })) {
+    return false;
+  }
+
+  bool Changed = false;
+  // Users first, so a chain only used after the loop sinks as a whole.
+  LoopBlocksRPO RPOT(&L);
+  RPOT.perform(&LI);
+  for (BasicBlock *BB : reverse(RPOT)) {
+    if (LI.getLoopFor(BB) != &L) {
+      continue;
+    }
+    for (Instruction &I : make_early_inc_range(reverse(*BB))) {
+      if (I.use_empty() || !canMove(I)) {
+        continue;
+      }
+      bool OnlyUsedAfterLoop = all_of(I.uses(), [&](Use &U) {
+        auto *User = cast<Instruction>(U.getUser());
+        BasicBlock *UseBB = User->getParent();
+        // A PHI uses its value at the end of the incoming block.
+        if (auto *Phi = dyn_cast<PHINode>(User)) {
+          UseBB = Phi->getIncomingBlock(U);
+        }
+        return DT.dominates(Exit, UseBB);
+      });
+      if (!OnlyUsedAfterLoop) {
+        continue;
+      }
+      LLVM_DEBUG(dbgs() << "topt-licm: sinking " << I << "\n");
+      I.moveBefore(&*Exit->getFirstInsertionPt());
+      ++NumSunk;
+      Changed = true;
+    }
+  }
+  return Changed;
+}
+
+PreservedAnalyses LICMPass::run(Function &F, FunctionAnalysisManager &AM) {
+  LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+  DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+
+  bool Changed = false;
+  bool CFGChanged = false;
+  // Innermost first, what an inner loop hoists into its preheader may be
+  // invariant in the enclosing loop too.
+  SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+  for (Loop *L : reverse(Loops)) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    if (!Preheader) {
+      // Keeps DT and LI up to date.
+      Preheader = InsertPreheaderForLoop(L, &DT, &LI, /*MSSAU=*/nullptr,
+                                         /*PreserveLCSSA=*/false);
+      if (Preheader) {
+        ++NumPreheadersCreated;
+        Changed = CFGChanged = true;
+      }
+    }
+    if (Preheader) {
+      Changed |= hoistInvariants(*L, LI, *Preheader);
+    }
+    Changed |= sinkToExit(*L, LI, DT);
+  }
+
+  if (!Changed) {
+    return PreservedAnalyses::all();
+  }
+  PreservedAnalyses PA;
+  PA.preserve<DominatorTreeAnalysis>();
+  PA.preserve<LoopAnalysis>();
+  if (!CFGChanged) {
+    PA.preserveSet<CFGAnalyses>();
+  }
+  return PA;
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,264 @@
+//===- StrengthReduce.cpp - Strength reduction of loop arithmetic ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/Analysis/ValueTracking.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/Debug.h>
+#include <llvm/Support/KnownBits.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "topt/DataFlow/SCCPSolver.h"
+#include "topt/LoopOpt/StrengthReduce.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-strength-reduce"
+
+STATISTIC(NumMulsReduced, "Number of induction variable products reduced");
+STATISTIC(NumIVsCreated, "Number of induction variables created");
+STATISTIC(NumDivsReduced, "Number of divisions by a power of two reduced");
+STATISTIC(NumRemsReduced, "Number of remainders by a power of two reduced");
+
+namespace llvm::trainOpt {
+/**
+ *  AffineIV - %iv = phi [ Start, %preheader ], [ Next, %latch ] with
+ *  Next = add %iv, Step and Step invariant in the loop.
+ */
+struct AffineIV {
+  PHINode *Phi;
+  Value *Start;
+  Value *Step;
+  Instruction *Next;
+};
+
+static bool matchAffineIV(Loop &L, PHINode &Phi, BasicBlock &Preheader,
+                          BasicBlock &Latch, AffineIV &IV) {
+  if (!Phi.getType()->isIntegerTy() || Phi.getNumIncomingValues() != 2) {
+    return false;
+  }
+  auto *Next = dyn_cast<BinaryOperator>(Phi.getIncomingValueForBlock(&Latch));
+  if (!Next || Next->getOpcode() != Instruction::Add ||
+      !L.contains(Next->getParent())) {
+    return false;
+  }
+  Value *Step = nullptr;
+  if (Next->getOperand(0) == &Phi) {
+    Step = Next->getOperand(1);
+  } else if (Next->getOperand(1) == &Phi) {
+    Step = Next->getOperand(0);
+  }
+  if (!Step || !L.isLoopInvariant(Step)) {
+    return false;
+  }
+  IV = {&Phi, Phi.getIncomingValueForBlock(&Preheader), Step, Next};
+  return true;
+}
+
+/**
+ *  reduceProducts - Replace every Mul of IV and a loop invariant factor by
+ *  an induction variable starting at Start * Factor and advancing by
+ *  Step * Factor. Both are computed once in the preheader. Wrapping is
+ *  the same on both sides, so the products are equal in every iteration.
+ */
+static bool reduceProducts(Loop &L, const AffineIV &IV, BasicBlock &Preheader,
+                           BasicBlock &Latch) {
+  SmallVector<BinaryOperator *, 4> Muls;
+  for (User *U : IV.Phi->users()) {
+    auto *Mul = dyn_cast<BinaryOperator>(U);
+    if (Mul && Mul->getOpcode() == Instruction::Mul &&
+        L.contains(Mul->getParent())) {
+      Muls.push_back(Mul);
+    }
+  }
+
+  // One induction variable per factor, products with the same factor share
+  // it.
+  DenseMap<Value *, PHINode *> Scaled;
+  bool Changed = false;
+  for (BinaryOperator *Mul : Muls) {
+    Value *Factor = Mul->getOperand(0) == IV.Phi ? Mul->getOperand(1)
+                                                 : Mul->getOperand(0);
+    if (!L.isLoopInvariant(Factor)) {
+      continue;
+    }
+    PHINode *&ScaledIV = Scaled[Factor];
+    if (!ScaledIV) {
+      IRBuilder<> PB(Preheader.getTerminator());
+      Value *ScaledStart = PB.CreateMul(IV.Start, Factor,
+                                        IV.Phi->getName() + ".scaled.start");
+      // Counting loops step by one, their products by the factor itself.
+      auto *StepC = dyn_cast<ConstantInt>(IV.Step);
+      Value *ScaledStep =
+          StepC && StepC->isOne()
+              ? Factor
+              : PB.CreateMul(IV.Step, Factor,
+                             IV.Phi->getName() + ".scaled.step");
+
+      BasicBlock *Header = L.getHeader();
+      IRBuilder<> HB(Header, Header->begin());
+      ScaledIV = HB.CreatePHI(IV.Phi->getType(), 2,
+                              IV.Phi->getName() + ".scaled");
+      // Next dominates the end of the latch, so does what follows it.
+      IRBuilder<> NB(IV.Next->getParent(), std::next(IV.Next->getIterator()));
+      Value *ScaledNext = NB.CreateAdd(ScaledIV, ScaledStep,
+                                       IV.Phi->getName() + ".scaled.next");
+      ScaledIV->addIncoming(ScaledStart, &Preheader);
+      ScaledIV->addIncoming(ScaledNext, &Latch);
+      ++NumIVsCreated;
+    }
+    LLVM_DEBUG(dbgs() << "topt-strength-reduce: " << *Mul << " becomes "
+                      << *ScaledIV << "\n");
+    Mul->replaceAllUsesWith(ScaledIV);
+    Mul->eraseFromParent();
+    ++NumMulsReduced;
+    Changed = true;
+  }
+  return Changed;
+}
+
+static bool reduceInductionProducts(LoopInfo &LI) {
+  bool Changed = false;
+  for (Loop *L : LI.getLoopsInPreorder()) {
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!Preheader || !Latch) {
+      continue;
+    }
+    // The scaled PHIs go into the header too, look at the original ones.
+    SmallVector<PHINode *, 4> Phis;
+    for (PHINode &Phi : L->getHeader()->phis()) {
+      Phis.push_back(&Phi);
+    }
+    for (PHINode *Phi : Phis) {
+      AffineIV IV;
+      if (matchAffineIV(*L, *Phi, *Preheader, *Latch, IV)) {
+        Changed |= reduceProducts(*L, IV, *Preheader, *Latch);
+      }
+    }
+  }
+  return Changed;
+}
+
+/**
+ *  getConstantDivisor - V itself if it is a ConstantInt, otherwise the
+ *  constant the solver proved it to be, or null.
+ */
+static ConstantInt *getConstantDivisor(Solver &Solver, Value *V) {
+  if (auto *C = dyn_cast<ConstantInt>(V)) {
+    return C;
+  }
+  // Only instructions in executable blocks are sure to have a state.
+  if (!isa<Instruction>(V)) {
+    return nullptr;
+  }
+  return Solver.getLatticeValueFor(V).getConstantInt();
+}
+
+static bool isNonNegative(Solver &Solver, Value *V, const DataLayout &DL) {
+  if (auto *C = getConstantDivisor(Solver, V)) {
+    return !C->isNegative();
+  }
+  return computeKnownBits(V, DL).isNonNegative();
+}
+
+/** DivisionToReduce - A division or remainder by the power of two Divisor. */
+struct DivisionToReduce {
+  BinaryOperator *I;
+  ConstantInt *Divisor;
+};
+
+static bool reduceDivisions(Function &F, const DataLayout &DL,
+                            const TargetLibraryInfo *TLI) {
+  Solver &Solver = getThreadSolver(DL, TLI);
+  for (Argument &AI : F.args()) {
+    Solver.markOverdefined(&AI);
+  }
+  Solver.markBlockExecutable(&F.front());
+  Solver.solve();
+
+  // All decisions are made on the IR the solver saw. The solver knows
+  // nothing of the instructions a rewrite creates, and a later division may
+  // use them.
+  SmallVector<DivisionToReduce, 8> Divisions;
+  for (BasicBlock &BB : F) {
+    if (!Solver.isBlockExecutable(&BB)) {
+      continue;
+    }
+    for (Instruction &I : BB) {
+      unsigned Opcode = I.getOpcode();
+      if (Opcode != Instruction::UDiv && Opcode != Instruction::URem &&
+          Opcode != Instruction::SDiv && Opcode != Instruction::SRem) {
+        continue;
+      }
+      ConstantInt *Divisor = getConstantDivisor(Solver, I.getOperand(1));
+      if (!Divisor || !Divisor->getValue().isPowerOf2()) {
+        continue;
+      }
+      bool IsSigned =
+          Opcode == Instruction::SDiv || Opcode == Instruction::SRem;
+      // Signed, the quotient rounds towards zero and the remainder takes the
+      // sign of the dividend, the shift and the mask only agree on
+      // non-negative values. The divisor must not be the minimum value.
+      if (IsSigned && (Divisor->isNegative() ||
+                       !isNonNegative(Solver, I.getOperand(0), DL))) {
+        continue;
+      }
+      Divisions.push_back({cast<BinaryOperator>(&I), Divisor});
+    }
+  }
+
+  for (auto [I, Divisor] : Divisions) {
+    // A dividend reduced before is the same value, only cheaper.
+    Value *Dividend = I->getOperand(0);
+    IRBuilder<> B(I);
+    const APInt &D = Divisor->getValue();
+    Value *Reduced;
+    unsigned Opcode = I->getOpcode();
+    if (Opcode == Instruction::UDiv || Opcode == Instruction::SDiv) {
+      Reduced = B.CreateLShr(Dividend, D.logBase2(), "", I->isExact());
+      ++NumDivsReduced;
+    } else {
+      Reduced = B.CreateAnd(Dividend, ConstantInt::get(I->getType(), D - 1));
+      ++NumRemsReduced;
+    }
+    LLVM_DEBUG(dbgs() << "topt-strength-reduce: " << *I << " becomes "
+                      << *Reduced << "\n");
+    // A constant dividend folds, constants have no names.
+    if (isa<Instruction>(Reduced)) {
+      Reduced->takeName(I);
+    }
+    I->replaceAllUsesWith(Reduced);
+    I->eraseFromParent();
+  }
+  return !Divisions.empty();
+}
+
+PreservedAnalyses StrengthReducePass::run(Function &F,
+                                          FunctionAnalysisManager &AM) {
+  LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+  auto &TLI = AM.getResult<TargetLibraryAnalysis>(F);
+
+  // Products first, the solver then sees the final instructions.
+  bool Changed = reduceInductionProducts(LI);
+  Changed |= reduceDivisions(F, F.getDataLayout(), &TLI);
+
+  if (!Changed) {
+    return PreservedAnalyses::all();
+  }
+  PreservedAnalyses PA;
+  PA.preserveSet<CFGAnalyses>();
+  return PA;
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,68 @@
+//===- Passes.cpp - Pipeline names of the topt passes ---------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/Passes/PassBuilder.h>
+
+#include "topt/Cleanup/Cleanup.h"
+#include "topt/DataFlow/ADCE.h"
+#include "topt/DataFlow/SCCP.h"
+#include "topt/DataFlow/SSCP.h"
+#include "topt/IPO/Inliner.h"
+#include "topt/LocalOpt/LVN.h"
+#include "topt/LoopOpt/LICM.h"
+#include "topt/LoopOpt/StrengthReduce.h"
+#include "topt/Passes/Passes.h"
+
+using namespace llvm;
+
+namespace llvm::trainOpt {
+void registerPassBuilderCallbacks(PassBuilder &PB) {
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, FunctionPassManager &PM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name == "topt-sccp") {
+          PM.addPass(trainOpt::SCCPPass{});
+          return true;
+        }
+        if (Name == "topt-sscp") {
+          PM.addPass(trainOpt::SSCPPass{});
+          return true;
+        }
+        if (Name == "topt-lvn") {
+          PM.addPass(trainOpt::LVNPass{});
+          return true;
+        }
+        if (Name == "topt-adce") {
+          PM.addPass(trainOpt::ADCEPass{});
+          return true;
+        }
+        if (Name == "topt-cleanup") {
+          PM.addPass(trainOpt::CleanupPass{});
+          return true;
+        }
+        if (Name == "topt-licm") {
+          PM.addPass(trainOpt::LICMPass{});
+          return true;
+        }
+        if (Name == "topt-strength-reduce") {
+          PM.addPass(trainOpt::StrengthReducePass{});
+          return true;
+        }
+        return false;
+      });
+  PB.registerPipelineParsingCallback(
+      [](StringRef Name, ModulePassManager &PM,
+         ArrayRef<PassBuilder::PipelineElement>) {
+        if (Name == "topt-inline") {
+          PM.addPass(trainOpt::InlinerPass{});
+          return true;
+        }
+        return false;
+      });
+}
+} // namespace llvm::trainOpt
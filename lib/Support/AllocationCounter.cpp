@@ -0,0 +1,109 @@
+//===- AllocationCounter.cpp - Count heap allocations ---------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// glibc exports its allocator under __libc_* names as well, so the public
+// entry points can be interposed by definitions in the executable that count
+// and forward. free is left alone, memory from the wrappers is ordinary glibc
+// memory.
+//
+// Only builds configured with TOPT_ENABLE_ALLOCATION_COUNTER interpose. Not
+// under the sanitizers: their own malloc would be bypassed while their free
+// still gets the memory.
+//
+//===----------------------------------------------------------------------===//
+
+#include "topt/Support/AllocationCounter.h"
+
+#include <cerrno>
+#include <cstddef>
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define TOPT_HAS_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) ||     \
+    __has_feature(memory_sanitizer)
+#define TOPT_HAS_SANITIZER 1
+#endif
+#endif
+
+#if defined(TOPT_ENABLE_ALLOCATION_COUNTER) && defined(__GLIBC__) &&         \
+    !defined(TOPT_HAS_SANITIZER)
+#define TOPT_COUNT_ALLOCATIONS 1
+#endif
+
+namespace {
+// Per thread only, a shared counter would be one cache line written by every
+// allocation of every thread. initial-exec keeps the first access of a thread
+// from allocating itself.
+thread_local uint64_t ThreadCount __attribute__((tls_model("initial-exec"))) =
+    0;
+
+inline void countAllocation() { ++ThreadCount; }
+} // namespace
+
+#ifdef TOPT_COUNT_ALLOCATIONS
+extern "C" {
+void *__libc_malloc(size_t Size);
+void *__libc_calloc(size_t Num, size_t Size);
+void *__libc_realloc(void *Ptr, size_t Size);
+void *__libc_memalign(size_t Alignment, size_t Size);
+
+void *malloc(size_t Size) {
+  countAllocation();
+  return __libc_malloc(Size);
+}
+
+void *calloc(size_t Num, size_t Size) {
+  countAllocation();
+  return __libc_calloc(Num, Size);
+}
+
+void *realloc(void *Ptr, size_t Size) {
+  countAllocation();
+  return __libc_realloc(Ptr, Size);
+}
+
+void *memalign(size_t Alignment, size_t Size) {
+  countAllocation();
+  return __libc_memalign(Alignment, Size);
+}
+
+void *aligned_alloc(size_t Alignment, size_t Size) {
+  countAllocation();
+  return __libc_memalign(Alignment, Size);
+}
+
+int posix_memalign(void **Result, size_t Alignment, size_t Size) {
+  if (Alignment == 0 || Alignment % sizeof(void *) ||
+      (Alignment & (Alignment - 1))) {
+    return EINVAL;
+  }
+  countAllocation();
+  void *Ptr = __libc_memalign(Alignment, Size);
+  if (!Ptr) {
+    return ENOMEM;
+  }
+  *Result = Ptr;
+  return 0;
+}
+} // extern "C"
+#endif // TOPT_COUNT_ALLOCATIONS
+
+namespace llvm {
+namespace trainOpt {
+uint64_t getThreadAllocationCount() { return ThreadCount; }
+
+bool isAllocationCountingSupported() {
+#ifdef TOPT_COUNT_ALLOCATIONS
+  return true;
+#else
+  return false;
+#endif
+}
+} // namespace trainOpt
+} // namespace llvm
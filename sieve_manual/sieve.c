@@ -1,23 +1,25 @@
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
-void sieve(int p, unsigned char* numbers, int upper_bound) {
-    int bit_index, byte_index;
+void sieve(uint64_t p, unsigned char* numbers, uint64_t upper_bound) {
+    uint64_t bit_index, byte_index;
 
-    upper_bound = (int)(upper_bound / p + 1);
-    for (int m = 2; m < upper_bound; m++) {
-        byte_index = (int)(m * p / 8);
+    upper_bound = upper_bound / p + 1;
+    for (uint64_t m = 2; m < upper_bound; m++) {
+        byte_index = m * p / 8;
         bit_index = m * p % 8;
         numbers[byte_index] |= (1 << bit_index);
     }
 }
 
-int next_prime(int p, unsigned char* numbers, int size) {
-    int bit_index, byte_index;
-    int bi = (p + 1) % 8;
+uint64_t next_prime(uint64_t p, unsigned char* numbers, uint64_t size) {
+    uint64_t bit_index, byte_index;
+    uint64_t bi = (p + 1) % 8;
 
-    for (byte_index = (int)((p + 1) / 8); byte_index < size; byte_index++) {
+    for (byte_index = (p + 1) / 8; byte_index < size; byte_index++) {
         for (bit_index = bi; bit_index < 8; bit_index++) {
             if ((numbers[byte_index] & (1 << bit_index)) == 0) {
                 return byte_index * 8 + bit_index;
@@ -29,38 +31,41 @@ int next_prime(int p, unsigned char* numbers, int size) {
     return p;
 }
 
-int print_primes(int n) {
+int print_primes(uint64_t n) {
     /*This function calculates all prime numbers up to given limit (n).
     It is an implementation of "Sieve of Eratosthenes" algorithm in C.*/
 
+    /* Anonymous pages come zeroed, huge pages keep the TLB misses down. */
     size_t numbers_size = (size_t)(n / 8 + 1);
-    unsigned char* numbers = (unsigned char*)calloc(numbers_size, sizeof(unsigned char));
-    if (numbers == NULL) {
+    unsigned char* numbers = (unsigned char*)mmap(NULL, numbers_size, PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (numbers == MAP_FAILED) {
         printf("Unable to allocate memory.\n");
         exit(-1);
     }
+    madvise(numbers, numbers_size, MADV_HUGEPAGE);
 
-    int p = 2;
+    uint64_t p = 2;
 
     while (1) {
         if (p > n) {
-            free(numbers);
+            munmap(numbers, numbers_size);
             return 0;
         }
 
         sieve(p, numbers, n);
-        int new_p = next_prime(p, numbers, numbers_size);
+        uint64_t new_p = next_prime(p, numbers, numbers_size);
 
         if (p != new_p) {
-            printf("%d\n", p);
+            printf("%llu\n", (unsigned long long)p);
             p = new_p;
         } else {
-            free(numbers);
+            munmap(numbers, numbers_size);
             return 0;
         }
     }
 
-    free(numbers);
+    munmap(numbers, numbers_size);
     return -1;
 }
 
@@ -70,7 +75,7 @@ int main(int argc, char* argv[]) {
         exit(-1);
     }
     
-    print_primes(atoi(argv[1]));
+    print_primes(strtoull(argv[1], NULL, 10));
 
     return 0;
 }
\ No newline at end of file
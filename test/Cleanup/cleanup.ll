@@ -0,0 +1,95 @@
+; RUN: topt -passes=topt-cleanup %s -o - | FileCheck %s
+; RUN: topt -passes=topt-cleanup -topt-cleanup-max-iterations=1 %s -o - \
+; RUN:   | FileCheck %s --check-prefix=ONE
+; Round one changes all functions, so the round that would confirm the fixed
+; point is over the limit.
+; RUN: topt -passes=topt-cleanup -topt-cleanup-max-iterations=1 -stats %s \
+; RUN:   -o /dev/null 2>&1 | FileCheck %s --check-prefix=STATS
+; Every function reaches its fixed point within the default limit.
+; RUN: topt -passes=topt-cleanup -stats %s -o /dev/null 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=NOCAP
+
+; SCCP folds %c, which makes %x and %y the same value for LVN, which replaces
+; %y by %x.
+define i32 @foo(i32 %a) {
+  %c = add i32 2, 3
+  %x = add i32 %a, %c
+  %y = add i32 %a, 5
+  %z = mul i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK-LABEL:  define i32 @foo(
+; CHECK-NEXT:   %x = add i32 %a, 5
+; CHECK-NEXT:   %z = mul i32 %x, %x
+; CHECK-NEXT:   ret i32 %z
+
+; ONE-LABEL:    define i32 @foo(
+; ONE-NEXT:     %x = add i32 %a, 5
+; ONE-NEXT:     %z = mul i32 %x, %x
+; ONE-NEXT:     ret i32 %z
+
+; LVN numbers %q before it merges %b into %a, so %q only equals %p in the
+; second round. SCCP erases %d2 and leaves %d1 to dead code removal, whose
+; change keeps the rounds going.
+define i32 @loop(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %p = phi i32 [ 0, %entry ], [ %a, %loop ]
+  %q = phi i32 [ 0, %entry ], [ %b, %loop ]
+  %a = add i32 %n, 1
+  %b = add i32 %n, 1
+  %d1 = mul i32 %n, 3
+  %d2 = add i32 %d1, 1
+  %c = icmp slt i32 %p, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %r = add i32 %p, %q
+  ret i32 %r
+}
+
+; CHECK-LABEL:  define i32 @loop(
+; CHECK:        %p = phi i32 [ 0, %entry ], [ %a, %loop ]
+; CHECK-NEXT:   %a = add i32 %n, 1
+; CHECK-NEXT:   %c = icmp slt i32 %p, %n
+; CHECK:        %r = add i32 %p, %p
+
+; ONE-LABEL:    define i32 @loop(
+; ONE:          %p = phi i32 [ 0, %entry ], [ %a, %loop ]
+; ONE-NEXT:     %q = phi i32 [ 0, %entry ], [ %a, %loop ]
+; ONE-NEXT:     %a = add i32 %n, 1
+; ONE-NEXT:     %c = icmp slt i32 %p, %n
+; ONE:          %r = add i32 %p, %q
+
+; SCCP turns %dead into an unreachable block and folds %k, which gives LVN
+; work, so SCCP runs again. That run must leave the block alone and count no
+; second dead block, or the round never looks quiet.
+define i32 @dead_branch(i32 %a) {
+entry:
+  %c = icmp eq i32 1, 2
+  br i1 %c, label %dead, label %live
+dead:
+  %d = add i32 %a, 1
+  br label %live
+live:
+  %k = add i32 2, 3
+  %x = add i32 %a, %k
+  %y = add i32 %a, 5
+  %r = mul i32 %x, %y
+  ret i32 %r
+}
+
+; CHECK-LABEL:  define i32 @dead_branch(
+; CHECK:        dead:
+; CHECK-NEXT:   unreachable
+; CHECK:        live:
+; CHECK-NEXT:   %x = add i32 %a, 5
+; CHECK-NEXT:   %r = mul i32 %x, %x
+; CHECK-NEXT:   ret i32 %r
+
+; STATS: 3 topt-cleanup {{.*}}Number of functions that hit the cleanup iteration limit
+
+; NOCAP:        1 SparseCondConstProp {{.*}}Number of basic blocks unreachable
+; NOCAP-NOT:    Number of functions that hit the cleanup iteration limit
+; NOCAP:        topt-cleanup {{.*}}Number of cleanup iterations over all functions
@@ -0,0 +1,63 @@
+; RUN: topt -passes=topt-adce %s -o - | FileCheck %s
+; RUN: topt -passes=topt-adce -topt-adce-use-sccp=false %s -o - \
+; RUN:   | FileCheck %s --check-prefix=NOSCCP
+
+; %count and %count.next only use each other, neither is trivially dead.
+; %scaled only feeds them. The store keeps %sum alive.
+define void @dead_cycle(ptr %p, i64 %n, i64 %k) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %count = phi i64 [ 0, %entry ], [ %count.next, %loop ]
+  %scaled = mul i64 %k, 3
+  %count.next = add i64 %count, %scaled
+  %sum = add i64 %i, %k
+  store i64 %sum, ptr %p
+  %i.next = add i64 %i, 1
+  %done = icmp eq i64 %i.next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; CHECK-LABEL: define void @dead_cycle(
+; CHECK:       loop:
+; CHECK-NEXT:    %i = phi i64
+; CHECK-NEXT:    %sum = add i64 %i, %k
+; CHECK-NEXT:    store i64 %sum, ptr %p
+; CHECK-NEXT:    %i.next = add i64 %i, 1
+; CHECK-NEXT:    %done = icmp eq i64 %i.next, %n
+; CHECK-NEXT:    br i1 %done, label %exit, label %loop
+
+; The solver never reaches %never, so the call in it does not keep %x
+; alive. Without the solver the call stays and so does %x.
+define i64 @dead_block(i64 %a) {
+entry:
+  %x = mul i64 %a, 7
+  %c = icmp eq i64 1, 2
+  br i1 %c, label %never, label %join
+
+never:
+  call void @use(i64 %x)
+  br label %join
+
+join:
+  %r = phi i64 [ %a, %entry ], [ %x, %never ]
+  ret i64 %r
+}
+
+; CHECK-LABEL: define i64 @dead_block(
+; CHECK-NOT:     mul
+; CHECK:       never:
+; CHECK-NEXT:    unreachable
+; CHECK:       join:
+; CHECK-NEXT:    ret i64 %a
+
+; NOSCCP-LABEL: define i64 @dead_block(
+; NOSCCP:         %x = mul i64 %a, 7
+; NOSCCP:         call void @use(i64 %x)
+
+declare void @use(i64)
@@ -0,0 +1,84 @@
+; RUN: topt -passes=topt-sccp %s -o - | FileCheck %s
+; RUN: topt -passes=topt-sccp -topt-sccp-predicate-info=false %s -o - \
+; RUN:   | FileCheck %s --check-prefix=NOPRED
+; The parallel solver reaches the same fixed point.
+; RUN: topt -passes=topt-sccp -topt-sccp-threads=4 \
+; RUN:   -topt-sccp-parallel-threshold=0 %s -o - | FileCheck %s
+
+; Guard then use: in %then, %x is 7, so %y is 8 and the second test of %y
+; always holds.
+define i32 @guard(i32 %x) {
+entry:
+  %is7 = icmp eq i32 %x, 7
+  br i1 %is7, label %then, label %else
+
+then:
+  %y = add i32 %x, 1
+  %is8 = icmp eq i32 %y, 8
+  br i1 %is8, label %ok, label %bad
+
+ok:
+  call void @use(i32 %x)
+  ret i32 %y
+
+bad:
+  ret i32 -1
+
+else:
+  ret i32 0
+}
+
+; CHECK-LABEL: define i32 @guard(
+; CHECK:       then:
+; CHECK-NEXT:    br i1 true, label %ok, label %bad
+; CHECK:       ok:
+; CHECK-NEXT:    call void @use(i32 7)
+; CHECK-NEXT:    ret i32 8
+; CHECK:       bad:
+; CHECK-NEXT:    unreachable
+
+; NOPRED-LABEL: define i32 @guard(
+; NOPRED:         %y = add i32 %x, 1
+; NOPRED:         call void @use(i32 %x)
+
+; The false edge of icmp ne, the cases of a switch and a repeated test of
+; the same condition. %join is entered from two blocks and learns nothing.
+define i32 @edges(i32 %a, i32 %s, i1 %c) {
+entry:
+  %ne = icmp ne i32 %a, 3
+  br i1 %ne, label %join, label %is3
+
+is3:
+  %a2 = mul i32 %a, 2
+  switch i32 %s, label %join [ i32 5, label %is5 ]
+
+is5:
+  %sum = add i32 %a2, %s
+  br i1 %c, label %again, label %join
+
+again:
+  br i1 %c, label %yes, label %join
+
+yes:
+  ret i32 %sum
+
+join:
+  %r = phi i32 [ %a, %entry ], [ %a, %is3 ], [ %s, %is5 ], [ 0, %again ]
+  %r2 = add i32 %r, %a
+  ret i32 %r2
+}
+
+; CHECK-LABEL: define i32 @edges(
+; CHECK:       is3:
+; CHECK-NEXT:    switch i32 %s
+; CHECK:       is5:
+; CHECK-NEXT:    br i1 %c, label %again, label %join
+; CHECK:       again:
+; CHECK-NEXT:    br i1 true, label %yes, label %join
+; CHECK:       yes:
+; CHECK-NEXT:    ret i32 11
+; CHECK:       join:
+; CHECK-NEXT:    %r = phi i32 [ %a, %entry ], [ 3, %is3 ], [ 5, %is5 ], [ 0, %again ]
+; CHECK-NEXT:    %r2 = add i32 %r, %a
+
+declare void @use(i32)
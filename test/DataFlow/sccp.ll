@@ -1,4 +1,6 @@
-; RUN: topt < %s -SCCP | FileCheck %s
+; RUN: topt -passes=topt-sccp %s -o - | FileCheck %s
+; RUN: topt -passes=topt-sccp -topt-sccp-threads=4 \
+; RUN:   -topt-sccp-parallel-threshold=0 %s -o - | FileCheck %s
 
 define i32 @test1(i32 %i0, i32 %j0) {
 BB1:
@@ -23,7 +25,7 @@ BB5:
 ; CHECK-LABEL:  BB3:
 ; CHECK:        br label %BB5
 ; CHECK-LABEL:  BB4:
-; CHECK:        br label %BB5
+; CHECK-NEXT:   unreachable
 ; CHECK-LABEL:  BB5:
 ; CHECK:        ret i32 10
 
@@ -53,7 +55,7 @@ BB7:
 }
 
 ; CHECK-LABEL:  BB2:
-; CHECK:        %k2 = phi i32 [ %k4, %BB7 ], [ 0, %BB1 ]
+; CHECK:        %k2 = phi i32 [ %k3, %BB7 ], [ 0, %BB1 ]
 ; CHECK:        %kcond = icmp slt i32 %k2, 100
 ; CHECK:        br i1 %kcond, label %BB3, label %BB4
 ; CHECK-LABEL:  BB3:
@@ -64,7 +66,198 @@ BB7:
 ; CHECK:        %k3 = add i32 %k2, 1
 ; CHECK:        br label %BB7
 ; CHECK-LABEL:  BB6:
-; CHECK:        br label %BB7
+; CHECK-NEXT:   unreachable
 ; CHECK-LABEL:  BB7:
-; CHECK:        %k4 = phi i32 [ %k3, %BB5 ], [ undef, %BB6 ]
-; CHECK:        br label %BB2
+; CHECK-NEXT:   br label %BB2
+
+; An operand that is still unknown does not make its user a constant.
+define i32 @unknown_operand() {
+  %x = add i32 undef, undef
+  %y = add i32 %x, 1
+  ret i32 %y
+}
+
+; CHECK-LABEL:  define i32 @unknown_operand(
+; CHECK-NEXT:   ret i32 undef
+
+; Loads, calls and casts are not modelled, they may produce any value.
+define i32 @load_is_overdefined(ptr %p) {
+  %v = load i32, ptr %p
+  %r = add i32 %v, 1
+  ret i32 %r
+}
+
+; CHECK-LABEL:  define i32 @load_is_overdefined(
+; CHECK:        %v = load i32, ptr %p
+; CHECK-NEXT:   %r = add i32 %v, 1
+; CHECK-NEXT:   ret i32 %r
+
+; A PHI is a constant only if all of its feasible incoming values agree.
+define i32 @phi_merge(i1 %c) {
+entry:
+  br i1 %c, label %a, label %b
+a:
+  br label %join
+b:
+  br label %join
+join:
+  %same = phi i32 [ 7, %a ], [ 7, %b ]
+  %diff = phi i32 [ 1, %a ], [ 2, %b ]
+  %r = add i32 %same, %diff
+  ret i32 %r
+}
+
+; CHECK-LABEL:  define i32 @phi_merge(
+; CHECK-LABEL:  join:
+; CHECK-NEXT:   %diff = phi i32 [ 1, %a ], [ 2, %b ]
+; CHECK-NEXT:   %r = add i32 7, %diff
+; CHECK-NEXT:   ret i32 %r
+
+; Terminators other than br keep all of their successors.
+define i32 @switch_terminator(i32 %x) {
+entry:
+  %k = add i32 2, 3
+  switch i32 %x, label %def [ i32 0, label %zero ]
+zero:
+  ret i32 %k
+def:
+  ret i32 0
+}
+
+; CHECK-LABEL:  define i32 @switch_terminator(
+; CHECK:        switch i32 %x, label %def [
+; CHECK-LABEL:  zero:
+; CHECK-NEXT:   ret i32 5
+; CHECK-LABEL:  def:
+; CHECK-NEXT:   ret i32 0
+
+; A dead block keeps a terminator and leaves the PHIs of its successors.
+define i32 @dead_pred_of_phi() {
+entry:
+  br i1 false, label %dead, label %join
+dead:
+  %d = add i32 1, 2
+  br label %join
+join:
+  %p = phi i32 [ %d, %dead ], [ 4, %entry ]
+  ret i32 %p
+}
+
+; CHECK-LABEL:  define i32 @dead_pred_of_phi(
+; CHECK-LABEL:  dead:
+; CHECK-NEXT:   unreachable
+; CHECK-LABEL:  join:
+; CHECK-NEXT:   ret i32 4
+
+; Invoke keeps both successors and its result may be any value. A PHI with
+; more than 64 incoming values is overdefined even if all of them agree.
+declare i32 @may_throw()
+declare i32 @__gxx_personality_v0(...)
+
+define i32 @invoke_switch_wide_phi(i32 %x)
+    personality ptr @__gxx_personality_v0 {
+entry:
+  %v = invoke i32 @may_throw()
+          to label %cont unwind label %lpad
+cont:
+  %k = mul i32 3, 4
+  %s = add i32 %v, %k
+  switch i32 %x, label %join [
+    i32 1, label %join
+    i32 2, label %join
+    i32 3, label %join
+    i32 4, label %join
+    i32 5, label %join
+    i32 6, label %join
+    i32 7, label %join
+    i32 8, label %join
+    i32 9, label %join
+    i32 10, label %join
+    i32 11, label %join
+    i32 12, label %join
+    i32 13, label %join
+    i32 14, label %join
+    i32 15, label %join
+    i32 16, label %join
+    i32 17, label %join
+    i32 18, label %join
+    i32 19, label %join
+    i32 20, label %join
+    i32 21, label %join
+    i32 22, label %join
+    i32 23, label %join
+    i32 24, label %join
+    i32 25, label %join
+    i32 26, label %join
+    i32 27, label %join
+    i32 28, label %join
+    i32 29, label %join
+    i32 30, label %join
+    i32 31, label %join
+    i32 32, label %join
+    i32 33, label %join
+    i32 34, label %join
+    i32 35, label %join
+    i32 36, label %join
+    i32 37, label %join
+    i32 38, label %join
+    i32 39, label %join
+    i32 40, label %join
+    i32 41, label %join
+    i32 42, label %join
+    i32 43, label %join
+    i32 44, label %join
+    i32 45, label %join
+    i32 46, label %join
+    i32 47, label %join
+    i32 48, label %join
+    i32 49, label %join
+    i32 50, label %join
+    i32 51, label %join
+    i32 52, label %join
+    i32 53, label %join
+    i32 54, label %join
+    i32 55, label %join
+    i32 56, label %join
+    i32 57, label %join
+    i32 58, label %join
+    i32 59, label %join
+    i32 60, label %join
+    i32 61, label %join
+    i32 62, label %join
+    i32 63, label %join
+    i32 64, label %join
+  ]
+lpad:
+  %lp = landingpad { ptr, i32 }
+          cleanup
+  %e = add i32 2, 2
+  ret i32 %e
+join:
+  %wide = phi i32 [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ],
+                   [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ], [ 1, %cont ]
+  %r = add i32 %wide, %s
+  ret i32 %r
+}
+
+; CHECK-LABEL:  define i32 @invoke_switch_wide_phi(
+; CHECK-LABEL:  cont:
+; CHECK-NEXT:   %s = add i32 %v, 12
+; CHECK-NEXT:   switch i32 %x, label %join [
+; CHECK-LABEL:  lpad:
+; CHECK:        ret i32 4
+; CHECK-LABEL:  join:
+; CHECK-NEXT:   %wide = phi i32 [ 1, %cont ]
+; CHECK-NEXT:   %r = add i32 %wide, %s
+; CHECK-NEXT:   ret i32 %r
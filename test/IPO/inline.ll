@@ -0,0 +1,91 @@
+; RUN: topt -passes=topt-inline %s -o - | FileCheck %s
+; RUN: topt -passes=topt-inline -topt-inline-threshold=0 %s -o - \
+; RUN:   | FileCheck %s --check-prefix=NONE
+
+; Two returns, the inlined body joins them with a PHI.
+define internal i32 @clamp(i32 %x) {
+entry:
+  %neg = icmp slt i32 %x, 0
+  br i1 %neg, label %zero, label %keep
+zero:
+  ret i32 0
+keep:
+  ret i32 %x
+}
+
+; A leaf once @clamp is inlined, so it is inlined into @caller in turn.
+define i32 @twice(i32 %x) {
+  %c = call i32 @clamp(i32 %x)
+  %r = add i32 %c, %c
+  ret i32 %r
+}
+
+define i32 @caller(i32 %a) {
+  %r = call i32 @twice(i32 %a)
+  ret i32 %r
+}
+
+declare void @external(i32)
+
+; Not a leaf, it calls a function that is not an intrinsic.
+define void @not_leaf(i32 %x) {
+  call void @external(i32 %x)
+  ret void
+}
+
+define void @calls_not_leaf(i32 %a) {
+  call void @not_leaf(i32 %a)
+  ret void
+}
+
+define i32 @recursive(i32 %x) {
+  %r = call i32 @recursive(i32 %x)
+  ret i32 %r
+}
+
+define internal i32 @inc(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+; Only the call site without noinline is inlined, @inc stays for the other.
+define i32 @noinline_call(i32 %a) {
+  %x = call i32 @inc(i32 %a) noinline
+  %y = call i32 @inc(i32 %x)
+  ret i32 %y
+}
+
+; @clamp has no callers left and is deleted.
+; CHECK-NOT:    @clamp(
+
+; CHECK-LABEL:  define i32 @twice(
+; CHECK-NOT:    call
+; CHECK:        [[C:%.*]] = phi i32 [ 0, %{{.*}} ], [ %x, %{{.*}} ]
+; CHECK:        %r = add i32 [[C]], [[C]]
+; CHECK:        ret i32 %r
+
+; CHECK-LABEL:  define i32 @caller(
+; CHECK-NOT:    call
+; CHECK:        phi i32 [ 0, %{{.*}} ], [ %a, %{{.*}} ]
+; CHECK:        ret i32
+
+; CHECK-LABEL:  define void @calls_not_leaf(
+; CHECK:        call void @not_leaf(i32 %a)
+
+; CHECK-LABEL:  define i32 @recursive(
+; CHECK:        call i32 @recursive(i32 %x)
+
+; CHECK-LABEL:  define internal i32 @inc(
+
+; CHECK-LABEL:  define i32 @noinline_call(
+; CHECK-NEXT:   %x = call i32 @inc(i32 %a) #[[NOINLINE:[0-9]+]]
+; CHECK-NEXT:   [[Y:%.*]] = add i32 %x, 1
+; CHECK-NEXT:   ret i32 [[Y]]
+
+; CHECK:        attributes #[[NOINLINE]] = { noinline }
+
+; NONE-LABEL:   define internal i32 @clamp(
+; NONE-LABEL:   define i32 @twice(
+; NONE:         call i32 @clamp(i32 %x)
+; NONE-LABEL:   define i32 @caller(
+; NONE:         call i32 @twice(i32 %a)
@@ -0,0 +1,51 @@
+; RUN: topt -passes=topt-lvn %s -o - | FileCheck %s
+
+; Only instructions computing the same thing are merged. The compares differ
+; in their predicate, the truncs in their type, and the store may change
+; what the second load reads.
+define i32 @distinct(i32 %a, i32 %b, ptr %p) {
+  %eq = icmp eq i32 %a, %b
+  %lt = icmp slt i32 %a, %b
+  %t8 = trunc i32 %a to i8
+  %t16 = trunc i32 %a to i16
+  %l1 = load i32, ptr %p
+  store i32 %b, ptr %p
+  %l2 = load i32, ptr %p
+  %r1 = call i32 @rand()
+  %r2 = call i32 @rand()
+  %z8 = zext i8 %t8 to i32
+  %z16 = zext i16 %t16 to i32
+  %s1 = select i1 %eq, i32 %l1, i32 %l2
+  %s2 = select i1 %lt, i32 %r1, i32 %r2
+  %s3 = add i32 %s1, %s2
+  %s4 = add i32 %z8, %z16
+  %s5 = add i32 %s3, %s4
+  ret i32 %s5
+}
+
+; CHECK-LABEL: define i32 @distinct(
+; CHECK:         %eq = icmp eq i32 %a, %b
+; CHECK-NEXT:    %lt = icmp slt i32 %a, %b
+; CHECK-NEXT:    %t8 = trunc i32 %a to i8
+; CHECK-NEXT:    %t16 = trunc i32 %a to i16
+; CHECK-NEXT:    %l1 = load i32, ptr %p
+; CHECK-NEXT:    store i32 %b, ptr %p
+; CHECK-NEXT:    %l2 = load i32, ptr %p
+; CHECK-NEXT:    %r1 = call i32 @rand()
+; CHECK-NEXT:    %r2 = call i32 @rand()
+
+; The second add is the first one. The leader keeps only the flags both
+; have, %x2 did not promise the absence of signed overflow.
+define i32 @merged(i32 %a, i32 %b) {
+  %x1 = add nsw i32 %a, %b
+  %x2 = add i32 %a, %b
+  %y = mul i32 %x1, %x2
+  ret i32 %y
+}
+
+; CHECK-LABEL: define i32 @merged(
+; CHECK-NEXT:    %x1 = add i32 %a, %b
+; CHECK-NEXT:    %y = mul i32 %x1, %x1
+; CHECK-NEXT:    ret i32 %y
+
+declare i32 @rand()
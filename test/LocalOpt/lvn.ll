@@ -1,3 +1,8 @@
+; RUN: topt -passes=topt-lvn %s -o - | FileCheck %s
+
+@g = global [4 x i8] zeroinitializer
+@h = global [4 x i8] zeroinitializer
+
  define dso_local i32 @foo(i32 %0, i32 %1, i32 %2,
  i32 %3) {
     %5 = sub i32 %2, %3
@@ -9,4 +14,41 @@
     %11 = mul i32 %10, %1
     %12 = add i32 %9, %11
     ret i32 %12
- }
\ No newline at end of file
+ }
+; CHECK-LABEL:  define dso_local i32 @foo(
+; CHECK:        %6 = mul i32 %5, %1
+; CHECK-NOT:    sub
+; CHECK:        %10 = add i32 %9, %6
+; CHECK-NEXT:   ret i32 %10
+
+; Globals are operands like any other value, the same one twice is the same
+; operand.
+define ptr @global_operands(i64 %i) {
+  %a = getelementptr i8, ptr @g, i64 %i
+  %b = getelementptr i8, ptr @g, i64 %i
+  %c = getelementptr i8, ptr @h, i64 %i
+  %d = icmp eq ptr %a, %b
+  %e = select i1 %d, ptr %b, ptr %c
+  ret ptr %e
+}
+
+; CHECK-LABEL:  define ptr @global_operands(
+; CHECK:        %a = getelementptr i8, ptr @g, i64 %i
+; CHECK-NEXT:   %c = getelementptr i8, ptr @h, i64 %i
+; CHECK-NEXT:   %d = icmp eq ptr %a, %a
+; CHECK-NEXT:   %e = select i1 %d, ptr %a, ptr %c
+
+; Integer constants of any width are keyed by their value.
+define i128 @wide_constants(i128 %a) {
+  %x = add i128 %a, 170141183460469231731687303715884105727
+  %y = add i128 %a, 170141183460469231731687303715884105727
+  %z = add i128 %a, -170141183460469231731687303715884105728
+  %r = mul i128 %x, %y
+  %s = mul i128 %r, %z
+  ret i128 %s
+}
+
+; CHECK-LABEL:  define i128 @wide_constants(
+; CHECK:        %x = add i128 %a, 170141183460469231731687303715884105727
+; CHECK-NEXT:   %z = add i128 %a, -170141183460469231731687303715884105728
+; CHECK-NEXT:   %r = mul i128 %x, %x
@@ -0,0 +1,78 @@
+; RUN: topt -passes=topt-licm %s -o - | FileCheck %s
+
+; %scale and %mask do not change in the loop and move to the preheader,
+; %last is only used after it and moves to the exit. The load stays, the
+; store in the loop may change what it reads. So does the udiv, it could
+; trap on a zero %d the loop never divides by.
+define i64 @hoist_and_sink(ptr %p, i64 %n, i64 %k, i64 %d) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %next, %latch ]
+  %scale = mul i64 %k, 8
+  %mask = and i64 %scale, 255
+  %v = load i64, ptr %p
+  %x = add i64 %v, %mask
+  store i64 %x, ptr %p
+  %last = mul i64 %i, %k
+  %cond = icmp eq i64 %d, 0
+  br i1 %cond, label %latch, label %divide
+
+divide:
+  %q = udiv i64 %n, %d
+  br label %latch
+
+latch:
+  %next = add i64 %i, 1
+  %done = icmp eq i64 %next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i64 %last
+}
+
+; CHECK-LABEL:  define i64 @hoist_and_sink(
+; CHECK:        entry:
+; CHECK-NEXT:   %scale = mul i64 %k, 8
+; CHECK-NEXT:   %mask = and i64 %scale, 255
+; CHECK-NEXT:   %cond = icmp eq i64 %d, 0
+; CHECK-NEXT:   br label %loop
+; CHECK:        loop:
+; CHECK:        %v = load i64, ptr %p
+; CHECK:        store i64 %x, ptr %p
+; CHECK-NOT:    %last
+; CHECK:        divide:
+; CHECK-NEXT:   %q = udiv i64 %n, %d
+; CHECK:        exit:
+; CHECK-NEXT:   %last = mul i64 %i, %k
+; CHECK-NEXT:   ret i64 %last
+
+; The header has two predecessors outside the loop, a preheader is created
+; for the hoisted %sum.
+define i64 @no_preheader(i1 %c, i64 %a, i64 %b, i64 %n) {
+entry:
+  br i1 %c, label %loop, label %other
+
+other:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ 1, %other ], [ %next, %loop ]
+  %sum = add i64 %a, %b
+  %next = add i64 %i, %sum
+  %done = icmp uge i64 %next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret i64 %next
+}
+
+; CHECK-LABEL:  define i64 @no_preheader(
+; CHECK:        loop.preheader:
+; CHECK-NEXT:   %i.ph = phi i64
+; CHECK-NEXT:   %sum = add i64 %a, %b
+; CHECK-NEXT:   br label %loop
+; CHECK:        loop:
+; CHECK-NEXT:   %i = phi i64 {{.*}}[ %i.ph, %loop.preheader ]
+; CHECK-NEXT:   %next = add i64 %i, %sum
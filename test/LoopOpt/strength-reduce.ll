@@ -0,0 +1,88 @@
+; RUN: topt -passes=topt-strength-reduce %s -o - | FileCheck %s
+
+; The bitmap index of the sieve: %i * %prime becomes a second induction
+; variable advancing by %prime, the division and remainder by 8 a shift and
+; a mask.
+define void @strike(ptr %bits, i64 %prime, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 2, %entry ], [ %next, %loop ]
+  %product = mul i64 %i, %prime
+  %byte = udiv i64 %product, 8
+  %bit = urem i64 %product, 8
+  %addr = getelementptr i8, ptr %bits, i64 %byte
+  %old = load i8, ptr %addr
+  %bit8 = trunc i64 %bit to i8
+  %mask = shl i8 1, %bit8
+  %new = or i8 %old, %mask
+  store i8 %new, ptr %addr
+  %next = add i64 %i, 1
+  %done = icmp ugt i64 %next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; CHECK-LABEL: define void @strike(
+; CHECK:       entry:
+; CHECK-NEXT:    %i.scaled.start = mul i64 2, %prime
+; CHECK:       loop:
+; CHECK-NEXT:    %i.scaled = phi i64 [ %i.scaled.start, %entry ], [ %i.scaled.next, %loop ]
+; CHECK-NOT:     mul
+; CHECK:         %byte = lshr i64 %i.scaled, 3
+; CHECK-NEXT:    %bit = and i64 %i.scaled, 7
+; CHECK:         %next = add i64 %i, 1
+; CHECK-NEXT:    %i.scaled.next = add i64 %i.scaled, %prime
+
+; The divisor is only known to be 16 after constant propagation. The sdiv
+; divides a value that may be negative and stays, the srem of a masked one
+; does not.
+define i64 @divisors(i64 %x, i1 %c) {
+entry:
+  br i1 %c, label %left, label %right
+
+left:
+  br label %join
+
+right:
+  br label %join
+
+join:
+  %d = phi i64 [ 16, %left ], [ 16, %right ]
+  %q = udiv i64 %x, %d
+  %s = sdiv i64 %x, %d
+  %low = and i64 %x, 255
+  %r = srem i64 %low, %d
+  %sum = add i64 %q, %s
+  %res = add i64 %sum, %r
+  ret i64 %res
+}
+
+; CHECK-LABEL: define i64 @divisors(
+; CHECK:         %q = lshr i64 %x, 4
+; CHECK-NEXT:    %s = sdiv i64 %x, %d
+; CHECK:         %r = and i64 %low, 15
+
+; Chained divisions are decided on the original IR. %a is no constant, the
+; urem by it stays, even though %k, which the solver knows to be 2, was
+; rewritten first. The sdiv of %a is non-negative and becomes a shift of the
+; reduced %a.
+define i32 @chained(i32 %x, i32 %z) {
+  %c = add i32 8, 8
+  %k = udiv i32 %c, 8
+  %a = udiv i32 %x, 8
+  %r = urem i32 %z, %a
+  %s = sdiv i32 %a, 4
+  %t = add i32 %r, %s
+  %u = add i32 %t, %k
+  ret i32 %u
+}
+
+; CHECK-LABEL: define i32 @chained(
+; CHECK:         %k = lshr i32 %c, 3
+; CHECK-NEXT:    %a = lshr i32 %x, 3
+; CHECK-NEXT:    %r = urem i32 %z, %a
+; CHECK-NEXT:    %s = lshr i32 %a, 2
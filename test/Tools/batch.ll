@@ -0,0 +1,21 @@
+; RUN: rm -rf %t && mkdir -p %t
+; RUN: echo "%s %t/a.ll" > %t/list
+; RUN: echo "%s %t/b.ll" >> %t/list
+; RUN: topt -passes=topt-lvn -batch=%t/list -j=2
+; RUN: FileCheck %s < %t/a.ll
+; RUN: FileCheck %s < %t/b.ll
+; RUN: echo "%t/missing.ll %t/c.ll" >> %t/list
+; RUN: not topt -passes=topt-lvn -batch=%t/list 2>&1 | FileCheck %s --check-prefix=ERR
+; RUN: FileCheck %s < %t/a.ll
+
+define i32 @foo(i32 %a, i32 %b) {
+  %x = add i32 %a, %b
+  %y = add i32 %a, %b
+  %z = mul i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK-LABEL:  define i32 @foo(
+; CHECK:        %z = mul i32 %x, %x
+
+; ERR:          missing.ll: error: Could not open input file
@@ -0,0 +1,33 @@
+; RUN: rm -rf %t.cache
+; RUN: topt -passes=topt-lvn -cache-dir=%t.cache %s -o %t.miss.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR
+; RUN: topt -passes=topt-lvn -cache-dir=%t.cache %s -o %t.hit.ll
+; RUN: diff %t.miss.ll %t.hit.ll
+; RUN: FileCheck %s < %t.hit.ll
+; A different pipeline is a different entry.
+; RUN: topt -passes=topt-sccp -cache-dir=%t.cache %s -o %t.sccp.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR2
+; So is the same pipeline with a different pass option.
+; RUN: topt -passes=topt-sccp -topt-sccp-predicate-info=false \
+; RUN:   -cache-dir=%t.cache %s -o %t.sccp-nopred.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR3
+
+define i32 @f(i32 %a, i32 %b) {
+  %x = add i32 %a, %b
+  %y = add i32 %a, %b
+  %z = mul i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK-LABEL:  define i32 @f(
+; CHECK:        %x = add i32 %a, %b
+; CHECK-NEXT:   %z = mul i32 %x, %x
+
+; DIR:          llvmcache-
+; DIR-NOT:      llvmcache-
+
+; DIR2-COUNT-2: llvmcache-
+; DIR2-NOT:     llvmcache-
+
+; DIR3-COUNT-3: llvmcache-
+; DIR3-NOT:     llvmcache-
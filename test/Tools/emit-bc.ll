@@ -0,0 +1,25 @@
+; RUN: topt -passes=topt-lvn -emit-bc %s -o %t.bc
+; RUN: llvm-dis < %t.bc | FileCheck %s
+; RUN: topt -passes=topt-lvn -only-functions=keep %t.bc -o %t.ll
+; RUN: FileCheck %s --check-prefix=ONLY < %t.ll
+
+define i32 @keep(i32 %a, i32 %b) {
+  %x = add i32 %a, %b
+  %y = add i32 %a, %b
+  %z = mul i32 %x, %y
+  ret i32 %z
+}
+
+define internal i32 @drop(i32 %a) {
+  %x = add i32 %a, 1
+  ret i32 %x
+}
+
+; CHECK-LABEL:  define i32 @keep(
+; CHECK:        %x = add i32 %a, %b
+; CHECK-NEXT:   %z = mul i32 %x, %x
+; CHECK-LABEL:  define internal i32 @drop(
+
+; ONLY-LABEL:   define i32 @keep(
+; ONLY:         %z = mul i32 %x, %x
+; ONLY:         declare i32 @drop(i32)
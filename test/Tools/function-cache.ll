@@ -0,0 +1,66 @@
+; RUN: rm -rf %t.cache
+; RUN: topt -passes=topt-lvn -function-cache-dir=%t.cache %s -o %t.miss.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR2
+; RUN: topt -passes=topt-lvn -function-cache-dir=%t.cache %s -o %t.hit.ll
+; RUN: diff %t.miss.ll %t.hit.ll
+; RUN: FileCheck %s < %t.hit.ll
+; Only the changed function gets a new entry, the other one is spliced in.
+; RUN: sed -e 's/%b = add i32 %a, 7/%b = add i32 %a, 8/' %s > %t.changed.ll
+; RUN: topt -passes=topt-lvn -function-cache-dir=%t.cache %t.changed.ll \
+; RUN:   -o %t.out.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR3
+; RUN: FileCheck %s --check-prefix=CHANGED < %t.out.ll
+; Options given to the passes are part of the key, even those topt-lvn does
+; not read, so both functions miss again.
+; RUN: topt -passes=topt-lvn -topt-sccp-predicate-info=false \
+; RUN:   -function-cache-dir=%t.cache %s -o %t.option.ll
+; RUN: ls %t.cache | FileCheck %s --check-prefix=DIR5
+; Module passes have no function form.
+; RUN: not topt -passes=globaldce -function-cache-dir=%t.cache %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERR
+
+%pair = type { i32, i32 }
+
+define i32 @first(i32 %a, ptr %g) {
+  %x = add i32 %a, 1
+  %y = add i32 %a, 1
+  %p = getelementptr %pair, ptr %g, i32 0, i32 1
+  %v = load i32, ptr %p
+  %s = mul i32 %x, %y
+  %r = add i32 %s, %v
+  ret i32 %r
+}
+
+define i32 @second(i32 %a) {
+  %b = add i32 %a, 7
+  %c = add i32 %a, 7
+  %d = mul i32 %b, %a
+  %e = add i32 %c, %d
+  ret i32 %e
+}
+
+; CHECK-LABEL:  define i32 @first(
+; CHECK:        %x = add i32 %a, 1
+; CHECK-NEXT:   %p = getelementptr %pair, ptr %g, i32 0, i32 1
+; CHECK:        %s = mul i32 %x, %x
+; CHECK-LABEL:  define i32 @second(
+; CHECK:        %d = mul i32 %b, %a
+; CHECK-NEXT:   %e = add i32 %b, %d
+
+; CHANGED-LABEL: define i32 @first(
+; CHANGED:       %s = mul i32 %x, %x
+; CHANGED-LABEL: define i32 @second(
+; CHANGED:       %b = add i32 %a, 8
+; CHANGED-NEXT:  %d = mul i32 %b, %a
+; CHANGED-NEXT:  %e = add i32 %b, %d
+
+; DIR2-COUNT-2: llvmcache-
+; DIR2-NOT:     llvmcache-
+
+; DIR3-COUNT-3: llvmcache-
+; DIR3-NOT:     llvmcache-
+
+; DIR5-COUNT-5: llvmcache-
+; DIR5-NOT:     llvmcache-
+
+; ERR: the function cache needs a pipeline of function passes only
@@ -0,0 +1,21 @@
+; RUN: topt -passes=topt-sccp,topt-lvn -profile-passes=%t.json %s -o /dev/null
+; RUN: FileCheck %s < %t.json
+
+define i32 @foo(i32 %a) {
+  %x = add i32 %a, 1
+  %y = add i32 %a, 1
+  %z = add i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK:        "passes": [
+; CHECK:        "pass": "{{.*}}SCCPPass"
+; CHECK-NEXT:   "ir_kind": "function"
+; CHECK-NEXT:   "ir_name": "foo"
+; CHECK-NEXT:   "wall_ns":
+; CHECK-NEXT:   "insts_before": 4
+; CHECK:        "pass": "{{.*}}LVNPass"
+; CHECK:        "insts_before": 4
+; CHECK-NEXT:   "insts_after": 3
+; CHECK:        "summary": [
+; CHECK:        "statistics": {
@@ -0,0 +1,49 @@
+; A mistyped -socket= must not delete an ordinary file.
+; RUN: echo keep > %t.file
+; RUN: not topt -serve -socket=%t.file 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=NOTSOCK
+; RUN: grep -q keep %t.file
+; RUN: rm -f %t.sock
+; RUN: sh -c 'topt -serve -j=2 -socket=%t.sock > %t.log 2>&1 &'
+; The server may still be starting up.
+; RUN: for i in $(seq 100); do \
+; RUN:   topt-client -socket=%t.sock -passes=topt-lvn %s -o %t.ll 2>/dev/null \
+; RUN:     && break; sleep 0.1; done
+; RUN: FileCheck %s < %t.ll
+; RUN: not topt-client -socket=%t.sock -passes=no-such-pass %s 2>&1 \
+; RUN:   | FileCheck %s --check-prefix=ERR
+; A client that leaves without reading its response does not take the server
+; down with it. Shutting down the reading side first makes the response hit
+; EPIPE every time.
+; RUN: %python -c "import socket, struct, sys; \
+; RUN:   m = open(sys.argv[2], 'rb').read(); p = b'topt-lvn'; \
+; RUN:   s = socket.socket(socket.AF_UNIX); s.connect(sys.argv[1]); \
+; RUN:   s.shutdown(socket.SHUT_RD); \
+; RUN:   h = struct.pack('<IIIQ', 0x54504f54, 0, len(p), len(m)); \
+; RUN:   s.sendall(h + p + m); s.close()" %t.sock %s
+; RUN: topt-client -socket=%t.sock -passes=topt-lvn %s -o - | FileCheck %s
+; An idle connection does not keep the server from shutting down.
+; RUN: rm -f %t.connected
+; RUN: sh -c '%python -c "import socket, sys, time; \
+; RUN:   s = socket.socket(socket.AF_UNIX); s.connect(sys.argv[1]); \
+; RUN:   open(sys.argv[2], \"w\").close(); time.sleep(60)" \
+; RUN:   %t.sock %t.connected > /dev/null 2>&1 & echo $! > %t.idle'
+; RUN: for i in $(seq 100); do test -f %t.connected && break; sleep 0.1; done
+; RUN: topt-client -socket=%t.sock -passes=topt-lvn -shutdown %s -o /dev/null
+; RUN: for i in $(seq 100); do test -S %t.sock || break; sleep 0.1; done
+; RUN: not test -S %t.sock
+; RUN: kill $(cat %t.idle)
+
+define i32 @foo(i32 %a, i32 %b) {
+  %x = add i32 %a, %b
+  %y = add i32 %a, %b
+  %z = mul i32 %x, %y
+  ret i32 %z
+}
+
+; CHECK-LABEL:  define i32 @foo(
+; CHECK:        %z = mul i32 %x, %x
+
+; ERR: unknown pass name 'no-such-pass'
+
+; NOTSOCK: file exists and is not a socket
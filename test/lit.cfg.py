@@ -48,3 +48,6 @@ config.environment['PATH'] = path
 path = os.path.pathsep.join((config.llvm_libs_dir,
                              config.environment.get('LD_LIBRARY_PATH','')))
 config.environment['LD_LIBRARY_PATH'] = path
+
+# For helper scripts in RUN lines.
+config.substitutions.append(('%python', '"%s"' % sys.executable))
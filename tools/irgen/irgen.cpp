@@ -0,0 +1,283 @@
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/NoFolder.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/SystemUtils.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<uint64_t> NumInsts(
+    "insts", cl::desc("Approximate number of instructions of the module"),
+    cl::init(1000));
+
+static cl::opt<unsigned> NumFunctions(
+    "functions", cl::desc("Number of functions the instructions are split "
+                          "into"),
+    cl::init(1));
+
+static cl::opt<unsigned> BlockSize(
+    "block-size", cl::desc("Instructions per straight line block, large "
+                           "blocks stress local value numbering"),
+    cl::init(16));
+
+static cl::opt<unsigned> PhiFanIn(
+    "phi-fanin", cl::desc("Arms of each branch and incoming values of the PHI "
+                          "joining them. 2 makes CFG diamonds, more makes a "
+                          "switch"),
+    cl::init(2));
+
+static cl::opt<unsigned> NestingDepth(
+    "nesting-depth", cl::desc("How deep branches nest inside the arms of "
+                              "other branches, 0 makes every function a "
+                              "single block"),
+    cl::init(1));
+
+static cl::opt<double> Redundancy(
+    "redundancy", cl::desc("Fraction of instructions repeating an expression "
+                           "computed earlier in the same block"),
+    cl::init(0.25));
+
+static cl::opt<double> ConstantRatio(
+    "constant-ratio", cl::desc("Fraction of instructions and branch "
+                               "conditions that only depend on constants"),
+    cl::init(0.25));
+
+static cl::opt<unsigned> OperandWindow(
+    "operand-window", cl::desc("Every instruction uses the one before it and "
+                               "one of the last <n> values, 1 makes a single "
+                               "def-use chain"),
+    cl::init(8));
+
+static cl::opt<unsigned> Seed("seed", cl::desc("Seed of the generator"),
+                              cl::init(1));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Override output filename"),
+                                           cl::init("-"),
+                                           cl::value_desc("filename"));
+
+static cl::opt<bool>
+    EmitBitcode("emit-bc",
+                cl::desc("Write LLVM bitcode instead of textual IR"));
+
+static std::unique_ptr<LLVMContext> Context;
+static std::unique_ptr<Module> TheModule;
+static std::unique_ptr<IRBuilder<NoFolder>> Builder;
+
+/// mt19937_64 produces the same sequence everywhere, the std distributions
+/// do not, so numbers are derived from it by hand.
+static std::mt19937_64 Rng;
+
+/// Instructions emitted into the current function so far.
+static uint64_t NumEmitted;
+static uint64_t FunctionBudget;
+
+static const Instruction::BinaryOps Opcodes[] = {
+    Instruction::Add, Instruction::Sub, Instruction::Mul,
+    Instruction::Xor, Instruction::And, Instruction::Or};
+
+static uint64_t randomBelow(uint64_t N) { return Rng() % N; }
+
+static double randomFraction() { return (Rng() >> 11) * 0x1.0p-53; }
+
+static Instruction::BinaryOps randomOpcode() {
+  return Opcodes[randomBelow(std::size(Opcodes))];
+}
+
+static Constant *randomConstant() {
+  return Builder->getInt64(randomBelow(1000));
+}
+
+/// emitStraightLine - Emit BlockSize binary operators into the current block,
+/// starting from In. Returns the last one.
+static Value *emitStraightLine(Value *In) {
+  struct Expr {
+    Instruction::BinaryOps Opcode;
+    Value *LHS;
+    Value *RHS;
+  };
+  std::vector<Expr> Exprs;
+  std::vector<Value *> Recent = {In};
+  Value *Last = In;
+
+  for (unsigned i = 0; i < BlockSize && NumEmitted < FunctionBudget; ++i) {
+    double Kind = randomFraction();
+    Expr E;
+    if (Kind < Redundancy && !Exprs.empty()) {
+      E = Exprs[randomBelow(Exprs.size())];
+    } else if (Kind < Redundancy + ConstantRatio) {
+      E = {randomOpcode(), randomConstant(), randomConstant()};
+    } else {
+      uint64_t Window = std::min<uint64_t>(OperandWindow, Recent.size());
+      Value *Other = Recent[Recent.size() - 1 - randomBelow(Window)];
+      E = {randomOpcode(), Last, Other};
+    }
+    Exprs.push_back(E);
+    Last = Builder->CreateBinOp(E.Opcode, E.LHS, E.RHS, "v");
+    Recent.push_back(Last);
+    ++NumEmitted;
+  }
+  return Last;
+}
+
+/// emitCondition - Selector of one of PhiFanIn arms, computed from
+/// constants only for a ConstantRatio fraction of the branches.
+static Value *emitCondition(Value *In) {
+  bool IsConstant = randomFraction() < ConstantRatio;
+  NumEmitted += 2;
+  if (PhiFanIn == 2) {
+    if (IsConstant) {
+      Value *Sum = Builder->CreateAdd(randomConstant(), randomConstant(), "sum");
+      return Builder->CreateICmpULT(Sum, Builder->getInt64(1000), "cond");
+    }
+    Value *Masked = Builder->CreateAnd(In, Builder->getInt64(1), "masked");
+    return Builder->CreateICmpEQ(Masked, Builder->getInt64(0), "cond");
+  }
+  if (IsConstant) {
+    Value *Sum = Builder->CreateAdd(Builder->getInt64(randomBelow(PhiFanIn)),
+                                    Builder->getInt64(0), "sum");
+    return Builder->CreateURem(Sum, Builder->getInt64(PhiFanIn), "selector");
+  }
+  Value *Mixed = Builder->CreateXor(In, Builder->getInt64(randomBelow(1000)),
+                                    "mixed");
+  return Builder->CreateURem(Mixed, Builder->getInt64(PhiFanIn), "selector");
+}
+
+/// emitRegion - Emit a branch with PhiFanIn arms at the end of the current
+/// block, fill each arm with a region one level less deep and join them with
+/// a PHI. Depth 0 is a straight line block. Returns the PHI, or the value
+/// of the straight line block.
+static Value *emitRegion(Function *F, Value *In, unsigned Depth) {
+  if (Depth == 0 || NumEmitted >= FunctionBudget) {
+    return emitStraightLine(In);
+  }
+
+  Value *Cond = emitCondition(In);
+  BasicBlock *Merge = BasicBlock::Create(*Context, "merge");
+  std::vector<BasicBlock *> Arms;
+  for (unsigned i = 0; i < PhiFanIn; ++i) {
+    Arms.push_back(BasicBlock::Create(*Context, "arm", F));
+  }
+  if (PhiFanIn == 2) {
+    Builder->CreateCondBr(Cond, Arms[0], Arms[1]);
+  } else {
+    SwitchInst *Switch = Builder->CreateSwitch(Cond, Arms[0], PhiFanIn - 1);
+    for (unsigned i = 1; i < PhiFanIn; ++i) {
+      Switch->addCase(Builder->getInt64(i), Arms[i]);
+    }
+  }
+  ++NumEmitted;
+
+  std::vector<std::pair<Value *, BasicBlock *>> Incoming;
+  for (BasicBlock *Arm : Arms) {
+    Builder->SetInsertPoint(Arm);
+    Value *Out = emitRegion(F, In, Depth - 1);
+    // Nested regions end in their own merge block.
+    Incoming.emplace_back(Out, Builder->GetInsertBlock());
+    Builder->CreateBr(Merge);
+    ++NumEmitted;
+  }
+
+  Merge->insertInto(F);
+  Builder->SetInsertPoint(Merge);
+  PHINode *Phi = Builder->CreatePHI(Builder->getInt64Ty(), PhiFanIn, "joined");
+  for (auto &[Val, Block] : Incoming) {
+    Phi->addIncoming(Val, Block);
+  }
+  ++NumEmitted;
+  return Phi;
+}
+
+/// emitFunction - i64 @irgen_<Index>(i64 %a, i64 %b) made of regions until
+/// its share of the instructions is used up.
+static void emitFunction(unsigned Index, uint64_t Budget) {
+  Type *I64 = Builder->getInt64Ty();
+  FunctionType *FT = FunctionType::get(I64, {I64, I64}, false);
+  Function *F = Function::Create(FT, Function::ExternalLinkage,
+                                 "irgen_" + std::to_string(Index),
+                                 TheModule.get());
+  F->getArg(0)->setName("a");
+  F->getArg(1)->setName("b");
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", F);
+  Builder->SetInsertPoint(Entry);
+  NumEmitted = 0;
+  FunctionBudget = Budget;
+
+  Value *Acc = Builder->CreateAdd(F->getArg(0), F->getArg(1), "acc");
+  ++NumEmitted;
+  while (NumEmitted < FunctionBudget) {
+    Value *Out = emitRegion(F, Acc, NestingDepth);
+    Acc = Builder->CreateXor(Acc, Out, "acc");
+    ++NumEmitted;
+  }
+  Builder->CreateRet(Acc);
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "synthetic IR generator for stressing the topt "
+                              "passes\n");
+
+  if (NumFunctions == 0 || BlockSize == 0 || OperandWindow == 0) {
+    errs() << argv[0] << ": -functions, -block-size and -operand-window must be positive\n";
+    return 1;
+  }
+  if (PhiFanIn < 2) {
+    errs() << argv[0] << ": -phi-fanin must be at least 2\n";
+    return 1;
+  }
+  if (Redundancy < 0 || ConstantRatio < 0 || Redundancy + ConstantRatio > 1) {
+    errs() << argv[0] << ": -redundancy and -constant-ratio must be fractions adding up to at most 1\n";
+    return 1;
+  }
+
+  Context = std::make_unique<LLVMContext>();
+  TheModule = std::make_unique<Module>("irgen", *Context);
+  Builder = std::make_unique<IRBuilder<NoFolder>>(*Context);
+  Rng.seed(Seed);
+
+  for (unsigned i = 0; i < NumFunctions; ++i) {
+    emitFunction(i, std::max<uint64_t>(NumInsts / NumFunctions, 1));
+  }
+
+  if (verifyModule(*TheModule, &errs())) {
+    errs() << argv[0] << ": generated module is broken\n";
+    return 1;
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC,
+                     EmitBitcode ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (EC) {
+    errs() << argv[0] << ": " << OutputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+  if (EmitBitcode) {
+    if (CheckBitcodeOutputToConsole(Out.os())) {
+      return 1;
+    }
+    WriteBitcodeToFile(*TheModule, Out.os());
+  } else {
+    TheModule->print(Out.os(), nullptr);
+  }
+  Out.keep();
+
+  return 0;
+}
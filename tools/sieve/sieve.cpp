@@ -6,10 +6,169 @@
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "topt/Passes/Passes.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
+enum class SieveMode { Classic, Segmented, Parallel };
+
+static cl::opt<SieveMode> Mode(
+    "mode", cl::desc("Sieve algorithm of the generated program"),
+    cl::values(
+        clEnumValN(SieveMode::Classic, "classic",
+                   "Strike the multiples of each prime across the whole "
+                   "bitmap, one prime at a time"),
+        clEnumValN(SieveMode::Segmented, "segmented",
+                   "Sieve the primes up to sqrt(n) first, then strike the "
+                   "multiples of all of them one cache sized segment at a "
+                   "time"),
+        clEnumValN(SieveMode::Parallel, "parallel",
+                   "Sieve the primes up to sqrt(n) first, then let worker "
+                   "threads claim segments, sieve them in a private buffer "
+                   "and copy them into place")),
+    cl::init(SieveMode::Classic));
+
+static cl::opt<unsigned> Threads(
+    "worker-threads", cl::desc("Worker threads of the parallel sieve"),
+    cl::init(4));
+
+static cl::opt<uint64_t> SegmentBytes(
+    "segment-bytes",
+    cl::desc("Bitmap bytes per segment of the segmented and parallel "
+             "sieves, the default fits a typical L1 data cache"),
+    cl::init(32 * 1024));
+
+enum class BitmapKind { Bytes, Words };
+
+static cl::opt<BitmapKind> Bitmap(
+    "bitmap", cl::desc("Bitmap representation of the generated program"),
+    cl::values(
+        clEnumValN(BitmapKind::Bytes, "bytes",
+                   "8 numbers per byte, a set bit marks a composite, bits are "
+                   "accessed through set_bit and check_bit calls"),
+        clEnumValN(BitmapKind::Words, "words",
+                   "64 numbers per i64 word, a set bit marks a composite, "
+                   "strikes are inlined and next_prime scans whole words "
+                   "with llvm.cttz")),
+    cl::init(BitmapKind::Bytes));
+
+enum class BitmapLayout { All, Odd, Wheel30 };
+
+static cl::opt<BitmapLayout> Layout(
+    "layout", cl::desc("Numbers stored in the bitmap of the generated program, "
+                       "anything but all needs -bitmap=words -mode=classic"),
+    cl::values(
+        clEnumValN(BitmapLayout::All, "all", "One bit per number"),
+        clEnumValN(BitmapLayout::Odd, "odd",
+                   "One bit per odd number, 2 is printed up front"),
+        clEnumValN(BitmapLayout::Wheel30, "wheel30",
+                   "One bit per number coprime to 30, 8 bits per 30 "
+                   "numbers, 2, 3 and 5 are printed up front")),
+    cl::init(BitmapLayout::All));
+
+enum class OutputKind { Printf, Buffered };
+
+static cl::opt<OutputKind> Output(
+    "output", cl::desc("How the generated program prints the primes"),
+    cl::values(
+        clEnumValN(OutputKind::Printf, "printf",
+                   "One printf call per prime"),
+        clEnumValN(OutputKind::Buffered, "buffered",
+                   "Format the primes into a buffer with an inlined itoa "
+                   "and flush it with one write call per buffer. The "
+                   "program takes the file descriptor to write to as an "
+                   "optional second argument")),
+    cl::init(OutputKind::Printf));
+
+static cl::opt<uint64_t> OutputBufferBytes(
+    "output-buffer-bytes",
+    cl::desc("Size of the output buffer of -output=buffered"),
+    cl::init(1 << 20));
+
+enum class PresieveKind { None, Generic, SSE2, AVX2, AVX512 };
+
+static cl::opt<PresieveKind> Presieve(
+    "presieve",
+    cl::desc("Strike the multiples of 2 to 13 by or-ing a precomputed "
+             "pattern into the bitmap, needs -bitmap=words -mode=classic "
+             "-layout=all"),
+    cl::values(
+        clEnumValN(PresieveKind::None, "none", "Strike them with sieve"),
+        clEnumValN(PresieveKind::Generic, "generic", "One i64 at a time"),
+        clEnumValN(PresieveKind::SSE2, "sse2", "<2 x i64> vectors"),
+        clEnumValN(PresieveKind::AVX2, "avx2",
+                   "<4 x i64> vectors, the presieve function gets +avx2"),
+        clEnumValN(PresieveKind::AVX512, "avx512",
+                   "<8 x i64> vectors, the presieve function gets "
+                   "+avx512f")),
+    cl::init(PresieveKind::None));
+
+/// The primes the presieve pattern strikes. Their product is 30030, so the
+/// pattern repeats every 30030 * 32 bits, i.e. every 15015 words.
+static const uint64_t PresievePrimes[] = {2, 3, 5, 7, 11, 13};
+static const uint64_t PresievePeriodWords = 15015;
+
+static cl::OptionCategory JitCategory("JIT benchmark options");
+
+static cl::opt<bool> Jit(
+    "jit",
+    cl::desc("Run the generated program in process with LLJIT and report "
+             "timings on stderr instead of printing the IR"),
+    cl::cat(JitCategory));
+
+enum class JitEntryKind { Main, CalcPrimes };
+
+static cl::opt<JitEntryKind> JitEntry(
+    "jit-entry", cl::desc("Function the JIT runs are timed with"),
+    cl::values(
+        clEnumValN(JitEntryKind::Main, "main",
+                   "main, i.e. allocation, sieving and printing"),
+        clEnumValN(JitEntryKind::CalcPrimes, "calc-primes",
+                   "calc_primes on a bitmap allocated before each run")),
+    cl::init(JitEntryKind::Main), cl::cat(JitCategory));
+
+static cl::opt<uint64_t> JitN("jit-n", cl::desc("n for the JIT runs"),
+                              cl::init(1000000), cl::cat(JitCategory));
+
+static cl::opt<unsigned> JitRuns("jit-runs", cl::desc("Number of JIT runs"),
+                                 cl::init(10), cl::cat(JitCategory));
+
+static cl::list<unsigned> JitPercentiles(
+    "jit-percentile",
+    cl::desc("Percentiles of the run times to report besides the minimum "
+             "and the median (default: 90,99)"),
+    cl::CommaSeparated, cl::cat(JitCategory));
+
+static cl::opt<unsigned> JitOptLevel(
+    "jit-opt",
+    cl::desc("Optimization level of the IR and the code generator, 0 to 3"),
+    cl::init(0), cl::cat(JitCategory));
+
+static cl::opt<std::string> JitPasses(
+    "jit-passes",
+    cl::desc("Pass pipeline to run on the IR before the JIT compiles it, "
+             "topt passes included, replaces the -jit-opt IR pipeline"),
+    cl::cat(JitCategory));
+
 static std::unique_ptr<LLVMContext> Context;
 static std::unique_ptr<Module> TheModule;
 static std::unique_ptr<IRBuilder<>> Builder;
@@ -25,8 +184,8 @@ void emitExternalFunctions() {
   FunctionType *PrintfType = FunctionType::get(Builder->getInt64Ty(), {Builder->getInt8Ty()->getPointerTo()}, true);
   Function::Create(PrintfType, Function::ExternalLinkage, "printf", *TheModule);
 
-  FunctionType *AtoiType = FunctionType::get(Builder->getInt64Ty(), {Builder->getInt8Ty()->getPointerTo()}, false);
-  Function::Create(AtoiType, Function::ExternalLinkage, "atoi", *TheModule);
+  FunctionType *StrtoullType = FunctionType::get(Builder->getInt64Ty(), {Builder->getInt8Ty()->getPointerTo(), Builder->getInt8Ty()->getPointerTo(), Builder->getInt32Ty()}, false);
+  Function::Create(StrtoullType, Function::ExternalLinkage, "strtoull", *TheModule);
 
   FunctionType *MallocType = FunctionType::get(Builder->getInt8Ty()->getPointerTo(), {Builder->getInt64Ty()}, false);
   Function::Create(MallocType, Function::ExternalLinkage, "malloc", *TheModule);
@@ -37,6 +196,32 @@ void emitExternalFunctions() {
   FunctionType *ExitType = FunctionType::get(Builder->getVoidTy(), {Builder->getInt64Ty()}, false);
   Function::Create(ExitType, Function::ExternalLinkage, "exit", *TheModule);
 
+  FunctionType *MmapType = FunctionType::get(Builder->getInt8Ty()->getPointerTo(), {Builder->getInt8Ty()->getPointerTo(), Builder->getInt64Ty(), Builder->getInt32Ty(), Builder->getInt32Ty(), Builder->getInt32Ty(), Builder->getInt64Ty()}, false);
+  Function::Create(MmapType, Function::ExternalLinkage, "mmap", *TheModule);
+
+  FunctionType *MadviseType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt8Ty()->getPointerTo(), Builder->getInt64Ty(), Builder->getInt32Ty()}, false);
+  Function::Create(MadviseType, Function::ExternalLinkage, "madvise", *TheModule);
+
+  FunctionType *MunmapType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt8Ty()->getPointerTo(), Builder->getInt64Ty()}, false);
+  Function::Create(MunmapType, Function::ExternalLinkage, "munmap", *TheModule);
+
+  if (Mode == SieveMode::Parallel) {
+    // pthread_t is an integer on Linux.
+    FunctionType *PthreadCreateType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt64Ty()->getPointerTo(), Builder->getInt8Ty()->getPointerTo(), Builder->getInt8Ty()->getPointerTo(), Builder->getInt8Ty()->getPointerTo()}, false);
+    Function::Create(PthreadCreateType, Function::ExternalLinkage, "pthread_create", *TheModule);
+
+    FunctionType *PthreadJoinType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt64Ty(), Builder->getInt8Ty()->getPointerTo()}, false);
+    Function::Create(PthreadJoinType, Function::ExternalLinkage, "pthread_join", *TheModule);
+  }
+
+  if (Output == OutputKind::Buffered) {
+    FunctionType *WriteType = FunctionType::get(Builder->getInt64Ty(), {Builder->getInt32Ty(), Builder->getInt8Ty()->getPointerTo(), Builder->getInt64Ty()}, false);
+    Function::Create(WriteType, Function::ExternalLinkage, "write", *TheModule);
+
+    FunctionType *FflushType = FunctionType::get(Builder->getInt32Ty(), {Builder->getInt8Ty()->getPointerTo()}, false);
+    Function::Create(FflushType, Function::ExternalLinkage, "fflush", *TheModule);
+  }
+
   verify();
 }
 
@@ -61,9 +246,108 @@ void emitConstants() {
   GlobalVariable *StrWrongInputGV = new GlobalVariable(*TheModule, StrWrongInput->getType(), true, GlobalValue::PrivateLinkage, StrWrongInput, ".str_wrong_input");
   StrWrongInputGV->setAlignment(Align(1));
 
+  if (Mode == SieveMode::Parallel) {
+    Constant *StrThreadFail = ConstantDataArray::getString(*Context, "Unable to create a thread.\n\00");
+    GlobalVariable *StrThreadFailGV = new GlobalVariable(*TheModule, StrThreadFail->getType(), true, GlobalValue::PrivateLinkage, StrThreadFail, ".str_thread_fail");
+    StrThreadFailGV->setAlignment(Align(1));
+  }
+
+  if (Output == OutputKind::Buffered) {
+    ArrayType *OutputBufferType = ArrayType::get(Builder->getInt8Ty(), OutputBufferBytes);
+    new GlobalVariable(*TheModule, OutputBufferType, false, GlobalValue::InternalLinkage, ConstantAggregateZero::get(OutputBufferType), "output_buffer");
+    new GlobalVariable(*TheModule, Builder->getInt64Ty(), false, GlobalValue::InternalLinkage, Builder->getInt64(0), "output_len");
+    new GlobalVariable(*TheModule, Builder->getInt32Ty(), false, GlobalValue::InternalLinkage, Builder->getInt32(1), "output_fd");
+  }
+
+  if (Presieve != PresieveKind::None) {
+    // One period plus one vector more, so a vector load starting anywhere
+    // in the first period never has to wrap around.
+    SmallVector<uint64_t, 0> PatternValues(PresievePeriodWords + 8, 0);
+    for (uint64_t WordIdx = 0; WordIdx < PatternValues.size(); ++WordIdx) {
+      for (uint64_t BitIdx = 0; BitIdx < 64; ++BitIdx) {
+        uint64_t Number = WordIdx * 64 + BitIdx;
+        for (uint64_t Prime : PresievePrimes) {
+          if (Number % Prime == 0) {
+            PatternValues[WordIdx] |= uint64_t(1) << BitIdx;
+            break;
+          }
+        }
+      }
+    }
+    Constant *Pattern = ConstantDataArray::get(*Context, ArrayRef<uint64_t>(PatternValues));
+    GlobalVariable *PatternGV = new GlobalVariable(*TheModule, Pattern->getType(), true, GlobalValue::PrivateLinkage, Pattern, "presieve_pattern");
+    PatternGV->setAlignment(Align(64));
+  }
+
+  if (Layout == BitmapLayout::Wheel30) {
+    // The residues modulo 30 of the numbers coprime to 30, the bit slot of
+    // each residue, and the distance from each residue to the next one.
+    const uint64_t ResidueValues[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+    uint64_t SlotValues[30] = {};
+    for (uint64_t Slot = 0; Slot < 8; ++Slot) {
+      SlotValues[ResidueValues[Slot]] = Slot;
+    }
+    const uint64_t GapValues[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+
+    Constant *Residues = ConstantDataArray::get(*Context, ArrayRef<uint64_t>(ResidueValues));
+    new GlobalVariable(*TheModule, Residues->getType(), true, GlobalValue::PrivateLinkage, Residues, "wheel_residues");
+    Constant *Slots = ConstantDataArray::get(*Context, ArrayRef<uint64_t>(SlotValues));
+    new GlobalVariable(*TheModule, Slots->getType(), true, GlobalValue::PrivateLinkage, Slots, "wheel_slots");
+    Constant *Gaps = ConstantDataArray::get(*Context, ArrayRef<uint64_t>(GapValues));
+    new GlobalVariable(*TheModule, Gaps->getType(), true, GlobalValue::PrivateLinkage, Gaps, "wheel_gaps");
+  }
+
   verify();
 }
 
+/**
+ *  emitNumberToIndex - Emit the bit index of Number for the bitmap layout.
+ *  Number has to be stored in the bitmap, i.e. odd or coprime to 30.
+ */
+Value *emitNumberToIndex(Value *Number) {
+  switch (Layout) {
+  case BitmapLayout::All:
+    return Number;
+  case BitmapLayout::Odd:
+    return Builder->CreateLShr(Number, Builder->getInt64(1), "idx");
+  case BitmapLayout::Wheel30: {
+    Value *Block = Builder->CreateUDiv(Number, Builder->getInt64(30), "block");
+    Value *Residue = Builder->CreateURem(Number, Builder->getInt64(30), "residue");
+    GlobalVariable *Slots = TheModule->getNamedGlobal("wheel_slots");
+    Value *SlotPtr = Builder->CreateGEP(Slots->getValueType(), Slots, {Builder->getInt64(0), Residue}, "slot_ptr");
+    Value *Slot = Builder->CreateLoad(Builder->getInt64Ty(), SlotPtr, "slot");
+    Value *BlockBase = Builder->CreateShl(Block, Builder->getInt64(3), "block_base");
+    return Builder->CreateOr(BlockBase, Slot, "idx");
+  }
+  }
+  llvm_unreachable("unknown bitmap layout");
+}
+
+/**
+ *  emitIndexToNumber - Emit the number stored at bit index Idx, the inverse
+ *  of emitNumberToIndex.
+ */
+Value *emitIndexToNumber(Value *Idx) {
+  switch (Layout) {
+  case BitmapLayout::All:
+    return Idx;
+  case BitmapLayout::Odd: {
+    Value *Twice = Builder->CreateShl(Idx, Builder->getInt64(1), "twice");
+    return Builder->CreateOr(Twice, Builder->getInt64(1), "number");
+  }
+  case BitmapLayout::Wheel30: {
+    Value *Block = Builder->CreateLShr(Idx, Builder->getInt64(3), "block");
+    Value *Slot = Builder->CreateAnd(Idx, Builder->getInt64(7), "slot");
+    GlobalVariable *Residues = TheModule->getNamedGlobal("wheel_residues");
+    Value *ResiduePtr = Builder->CreateGEP(Residues->getValueType(), Residues, {Builder->getInt64(0), Slot}, "residue_ptr");
+    Value *Residue = Builder->CreateLoad(Builder->getInt64Ty(), ResiduePtr, "residue");
+    Value *BlockBase = Builder->CreateMul(Block, Builder->getInt64(30), "block_base");
+    return Builder->CreateAdd(BlockBase, Residue, "number");
+  }
+  }
+  llvm_unreachable("unknown bitmap layout");
+}
+
 void emitSetBitFunction() {
   FunctionType *SetBitType = FunctionType::get(Builder->getVoidTy(), {Builder->getInt64Ty(), Builder->getInt64Ty(), Builder->getInt8Ty()->getPointerTo(), Builder->getInt1Ty()}, false);
   Function *SetBitFunc = Function::Create(SetBitType, Function::ExternalLinkage, "set_bit", *TheModule);
@@ -142,6 +426,57 @@ void emitCheckBitFunction() {
   verify();
 }
 
+/**
+ *  emitStrike - Emit code at the insertion point that marks Number in the
+ *  bitmap Primes as composite.
+ */
+void emitStrike(Value *Primes, Value *Number) {
+  if (Bitmap == BitmapKind::Bytes) {
+    Value *ByteIdx = Builder->CreateUDiv(Number, Builder->getInt64(8), "byte_idx");
+    Value *BitIdx = Builder->CreateURem(Number, Builder->getInt64(8), "bit_idx");
+    Function *SetBitFunc = TheModule->getFunction("set_bit");
+    Builder->CreateCall(SetBitFunc, {ByteIdx, BitIdx, Primes, Builder->getInt1(true)});
+    return;
+  }
+  Value *Idx = emitNumberToIndex(Number);
+  Value *WordIdx = Builder->CreateLShr(Idx, Builder->getInt64(6), "word_idx");
+  Value *BitIdx = Builder->CreateAnd(Idx, Builder->getInt64(63), "bit_idx");
+  Value *Mask = Builder->CreateShl(Builder->getInt64(1), BitIdx, "mask");
+  Value *WordPtr = Builder->CreateGEP(Builder->getInt64Ty(), Primes, WordIdx, "word_ptr");
+  Value *Word = Builder->CreateLoad(Builder->getInt64Ty(), WordPtr, "word");
+  Value *StruckWord = Builder->CreateOr(Word, Mask, "struck_word");
+  Builder->CreateStore(StruckWord, WordPtr);
+}
+
+/**
+ *  emitBitmapBytes - Emit the size in bytes of the bitmap for the numbers up
+ *  to N.
+ */
+Value *emitBitmapBytes(Value *N) {
+  if (Bitmap == BitmapKind::Bytes) {
+    Value *SizeInBytes1 = Builder->CreateUDiv(N, Builder->getInt64(8), "size_in_bytes_1");
+    return Builder->CreateAdd(SizeInBytes1, Builder->getInt64(1), "size");
+  }
+  // Upper bound of the bit index of any number up to n.
+  Value *MaxIdx = N;
+  if (Layout == BitmapLayout::Odd) {
+    MaxIdx = Builder->CreateLShr(N, Builder->getInt64(1), "max_idx");
+  } else if (Layout == BitmapLayout::Wheel30) {
+    Value *Blocks = Builder->CreateUDiv(N, Builder->getInt64(30), "blocks");
+    Value *BlocksBase = Builder->CreateShl(Blocks, Builder->getInt64(3), "blocks_base");
+    MaxIdx = Builder->CreateOr(BlocksBase, Builder->getInt64(7), "max_idx");
+  }
+  Value *NumWords1 = Builder->CreateUDiv(MaxIdx, Builder->getInt64(64), "num_words_1");
+  Value *NumWords = Builder->CreateAdd(NumWords1, Builder->getInt64(1), "num_words");
+  return Builder->CreateMul(NumWords, Builder->getInt64(8), "size");
+}
+
+/**
+ *  emitInitArrayFunction - init_array(n) maps zeroed anonymous pages for the
+ *  bitmap, in which a set bit marks a composite, so only 0 and 1 have to be
+ *  struck. The kernel is asked to back the mapping with huge pages, which
+ *  keeps the TLB misses of a bitmap of many gigabytes down.
+ */
 void emitInitArrayFunction() {
   FunctionType *InitArrayType = FunctionType::get(
     Builder->getInt8Ty()->getPointerTo(),
@@ -155,28 +490,21 @@ void emitInitArrayFunction() {
   BasicBlock *Entry = BasicBlock::Create(*Context, "entry", InitArrayFunc);
   BasicBlock *AllocFail = BasicBlock::Create(*Context, "alloc_fail", InitArrayFunc);
   BasicBlock *Init = BasicBlock::Create(*Context, "init", InitArrayFunc);
-  BasicBlock *Init0 = BasicBlock::Create(*Context, "init0", InitArrayFunc);
-  BasicBlock *Init1 = BasicBlock::Create(*Context, "init1", InitArrayFunc);
-  BasicBlock *Init2 = BasicBlock::Create(*Context, "init2", InitArrayFunc);
-  BasicBlock *InitLoop = BasicBlock::Create(*Context, "init_loop", InitArrayFunc);
-  BasicBlock *InitLoopCond = BasicBlock::Create(*Context, "init_loop_cond", InitArrayFunc);
-  BasicBlock *InitLoopBody = BasicBlock::Create(*Context, "init_loop_body", InitArrayFunc);
-  BasicBlock *Return = BasicBlock::Create(*Context, "return", InitArrayFunc);
 
   Builder->SetInsertPoint(Entry);
-  Function::arg_iterator Args = InitArrayFunc->arg_begin();
-  Value *N = Args++;
+  Value *N = InitArrayFunc->arg_begin();
   N->setName("n");
 
-  Value *I = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "i");
-  Value *SizeInBytes1 = Builder->CreateUDiv(N, Builder->getInt64(8), "size_in_bytes_1");
-  Value *Size = Builder->CreateAdd(SizeInBytes1, Builder->getInt64(1), "size");
+  Value *Size = emitBitmapBytes(N);
   Function *PrintfFunc = TheModule->getFunction("printf");
   Value *StrArraySize = TheModule->getNamedGlobal(".str_array_size");
   Builder->CreateCall(PrintfFunc, {StrArraySize, Size});
-  Function *MallocFunc = TheModule->getFunction("malloc");
-  Value *Primes = Builder->CreateCall(MallocFunc, {Size}, "primes");
-  Value *AllocCheck = Builder->CreateICmpEQ(Primes, ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo()), "alloc_check");
+  // PROT_READ | PROT_WRITE and MAP_PRIVATE | MAP_ANONYMOUS of Linux.
+  Function *MmapFunc = TheModule->getFunction("mmap");
+  Value *NullPtr = ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo());
+  Value *Primes = Builder->CreateCall(MmapFunc, {NullPtr, Size, Builder->getInt32(0x3), Builder->getInt32(0x22), Builder->getInt32(-1), Builder->getInt64(0)}, "primes");
+  Value *MapFailed = Builder->CreateIntToPtr(Builder->getInt64(-1), Builder->getInt8Ty()->getPointerTo(), "map_failed");
+  Value *AllocCheck = Builder->CreateICmpEQ(Primes, MapFailed, "alloc_check");
   Builder->CreateCondBr(AllocCheck, AllocFail, Init);
 
   Builder->SetInsertPoint(AllocFail);
@@ -186,42 +514,47 @@ void emitInitArrayFunction() {
   Builder->CreateCall(ExitFunc, {Builder->getInt64(-1)});
   Builder->CreateUnreachable();
 
+  // MADV_HUGEPAGE. Without transparent huge pages this fails, which only
+  // costs speed.
   Builder->SetInsertPoint(Init);
-  Value *Cmp1 = Builder->CreateICmpSGT(N, Builder->getInt64(0), "cmp1");
-  Builder->CreateCondBr(Cmp1, Init0, Init1);
-
-  Builder->SetInsertPoint(Init0);
-  Function *SetBitFunc = TheModule->getFunction("set_bit");
-  Builder->CreateCall(SetBitFunc, {Builder->getInt64(0), Builder->getInt64(0), Primes, Builder->getInt1(false)});
-  Builder->CreateBr(Init1);
-
-  Builder->SetInsertPoint(Init1);
-  Value *Cmp2 = Builder->CreateICmpSGT(N, Builder->getInt64(1), "cmp2");
-  Builder->CreateCondBr(Cmp2, Init2, InitLoop);
-
-  Builder->SetInsertPoint(Init2);
-  Builder->CreateCall(SetBitFunc, {Builder->getInt64(0), Builder->getInt64(1), Primes, Builder->getInt1(false)});
-  Builder->CreateBr(InitLoop);
+  Function *MadviseFunc = TheModule->getFunction("madvise");
+  Builder->CreateCall(MadviseFunc, {Primes, Size, Builder->getInt32(14)});
+  // Number 1 has bit 0 in the other layouts.
+  if (Layout == BitmapLayout::All) {
+    emitStrike(Primes, Builder->getInt64(0));
+  }
+  emitStrike(Primes, Builder->getInt64(1));
+  Builder->CreateRet(Primes);
 
-  Builder->SetInsertPoint(InitLoop);
-  Builder->CreateStore(Builder->getInt64(2), I);
-  Builder->CreateBr(InitLoopCond);
+  verify();
+}
 
-  Builder->SetInsertPoint(InitLoopCond);
-  Value *IVal = Builder->CreateLoad(Builder->getInt64Ty(), I, "i_val");
-  Value *Cmp3 = Builder->CreateICmpSLT(IVal, N, "cmp3");
-  Builder->CreateCondBr(Cmp3, InitLoopBody, Return);
+/**
+ *  emitFreeArrayFunction - free_array(primes, n) unmaps the bitmap of
+ *  init_array(n).
+ */
+void emitFreeArrayFunction() {
+  FunctionType *FreeArrayType = FunctionType::get(
+    Builder->getVoidTy(),
+    {Builder->getInt8Ty()->getPointerTo(),
+      Builder->getInt64Ty()},
+    false
+  );
 
-  Builder->SetInsertPoint(InitLoopBody);
-  Value *ByteIdx = Builder->CreateUDiv(IVal, Builder->getInt64(8), "byte_idx");
-  Value *BitIdx = Builder->CreateURem(IVal, Builder->getInt64(8), "bit_idx");
-  Builder->CreateCall(SetBitFunc, {ByteIdx, BitIdx, Primes, Builder->getInt1(true)});
-  Value *INext = Builder->CreateAdd(IVal, Builder->getInt64(1), "i_next");
-  Builder->CreateStore(INext, I);
-  Builder->CreateBr(InitLoopCond);
+  Function *FreeArrayFunc = Function::Create(
+    FreeArrayType, Function::ExternalLinkage, "free_array", *TheModule);
 
-  Builder->SetInsertPoint(Return);
-  Builder->CreateRet(Primes);
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", FreeArrayFunc);
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = FreeArrayFunc->arg_begin();
+  Value *Primes = Args++;
+  Primes->setName("primes");
+  Value *N = Args++;
+  N->setName("n");
+  Value *Size = emitBitmapBytes(N);
+  Function *MunmapFunc = TheModule->getFunction("munmap");
+  Builder->CreateCall(MunmapFunc, {Primes, Size});
+  Builder->CreateRetVoid();
 
   verify();
 }
@@ -264,10 +597,7 @@ void emitSieveFunction() {
 
   Builder->SetInsertPoint(SieveLoopBody);
   Value *Product = Builder->CreateMul(IVal, Prime, "product");
-  Value *ByteIdx = Builder->CreateUDiv(Product, Builder->getInt64(8), "byte_idx");
-  Value *BitIdx = Builder->CreateURem(Product, Builder->getInt64(8), "bit_idx");
-  Function *SetBitFunc = TheModule->getFunction("set_bit");
-  Builder->CreateCall(SetBitFunc, {ByteIdx, BitIdx, Primes, Builder->getInt1(false)});
+  emitStrike(Primes, Product);
   Value *INext = Builder->CreateAdd(IVal, Builder->getInt64(1), "i_next");
   Builder->CreateStore(INext, I);
   Builder->CreateBr(SieveLoopCond);
@@ -278,6 +608,78 @@ void emitSieveFunction() {
   verify();
 }
 
+/**
+ *  emitLayoutSieveFunction - sieve(prime, words, upper_bound) for the odd and
+ *  wheel layouts. Only the multiples prime * m with m stored in the bitmap
+ *  are struck, all others are not stored at all. Smaller m were struck by
+ *  smaller primes already, so m starts at prime.
+ */
+void emitLayoutSieveFunction() {
+  FunctionType *SieveType = FunctionType::get(
+      Builder->getVoidTy(),
+      {Builder->getInt64Ty(),
+        Builder->getInt64Ty()->getPointerTo(),
+        Builder->getInt64Ty()},
+      false
+  );
+
+  Function *SieveFunc = Function::Create(
+      SieveType, Function::ExternalLinkage, "sieve", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", SieveFunc);
+  BasicBlock *SieveLoopCond = BasicBlock::Create(*Context, "sieve_loop_cond", SieveFunc);
+  BasicBlock *SieveLoopBody = BasicBlock::Create(*Context, "sieve_loop_body", SieveFunc);
+  BasicBlock *SieveDone = BasicBlock::Create(*Context, "sieve_done", SieveFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = SieveFunc->arg_begin();
+  Value *Prime = Args++;
+  Prime->setName("prime");
+  Value *Words = Args++;
+  Words->setName("words");
+  Value *UpperBound = Args++;
+  UpperBound->setName("upper_bound");
+  Value *M = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "m");
+  Value *GapIdx = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "gap_idx");
+  Builder->CreateStore(Prime, M);
+  if (Layout == BitmapLayout::Wheel30) {
+    // The wheel position of m is the slot of prime.
+    Value *PrimeIdx = emitNumberToIndex(Prime);
+    Value *PrimeSlot = Builder->CreateAnd(PrimeIdx, Builder->getInt64(7), "prime_slot");
+    Builder->CreateStore(PrimeSlot, GapIdx);
+  }
+  Builder->CreateBr(SieveLoopCond);
+
+  Builder->SetInsertPoint(SieveLoopCond);
+  Value *MVal = Builder->CreateLoad(Builder->getInt64Ty(), M, "m_val");
+  Value *Product = Builder->CreateMul(MVal, Prime, "product");
+  Value *Cmp1 = Builder->CreateICmpULE(Product, UpperBound, "cmp1");
+  Builder->CreateCondBr(Cmp1, SieveLoopBody, SieveDone);
+
+  Builder->SetInsertPoint(SieveLoopBody);
+  emitStrike(Words, Product);
+  if (Layout == BitmapLayout::Odd) {
+    Value *MNext = Builder->CreateAdd(MVal, Builder->getInt64(2), "m_next");
+    Builder->CreateStore(MNext, M);
+  } else {
+    Value *GapIdxVal = Builder->CreateLoad(Builder->getInt64Ty(), GapIdx, "gap_idx_val");
+    GlobalVariable *Gaps = TheModule->getNamedGlobal("wheel_gaps");
+    Value *GapPtr = Builder->CreateGEP(Gaps->getValueType(), Gaps, {Builder->getInt64(0), GapIdxVal}, "gap_ptr");
+    Value *Gap = Builder->CreateLoad(Builder->getInt64Ty(), GapPtr, "gap");
+    Value *MNext = Builder->CreateAdd(MVal, Gap, "m_next");
+    Builder->CreateStore(MNext, M);
+    Value *GapIdxNext1 = Builder->CreateAdd(GapIdxVal, Builder->getInt64(1), "gap_idx_next_1");
+    Value *GapIdxNext = Builder->CreateAnd(GapIdxNext1, Builder->getInt64(7), "gap_idx_next");
+    Builder->CreateStore(GapIdxNext, GapIdx);
+  }
+  Builder->CreateBr(SieveLoopCond);
+
+  Builder->SetInsertPoint(SieveDone);
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
 void emitNextPrimeFunction() {
   FunctionType *NextPrimeType = FunctionType::get(
       Builder->getInt64Ty(),
@@ -322,7 +724,7 @@ void emitNextPrimeFunction() {
   Value *BitIdx = Builder->CreateURem(IVal, Builder->getInt64(8), "bit_idx");
   Function *CheckBitFunc = TheModule->getFunction("check_bit");
   Value *IsSet = Builder->CreateCall(CheckBitFunc, {ByteIdx, BitIdx, Primes}, "is_set");
-  Builder->CreateCondBr(IsSet, NextPrimeFound, NextPrimeIter);
+  Builder->CreateCondBr(IsSet, NextPrimeIter, NextPrimeFound);
 
   Builder->SetInsertPoint(NextPrimeIter);
   Value *INext = Builder->CreateAdd(IVal, Builder->getInt64(1), "i_next");
@@ -339,6 +741,859 @@ void emitNextPrimeFunction() {
   verify();
 }
 
+/**
+ *  emitWordSetBitFunction - set_bit(idx, words, val) for the word bitmap.
+ *  Clears the bit and ors in val, so setting and clearing take the same
+ *  branch free path.
+ */
+void emitWordSetBitFunction() {
+  FunctionType *SetBitType = FunctionType::get(Builder->getVoidTy(), {Builder->getInt64Ty(), Builder->getInt64Ty()->getPointerTo(), Builder->getInt1Ty()}, false);
+  Function *SetBitFunc = Function::Create(SetBitType, Function::ExternalLinkage, "set_bit", *TheModule);
+
+  Function::arg_iterator Args = SetBitFunc->arg_begin();
+  Value *Idx = Args++;
+  Idx->setName("idx");
+  Value *Words = Args++;
+  Words->setName("words");
+  Value *Val = Args++;
+  Val->setName("val");
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", SetBitFunc);
+  Builder->SetInsertPoint(Entry);
+  Value *WordIdx = Builder->CreateLShr(Idx, Builder->getInt64(6), "word_idx");
+  Value *BitIdx = Builder->CreateAnd(Idx, Builder->getInt64(63), "bit_idx");
+  Value *Mask = Builder->CreateShl(Builder->getInt64(1), BitIdx, "mask");
+  Value *WordPtr = Builder->CreateGEP(Builder->getInt64Ty(), Words, WordIdx, "word_ptr");
+  Value *Word = Builder->CreateLoad(Builder->getInt64Ty(), WordPtr, "word");
+  Value *InvertedMask = Builder->CreateXor(Mask, Builder->getInt64(-1), "inverted_mask");
+  Value *Cleared = Builder->CreateAnd(Word, InvertedMask, "cleared");
+  Value *ValWide = Builder->CreateZExt(Val, Builder->getInt64Ty(), "val_wide");
+  Value *ValBit = Builder->CreateShl(ValWide, BitIdx, "val_bit");
+  Value *NewWord = Builder->CreateOr(Cleared, ValBit, "new_word");
+  Builder->CreateStore(NewWord, WordPtr);
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  emitWordNextPrimeFunction - next_prime(prime, words, upper_bound) for the
+ *  word bitmap. Candidates are zero bits, so the lowest set bit of the
+ *  inverted word is the next prime in that word. The scan works on bit
+ *  indices and only maps them back to numbers to compare with upper_bound.
+ */
+void emitWordNextPrimeFunction() {
+  FunctionType *NextPrimeType = FunctionType::get(
+      Builder->getInt64Ty(),
+      {Builder->getInt64Ty(),
+        Builder->getInt64Ty()->getPointerTo(),
+        Builder->getInt64Ty()},
+      false
+  );
+
+  Function *NextPrimeFunc = Function::Create(
+      NextPrimeType, Function::ExternalLinkage, "next_prime", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", NextPrimeFunc);
+  BasicBlock *NextPrimeLoopBody = BasicBlock::Create(*Context, "next_prime_loop_body", NextPrimeFunc);
+  BasicBlock *NextPrimeCandidate = BasicBlock::Create(*Context, "next_prime_candidate", NextPrimeFunc);
+  BasicBlock *NextPrimeIter = BasicBlock::Create(*Context, "next_prime_iter", NextPrimeFunc);
+  BasicBlock *NextPrimeLoadWord = BasicBlock::Create(*Context, "next_prime_load_word", NextPrimeFunc);
+  BasicBlock *NextPrimeNotFound = BasicBlock::Create(*Context, "next_prime_not_found", NextPrimeFunc);
+  BasicBlock *NextPrimeFound = BasicBlock::Create(*Context, "next_prime_found", NextPrimeFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = NextPrimeFunc->arg_begin();
+  Value *Prime = Args++;
+  Prime->setName("prime");
+  Value *Words = Args++;
+  Words->setName("words");
+  Value *UpperBound = Args++;
+  UpperBound->setName("upper_bound");
+  Value *WordIdx = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "word_idx");
+  Value *Word = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "word");
+  Value *PrimeIdx = emitNumberToIndex(Prime);
+  Value *StartIndex = Builder->CreateAdd(PrimeIdx, Builder->getInt64(1), "start_index");
+  Value *StartWordIdx = Builder->CreateLShr(StartIndex, Builder->getInt64(6), "start_word_idx");
+  Value *StartBitIdx = Builder->CreateAnd(StartIndex, Builder->getInt64(63), "start_bit_idx");
+  // Bits below the start index count as struck.
+  Value *StartBit = Builder->CreateShl(Builder->getInt64(1), StartBitIdx, "start_bit");
+  Value *BelowStart = Builder->CreateSub(StartBit, Builder->getInt64(1), "below_start");
+  Value *StartWordPtr = Builder->CreateGEP(Builder->getInt64Ty(), Words, StartWordIdx, "start_word_ptr");
+  Value *StartWord1 = Builder->CreateLoad(Builder->getInt64Ty(), StartWordPtr, "start_word_1");
+  Value *StartWord = Builder->CreateOr(StartWord1, BelowStart, "start_word");
+  Builder->CreateStore(StartWordIdx, WordIdx);
+  Builder->CreateStore(StartWord, Word);
+  Builder->CreateBr(NextPrimeLoopBody);
+
+  Builder->SetInsertPoint(NextPrimeLoopBody);
+  Value *WordIdxVal = Builder->CreateLoad(Builder->getInt64Ty(), WordIdx, "word_idx_val");
+  Value *WordVal = Builder->CreateLoad(Builder->getInt64Ty(), Word, "word_val");
+  Value *Candidates = Builder->CreateXor(WordVal, Builder->getInt64(-1), "candidates");
+  Value *HasCandidate = Builder->CreateICmpNE(Candidates, Builder->getInt64(0), "has_candidate");
+  Builder->CreateCondBr(HasCandidate, NextPrimeCandidate, NextPrimeIter);
+
+  Builder->SetInsertPoint(NextPrimeCandidate);
+  Value *BitIdx = Builder->CreateIntrinsic(Intrinsic::cttz, {Builder->getInt64Ty()}, {Candidates, Builder->getInt1(true)}, nullptr, "bit_idx");
+  Value *WordBase = Builder->CreateShl(WordIdxVal, Builder->getInt64(6), "word_base");
+  Value *CandidateIdx = Builder->CreateOr(WordBase, BitIdx, "candidate");
+  Value *Candidate = emitIndexToNumber(CandidateIdx);
+  Value *Cmp1 = Builder->CreateICmpSLT(Candidate, UpperBound, "cmp1");
+  Builder->CreateCondBr(Cmp1, NextPrimeFound, NextPrimeNotFound);
+
+  Builder->SetInsertPoint(NextPrimeIter);
+  Value *WordIdxNext = Builder->CreateAdd(WordIdxVal, Builder->getInt64(1), "word_idx_next");
+  Value *NextWordBase = Builder->CreateShl(WordIdxNext, Builder->getInt64(6), "next_word_base");
+  Value *NextWordNumber = emitIndexToNumber(NextWordBase);
+  Value *Cmp2 = Builder->CreateICmpSLT(NextWordNumber, UpperBound, "cmp2");
+  Builder->CreateCondBr(Cmp2, NextPrimeLoadWord, NextPrimeNotFound);
+
+  Builder->SetInsertPoint(NextPrimeLoadWord);
+  Value *NextWordPtr = Builder->CreateGEP(Builder->getInt64Ty(), Words, WordIdxNext, "next_word_ptr");
+  Value *NextWord = Builder->CreateLoad(Builder->getInt64Ty(), NextWordPtr, "next_word");
+  Builder->CreateStore(WordIdxNext, WordIdx);
+  Builder->CreateStore(NextWord, Word);
+  Builder->CreateBr(NextPrimeLoopBody);
+
+  Builder->SetInsertPoint(NextPrimeNotFound);
+  Builder->CreateRet(Prime);
+
+  Builder->SetInsertPoint(NextPrimeFound);
+  Builder->CreateRet(Candidate);
+
+  verify();
+}
+
+void emitIntSqrtFunction() {
+  FunctionType *IntSqrtType = FunctionType::get(
+      Builder->getInt64Ty(),
+      {Builder->getInt64Ty()},
+      false
+  );
+
+  Function *IntSqrtFunc = Function::Create(
+      IntSqrtType, Function::ExternalLinkage, "int_sqrt", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", IntSqrtFunc);
+  BasicBlock *IntSqrtLoopCond = BasicBlock::Create(*Context, "int_sqrt_loop_cond", IntSqrtFunc);
+  BasicBlock *IntSqrtLoopBody = BasicBlock::Create(*Context, "int_sqrt_loop_body", IntSqrtFunc);
+  BasicBlock *IntSqrtDone = BasicBlock::Create(*Context, "int_sqrt_done", IntSqrtFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Value *N = IntSqrtFunc->arg_begin();
+  N->setName("n");
+  Value *R = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "r");
+  Builder->CreateStore(Builder->getInt64(0), R);
+  Builder->CreateBr(IntSqrtLoopCond);
+
+  // Largest r with r * r <= n.
+  Builder->SetInsertPoint(IntSqrtLoopCond);
+  Value *RVal = Builder->CreateLoad(Builder->getInt64Ty(), R, "r_val");
+  Value *RNext = Builder->CreateAdd(RVal, Builder->getInt64(1), "r_next");
+  Value *RNextSquare = Builder->CreateMul(RNext, RNext, "r_next_square");
+  Value *Cmp1 = Builder->CreateICmpULE(RNextSquare, N, "cmp1");
+  Builder->CreateCondBr(Cmp1, IntSqrtLoopBody, IntSqrtDone);
+
+  Builder->SetInsertPoint(IntSqrtLoopBody);
+  Builder->CreateStore(RNext, R);
+  Builder->CreateBr(IntSqrtLoopCond);
+
+  Builder->SetInsertPoint(IntSqrtDone);
+  Builder->CreateRet(RVal);
+
+  verify();
+}
+
+/**
+ *  emitSegmentedSieveFunction - sieve_segmented(n, primes) strikes all
+ *  composites up to n. The primes up to sqrt(n) are found with the classic
+ *  sieve and next_prime. The rest of the bitmap is processed in segments of
+ *  SegmentBytes bytes: every base prime strikes its multiples inside the
+ *  segment and remembers where it stopped, so each segment is loaded into
+ *  the cache once instead of once per prime.
+ */
+void emitSegmentedSieveFunction() {
+  FunctionType *SieveSegmentedType = FunctionType::get(
+      Builder->getVoidTy(),
+      {Builder->getInt64Ty(),
+        Builder->getInt8Ty()->getPointerTo()},
+      false
+  );
+
+  Function *SieveSegmentedFunc = Function::Create(
+      SieveSegmentedType, Function::ExternalLinkage, "sieve_segmented", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", SieveSegmentedFunc);
+  BasicBlock *BaseLoopCond = BasicBlock::Create(*Context, "base_loop_cond", SieveSegmentedFunc);
+  BasicBlock *BaseLoopBody = BasicBlock::Create(*Context, "base_loop_body", SieveSegmentedFunc);
+  BasicBlock *BaseLoopNext = BasicBlock::Create(*Context, "base_loop_next", SieveSegmentedFunc);
+  BasicBlock *BaseDone = BasicBlock::Create(*Context, "base_done", SieveSegmentedFunc);
+  BasicBlock *SegmentLoopCond = BasicBlock::Create(*Context, "segment_loop_cond", SieveSegmentedFunc);
+  BasicBlock *SegmentLoopBody = BasicBlock::Create(*Context, "segment_loop_body", SieveSegmentedFunc);
+  BasicBlock *PrimeLoopCond = BasicBlock::Create(*Context, "prime_loop_cond", SieveSegmentedFunc);
+  BasicBlock *PrimeLoopBody = BasicBlock::Create(*Context, "prime_loop_body", SieveSegmentedFunc);
+  BasicBlock *StrikeLoopCond = BasicBlock::Create(*Context, "strike_loop_cond", SieveSegmentedFunc);
+  BasicBlock *StrikeLoopBody = BasicBlock::Create(*Context, "strike_loop_body", SieveSegmentedFunc);
+  BasicBlock *StrikeDone = BasicBlock::Create(*Context, "strike_done", SieveSegmentedFunc);
+  BasicBlock *SegmentDone = BasicBlock::Create(*Context, "segment_done", SieveSegmentedFunc);
+  BasicBlock *Return = BasicBlock::Create(*Context, "return", SieveSegmentedFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = SieveSegmentedFunc->arg_begin();
+  Value *N = Args++;
+  N->setName("n");
+  Value *Primes = Args++;
+  Primes->setName("primes");
+  Value *P = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "p");
+  Value *Count = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "count");
+  Value *Lo = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "lo");
+  Value *K = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "k");
+  Value *J = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "j");
+  Function *IntSqrtFunc = TheModule->getFunction("int_sqrt");
+  Value *Limit = Builder->CreateCall(IntSqrtFunc, {N}, "limit");
+  Value *LimitEnd = Builder->CreateAdd(Limit, Builder->getInt64(1), "limit_end");
+  // There are at most limit base primes: one array with the primes and one
+  // with the next multiple each of them has to strike.
+  Value *ArrayBytes = Builder->CreateMul(LimitEnd, Builder->getInt64(8), "array_bytes");
+  Function *MallocFunc = TheModule->getFunction("malloc");
+  Value *BasePrimes = Builder->CreateCall(MallocFunc, {ArrayBytes}, "base_primes");
+  Value *NextMultiples = Builder->CreateCall(MallocFunc, {ArrayBytes}, "next_multiples");
+  Builder->CreateStore(Builder->getInt64(2), P);
+  Builder->CreateStore(Builder->getInt64(0), Count);
+  Builder->CreateBr(BaseLoopCond);
+
+  Builder->SetInsertPoint(BaseLoopCond);
+  Value *PVal = Builder->CreateLoad(Builder->getInt64Ty(), P, "p_val");
+  Value *Cmp1 = Builder->CreateICmpULE(PVal, Limit, "cmp1");
+  Builder->CreateCondBr(Cmp1, BaseLoopBody, BaseDone);
+
+  // Classic sieve below sqrt(n). The first multiple a base prime strikes in
+  // the segments is the first one above the limit, but never below p * p.
+  Builder->SetInsertPoint(BaseLoopBody);
+  Function *SieveFunc = TheModule->getFunction("sieve");
+  Builder->CreateCall(SieveFunc, {PVal, Primes, Limit});
+  Value *CountVal = Builder->CreateLoad(Builder->getInt64Ty(), Count, "count_val");
+  Value *BasePtr = Builder->CreateGEP(Builder->getInt64Ty(), BasePrimes, CountVal, "base_ptr");
+  Builder->CreateStore(PVal, BasePtr);
+  Value *FirstAbove1 = Builder->CreateAdd(Limit, PVal, "first_above_1");
+  Value *FirstAbove2 = Builder->CreateUDiv(FirstAbove1, PVal, "first_above_2");
+  Value *FirstAbove = Builder->CreateMul(FirstAbove2, PVal, "first_above");
+  Value *Square = Builder->CreateMul(PVal, PVal, "square");
+  Value *SquareIsAbove = Builder->CreateICmpUGT(Square, FirstAbove, "square_is_above");
+  Value *FirstMultiple = Builder->CreateSelect(SquareIsAbove, Square, FirstAbove, "first_multiple");
+  Value *NextPtr = Builder->CreateGEP(Builder->getInt64Ty(), NextMultiples, CountVal, "next_ptr");
+  Builder->CreateStore(FirstMultiple, NextPtr);
+  Value *CountNext = Builder->CreateAdd(CountVal, Builder->getInt64(1), "count_next");
+  Builder->CreateStore(CountNext, Count);
+  Function *NextPrimeFunc = TheModule->getFunction("next_prime");
+  Value *NextPrime = Builder->CreateCall(NextPrimeFunc, {PVal, Primes, LimitEnd}, "next_prime");
+  Value *Cmp2 = Builder->CreateICmpEQ(NextPrime, PVal, "cmp2");
+  Builder->CreateCondBr(Cmp2, BaseDone, BaseLoopNext);
+
+  Builder->SetInsertPoint(BaseLoopNext);
+  Builder->CreateStore(NextPrime, P);
+  Builder->CreateBr(BaseLoopCond);
+
+  Builder->SetInsertPoint(BaseDone);
+  Value *NumBase = Builder->CreateLoad(Builder->getInt64Ty(), Count, "num_base");
+  Value *End = Builder->CreateAdd(N, Builder->getInt64(1), "end");
+  Builder->CreateStore(LimitEnd, Lo);
+  Builder->CreateBr(SegmentLoopCond);
+
+  Builder->SetInsertPoint(SegmentLoopCond);
+  Value *LoVal = Builder->CreateLoad(Builder->getInt64Ty(), Lo, "lo_val");
+  Value *Cmp3 = Builder->CreateICmpULT(LoVal, End, "cmp3");
+  Builder->CreateCondBr(Cmp3, SegmentLoopBody, Return);
+
+  Builder->SetInsertPoint(SegmentLoopBody);
+  Value *Hi1 = Builder->CreateAdd(LoVal, Builder->getInt64(SegmentBytes * 8), "hi_1");
+  Value *HiIsPastEnd = Builder->CreateICmpUGT(Hi1, End, "hi_is_past_end");
+  Value *Hi = Builder->CreateSelect(HiIsPastEnd, End, Hi1, "hi");
+  Builder->CreateStore(Builder->getInt64(0), K);
+  Builder->CreateBr(PrimeLoopCond);
+
+  Builder->SetInsertPoint(PrimeLoopCond);
+  Value *KVal = Builder->CreateLoad(Builder->getInt64Ty(), K, "k_val");
+  Value *Cmp4 = Builder->CreateICmpULT(KVal, NumBase, "cmp4");
+  Builder->CreateCondBr(Cmp4, PrimeLoopBody, SegmentDone);
+
+  Builder->SetInsertPoint(PrimeLoopBody);
+  Value *PrimePtr = Builder->CreateGEP(Builder->getInt64Ty(), BasePrimes, KVal, "prime_ptr");
+  Value *Prime = Builder->CreateLoad(Builder->getInt64Ty(), PrimePtr, "prime");
+  Value *MultiplePtr = Builder->CreateGEP(Builder->getInt64Ty(), NextMultiples, KVal, "multiple_ptr");
+  Value *Multiple = Builder->CreateLoad(Builder->getInt64Ty(), MultiplePtr, "multiple");
+  Builder->CreateStore(Multiple, J);
+  Builder->CreateBr(StrikeLoopCond);
+
+  Builder->SetInsertPoint(StrikeLoopCond);
+  Value *JVal = Builder->CreateLoad(Builder->getInt64Ty(), J, "j_val");
+  Value *Cmp5 = Builder->CreateICmpULT(JVal, Hi, "cmp5");
+  Builder->CreateCondBr(Cmp5, StrikeLoopBody, StrikeDone);
+
+  Builder->SetInsertPoint(StrikeLoopBody);
+  emitStrike(Primes, JVal);
+  Value *JNext = Builder->CreateAdd(JVal, Prime, "j_next");
+  Builder->CreateStore(JNext, J);
+  Builder->CreateBr(StrikeLoopCond);
+
+  Builder->SetInsertPoint(StrikeDone);
+  Builder->CreateStore(JVal, MultiplePtr);
+  Value *KNext = Builder->CreateAdd(KVal, Builder->getInt64(1), "k_next");
+  Builder->CreateStore(KNext, K);
+  Builder->CreateBr(PrimeLoopCond);
+
+  Builder->SetInsertPoint(SegmentDone);
+  Builder->CreateStore(Hi, Lo);
+  Builder->CreateBr(SegmentLoopCond);
+
+  Builder->SetInsertPoint(Return);
+  Function *FreeFunc = TheModule->getFunction("free");
+  Builder->CreateCall(FreeFunc, {BasePrimes});
+  Builder->CreateCall(FreeFunc, {NextMultiples});
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  getSieveJobType - The state the parallel sieve shares with its workers:
+ *  n, the bitmap, the base primes, their count and the next unclaimed
+ *  segment.
+ */
+StructType *getSieveJobType() {
+  if (StructType *SieveJobType = StructType::getTypeByName(*Context, "sieve_job")) {
+    return SieveJobType;
+  }
+  return StructType::create(
+      *Context,
+      {Builder->getInt64Ty(),
+        Builder->getInt8Ty()->getPointerTo(),
+        Builder->getInt64Ty()->getPointerTo(),
+        Builder->getInt64Ty(),
+        Builder->getInt64Ty()},
+      "sieve_job");
+}
+
+/**
+ *  emitSieveWorkerFunction - sieve_worker(job) claims segments of
+ *  SegmentBytes bytes until none are left. Each segment is sieved with all
+ *  base primes in a buffer private to the thread and then copied into its
+ *  place in the bitmap, so the bitmap ends up in order no matter which
+ *  thread finishes first. Segment boundaries are word aligned, no two
+ *  threads ever write the same word.
+ */
+void emitSieveWorkerFunction() {
+  FunctionType *SieveWorkerType = FunctionType::get(
+      Builder->getInt8Ty()->getPointerTo(),
+      {Builder->getInt8Ty()->getPointerTo()},
+      false
+  );
+
+  Function *SieveWorkerFunc = Function::Create(
+      SieveWorkerType, Function::ExternalLinkage, "sieve_worker", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", SieveWorkerFunc);
+  BasicBlock *ClaimSegment = BasicBlock::Create(*Context, "claim_segment", SieveWorkerFunc);
+  BasicBlock *SegmentBody = BasicBlock::Create(*Context, "segment_body", SieveWorkerFunc);
+  BasicBlock *PrimeLoopCond = BasicBlock::Create(*Context, "prime_loop_cond", SieveWorkerFunc);
+  BasicBlock *PrimeLoopBody = BasicBlock::Create(*Context, "prime_loop_body", SieveWorkerFunc);
+  BasicBlock *StrikeLoopCond = BasicBlock::Create(*Context, "strike_loop_cond", SieveWorkerFunc);
+  BasicBlock *StrikeLoopBody = BasicBlock::Create(*Context, "strike_loop_body", SieveWorkerFunc);
+  BasicBlock *StrikeDone = BasicBlock::Create(*Context, "strike_done", SieveWorkerFunc);
+  BasicBlock *StrikeZeroAndOne = BasicBlock::Create(*Context, "strike_zero_and_one", SieveWorkerFunc);
+  BasicBlock *CopySegment = BasicBlock::Create(*Context, "copy_segment", SieveWorkerFunc);
+  BasicBlock *Return = BasicBlock::Create(*Context, "return", SieveWorkerFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Value *Job = SieveWorkerFunc->arg_begin();
+  Job->setName("job");
+  StructType *SieveJobType = getSieveJobType();
+  Value *K = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "k");
+  Value *J = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "j");
+  Value *NPtr = Builder->CreateStructGEP(SieveJobType, Job, 0, "n_ptr");
+  Value *N = Builder->CreateLoad(Builder->getInt64Ty(), NPtr, "n");
+  Value *PrimesPtr = Builder->CreateStructGEP(SieveJobType, Job, 1, "primes_ptr");
+  Value *Primes = Builder->CreateLoad(Builder->getInt8Ty()->getPointerTo(), PrimesPtr, "primes");
+  Value *BasePrimesPtr = Builder->CreateStructGEP(SieveJobType, Job, 2, "base_primes_ptr");
+  Value *BasePrimes = Builder->CreateLoad(Builder->getInt64Ty()->getPointerTo(), BasePrimesPtr, "base_primes");
+  Value *NumBasePtr = Builder->CreateStructGEP(SieveJobType, Job, 3, "num_base_ptr");
+  Value *NumBase = Builder->CreateLoad(Builder->getInt64Ty(), NumBasePtr, "num_base");
+  Value *NextSegmentPtr = Builder->CreateStructGEP(SieveJobType, Job, 4, "next_segment_ptr");
+  Value *End = Builder->CreateAdd(N, Builder->getInt64(1), "end");
+  Function *MallocFunc = TheModule->getFunction("malloc");
+  Value *Buffer = Builder->CreateCall(MallocFunc, {Builder->getInt64(SegmentBytes)}, "buffer");
+  Builder->CreateBr(ClaimSegment);
+
+  Builder->SetInsertPoint(ClaimSegment);
+  Value *Segment = Builder->CreateAtomicRMW(AtomicRMWInst::Add, NextSegmentPtr, Builder->getInt64(1), MaybeAlign(8), AtomicOrdering::Monotonic);
+  Segment->setName("segment");
+  Value *Lo = Builder->CreateMul(Segment, Builder->getInt64(SegmentBytes * 8), "lo");
+  Value *Cmp1 = Builder->CreateICmpULT(Lo, End, "cmp1");
+  Builder->CreateCondBr(Cmp1, SegmentBody, Return);
+
+  Builder->SetInsertPoint(SegmentBody);
+  Value *Hi1 = Builder->CreateAdd(Lo, Builder->getInt64(SegmentBytes * 8), "hi_1");
+  Value *HiIsPastEnd = Builder->CreateICmpUGT(Hi1, End, "hi_is_past_end");
+  Value *Hi = Builder->CreateSelect(HiIsPastEnd, End, Hi1, "hi");
+  Builder->CreateMemSet(Buffer, Builder->getInt8(0), SegmentBytes, MaybeAlign(8));
+  Builder->CreateStore(Builder->getInt64(0), K);
+  Builder->CreateBr(PrimeLoopCond);
+
+  Builder->SetInsertPoint(PrimeLoopCond);
+  Value *KVal = Builder->CreateLoad(Builder->getInt64Ty(), K, "k_val");
+  Value *Cmp2 = Builder->CreateICmpULT(KVal, NumBase, "cmp2");
+  Builder->CreateCondBr(Cmp2, PrimeLoopBody, StrikeZeroAndOne);
+
+  // The first multiple to strike is the first one in the segment, but never
+  // below p * p, which keeps the base primes themselves.
+  Builder->SetInsertPoint(PrimeLoopBody);
+  Value *PrimePtr = Builder->CreateGEP(Builder->getInt64Ty(), BasePrimes, KVal, "prime_ptr");
+  Value *Prime = Builder->CreateLoad(Builder->getInt64Ty(), PrimePtr, "prime");
+  Value *FirstInside1 = Builder->CreateAdd(Lo, Prime, "first_inside_1");
+  Value *FirstInside2 = Builder->CreateSub(FirstInside1, Builder->getInt64(1), "first_inside_2");
+  Value *FirstInside3 = Builder->CreateUDiv(FirstInside2, Prime, "first_inside_3");
+  Value *FirstInside = Builder->CreateMul(FirstInside3, Prime, "first_inside");
+  Value *Square = Builder->CreateMul(Prime, Prime, "square");
+  Value *SquareIsAbove = Builder->CreateICmpUGT(Square, FirstInside, "square_is_above");
+  Value *FirstMultiple = Builder->CreateSelect(SquareIsAbove, Square, FirstInside, "first_multiple");
+  Builder->CreateStore(FirstMultiple, J);
+  Builder->CreateBr(StrikeLoopCond);
+
+  Builder->SetInsertPoint(StrikeLoopCond);
+  Value *JVal = Builder->CreateLoad(Builder->getInt64Ty(), J, "j_val");
+  Value *Cmp3 = Builder->CreateICmpULT(JVal, Hi, "cmp3");
+  Builder->CreateCondBr(Cmp3, StrikeLoopBody, StrikeDone);
+
+  Builder->SetInsertPoint(StrikeLoopBody);
+  Value *Offset = Builder->CreateSub(JVal, Lo, "offset");
+  emitStrike(Buffer, Offset);
+  Value *JNext = Builder->CreateAdd(JVal, Prime, "j_next");
+  Builder->CreateStore(JNext, J);
+  Builder->CreateBr(StrikeLoopCond);
+
+  Builder->SetInsertPoint(StrikeDone);
+  Value *KNext = Builder->CreateAdd(KVal, Builder->getInt64(1), "k_next");
+  Builder->CreateStore(KNext, K);
+  Builder->CreateBr(PrimeLoopCond);
+
+  // No multiple of a prime strikes 0 and 1, the first segment does.
+  Builder->SetInsertPoint(StrikeZeroAndOne);
+  Value *IsFirst = Builder->CreateICmpEQ(Lo, Builder->getInt64(0), "is_first");
+  BasicBlock *StrikeFirst = BasicBlock::Create(*Context, "strike_first", SieveWorkerFunc, CopySegment);
+  Builder->CreateCondBr(IsFirst, StrikeFirst, CopySegment);
+
+  Builder->SetInsertPoint(StrikeFirst);
+  emitStrike(Buffer, Builder->getInt64(0));
+  emitStrike(Buffer, Builder->getInt64(1));
+  Builder->CreateBr(CopySegment);
+
+  // Whole bytes or words, whatever the bitmap is accessed with.
+  Builder->SetInsertPoint(CopySegment);
+  uint64_t UnitBits = Bitmap == BitmapKind::Bytes ? 8 : 64;
+  Value *Length = Builder->CreateSub(Hi, Lo, "length");
+  Value *Units1 = Builder->CreateAdd(Length, Builder->getInt64(UnitBits - 1), "units_1");
+  Value *Units = Builder->CreateUDiv(Units1, Builder->getInt64(UnitBits), "units");
+  Value *CopyBytes = Builder->CreateMul(Units, Builder->getInt64(UnitBits / 8), "copy_bytes");
+  Value *DstOffset = Builder->CreateUDiv(Lo, Builder->getInt64(8), "dst_offset");
+  Value *Dst = Builder->CreateGEP(Builder->getInt8Ty(), Primes, DstOffset, "dst");
+  Builder->CreateMemCpy(Dst, MaybeAlign(1), Buffer, MaybeAlign(8), CopyBytes);
+  Builder->CreateBr(ClaimSegment);
+
+  Builder->SetInsertPoint(Return);
+  Function *FreeFunc = TheModule->getFunction("free");
+  Builder->CreateCall(FreeFunc, {Buffer});
+  Builder->CreateRet(ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo()));
+
+  verify();
+}
+
+/**
+ *  emitParallelSieveFunction - sieve_parallel(n, primes) strikes all
+ *  composites up to n. The primes up to sqrt(n) are found serially with the
+ *  classic sieve and next_prime, then Threads sieve_worker threads sieve the
+ *  whole range from 0 to n segment by segment.
+ */
+void emitParallelSieveFunction() {
+  FunctionType *SieveParallelType = FunctionType::get(
+      Builder->getVoidTy(),
+      {Builder->getInt64Ty(),
+        Builder->getInt8Ty()->getPointerTo()},
+      false
+  );
+
+  Function *SieveParallelFunc = Function::Create(
+      SieveParallelType, Function::ExternalLinkage, "sieve_parallel", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", SieveParallelFunc);
+  BasicBlock *BaseLoopCond = BasicBlock::Create(*Context, "base_loop_cond", SieveParallelFunc);
+  BasicBlock *BaseLoopBody = BasicBlock::Create(*Context, "base_loop_body", SieveParallelFunc);
+  BasicBlock *BaseLoopNext = BasicBlock::Create(*Context, "base_loop_next", SieveParallelFunc);
+  BasicBlock *BaseDone = BasicBlock::Create(*Context, "base_done", SieveParallelFunc);
+  BasicBlock *CreateLoopCond = BasicBlock::Create(*Context, "create_loop_cond", SieveParallelFunc);
+  BasicBlock *CreateLoopBody = BasicBlock::Create(*Context, "create_loop_body", SieveParallelFunc);
+  BasicBlock *CreateLoopNext = BasicBlock::Create(*Context, "create_loop_next", SieveParallelFunc);
+  BasicBlock *CreateFail = BasicBlock::Create(*Context, "create_fail", SieveParallelFunc);
+  BasicBlock *JoinLoopCond = BasicBlock::Create(*Context, "join_loop_cond", SieveParallelFunc);
+  BasicBlock *JoinLoopBody = BasicBlock::Create(*Context, "join_loop_body", SieveParallelFunc);
+  BasicBlock *Return = BasicBlock::Create(*Context, "return", SieveParallelFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = SieveParallelFunc->arg_begin();
+  Value *N = Args++;
+  N->setName("n");
+  Value *Primes = Args++;
+  Primes->setName("primes");
+  StructType *SieveJobType = getSieveJobType();
+  ArrayType *ThreadIdsType = ArrayType::get(Builder->getInt64Ty(), Threads);
+  Value *P = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "p");
+  Value *Count = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "count");
+  Value *T = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "t");
+  Value *Job = Builder->CreateAlloca(SieveJobType, nullptr, "job");
+  Value *ThreadIds = Builder->CreateAlloca(ThreadIdsType, nullptr, "thread_ids");
+  Function *IntSqrtFunc = TheModule->getFunction("int_sqrt");
+  Value *Limit = Builder->CreateCall(IntSqrtFunc, {N}, "limit");
+  Value *LimitEnd = Builder->CreateAdd(Limit, Builder->getInt64(1), "limit_end");
+  Value *ArrayBytes = Builder->CreateMul(LimitEnd, Builder->getInt64(8), "array_bytes");
+  Function *MallocFunc = TheModule->getFunction("malloc");
+  Value *BasePrimes = Builder->CreateCall(MallocFunc, {ArrayBytes}, "base_primes");
+  Builder->CreateStore(Builder->getInt64(2), P);
+  Builder->CreateStore(Builder->getInt64(0), Count);
+  Builder->CreateBr(BaseLoopCond);
+
+  Builder->SetInsertPoint(BaseLoopCond);
+  Value *PVal = Builder->CreateLoad(Builder->getInt64Ty(), P, "p_val");
+  Value *Cmp1 = Builder->CreateICmpULE(PVal, Limit, "cmp1");
+  Builder->CreateCondBr(Cmp1, BaseLoopBody, BaseDone);
+
+  Builder->SetInsertPoint(BaseLoopBody);
+  Function *SieveFunc = TheModule->getFunction("sieve");
+  Builder->CreateCall(SieveFunc, {PVal, Primes, Limit});
+  Value *CountVal = Builder->CreateLoad(Builder->getInt64Ty(), Count, "count_val");
+  Value *BasePtr = Builder->CreateGEP(Builder->getInt64Ty(), BasePrimes, CountVal, "base_ptr");
+  Builder->CreateStore(PVal, BasePtr);
+  Value *CountNext = Builder->CreateAdd(CountVal, Builder->getInt64(1), "count_next");
+  Builder->CreateStore(CountNext, Count);
+  Function *NextPrimeFunc = TheModule->getFunction("next_prime");
+  Value *NextPrime = Builder->CreateCall(NextPrimeFunc, {PVal, Primes, LimitEnd}, "next_prime");
+  Value *Cmp2 = Builder->CreateICmpEQ(NextPrime, PVal, "cmp2");
+  Builder->CreateCondBr(Cmp2, BaseDone, BaseLoopNext);
+
+  Builder->SetInsertPoint(BaseLoopNext);
+  Builder->CreateStore(NextPrime, P);
+  Builder->CreateBr(BaseLoopCond);
+
+  Builder->SetInsertPoint(BaseDone);
+  Value *NumBase = Builder->CreateLoad(Builder->getInt64Ty(), Count, "num_base");
+  Builder->CreateStore(N, Builder->CreateStructGEP(SieveJobType, Job, 0, "n_ptr"));
+  Builder->CreateStore(Primes, Builder->CreateStructGEP(SieveJobType, Job, 1, "primes_ptr"));
+  Builder->CreateStore(BasePrimes, Builder->CreateStructGEP(SieveJobType, Job, 2, "base_primes_ptr"));
+  Builder->CreateStore(NumBase, Builder->CreateStructGEP(SieveJobType, Job, 3, "num_base_ptr"));
+  Builder->CreateStore(Builder->getInt64(0), Builder->CreateStructGEP(SieveJobType, Job, 4, "next_segment_ptr"));
+  Builder->CreateStore(Builder->getInt64(0), T);
+  Builder->CreateBr(CreateLoopCond);
+
+  Builder->SetInsertPoint(CreateLoopCond);
+  Value *TVal = Builder->CreateLoad(Builder->getInt64Ty(), T, "t_val");
+  Value *Cmp3 = Builder->CreateICmpULT(TVal, Builder->getInt64(Threads), "cmp3");
+  Builder->CreateCondBr(Cmp3, CreateLoopBody, JoinLoopCond);
+
+  Builder->SetInsertPoint(CreateLoopBody);
+  Value *ThreadIdPtr = Builder->CreateGEP(ThreadIdsType, ThreadIds, {Builder->getInt64(0), TVal}, "thread_id_ptr");
+  Function *PthreadCreateFunc = TheModule->getFunction("pthread_create");
+  Function *SieveWorkerFunc = TheModule->getFunction("sieve_worker");
+  Value *NullAttr = ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo());
+  Value *CreateResult = Builder->CreateCall(PthreadCreateFunc, {ThreadIdPtr, NullAttr, SieveWorkerFunc, Job}, "create_result");
+  Value *Cmp4 = Builder->CreateICmpEQ(CreateResult, Builder->getInt32(0), "cmp4");
+  Builder->CreateCondBr(Cmp4, CreateLoopNext, CreateFail);
+
+  Builder->SetInsertPoint(CreateLoopNext);
+  Value *TNext = Builder->CreateAdd(TVal, Builder->getInt64(1), "t_next");
+  Builder->CreateStore(TNext, T);
+  Builder->CreateBr(CreateLoopCond);
+
+  Builder->SetInsertPoint(CreateFail);
+  Function *PrintfFunc = TheModule->getFunction("printf");
+  Value *StrThreadFail = TheModule->getNamedGlobal(".str_thread_fail");
+  Builder->CreateCall(PrintfFunc, {StrThreadFail});
+  Function *ExitFunc = TheModule->getFunction("exit");
+  Builder->CreateCall(ExitFunc, {Builder->getInt64(-1)});
+  Builder->CreateUnreachable();
+
+  // All threads were created once the create loop is done, so t counts down
+  // from Threads here.
+  Builder->SetInsertPoint(JoinLoopCond);
+  Value *Joined = Builder->CreateLoad(Builder->getInt64Ty(), T, "joined");
+  Value *Cmp5 = Builder->CreateICmpNE(Joined, Builder->getInt64(0), "cmp5");
+  Builder->CreateCondBr(Cmp5, JoinLoopBody, Return);
+
+  Builder->SetInsertPoint(JoinLoopBody);
+  Value *JoinIdx = Builder->CreateSub(Joined, Builder->getInt64(1), "join_idx");
+  Value *JoinIdPtr = Builder->CreateGEP(ThreadIdsType, ThreadIds, {Builder->getInt64(0), JoinIdx}, "join_id_ptr");
+  Value *JoinId = Builder->CreateLoad(Builder->getInt64Ty(), JoinIdPtr, "join_id");
+  Function *PthreadJoinFunc = TheModule->getFunction("pthread_join");
+  Builder->CreateCall(PthreadJoinFunc, {JoinId, NullAttr});
+  Builder->CreateStore(JoinIdx, T);
+  Builder->CreateBr(JoinLoopCond);
+
+  Builder->SetInsertPoint(Return);
+  Function *FreeFunc = TheModule->getFunction("free");
+  Builder->CreateCall(FreeFunc, {BasePrimes});
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  emitFlushOutputFunction - flush_output() writes the buffered output to
+ *  output_fd, retrying partial writes, and empties the buffer.
+ */
+void emitFlushOutputFunction() {
+  FunctionType *FlushOutputType = FunctionType::get(Builder->getVoidTy(), false);
+  Function *FlushOutputFunc = Function::Create(
+      FlushOutputType, Function::ExternalLinkage, "flush_output", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", FlushOutputFunc);
+  BasicBlock *WriteLoopCond = BasicBlock::Create(*Context, "write_loop_cond", FlushOutputFunc);
+  BasicBlock *WriteLoopBody = BasicBlock::Create(*Context, "write_loop_body", FlushOutputFunc);
+  BasicBlock *WriteOk = BasicBlock::Create(*Context, "write_ok", FlushOutputFunc);
+  BasicBlock *WriteFail = BasicBlock::Create(*Context, "write_fail", FlushOutputFunc);
+  BasicBlock *WriteDone = BasicBlock::Create(*Context, "write_done", FlushOutputFunc);
+
+  Builder->SetInsertPoint(Entry);
+  GlobalVariable *OutputBuffer = TheModule->getNamedGlobal("output_buffer");
+  GlobalVariable *OutputLen = TheModule->getNamedGlobal("output_len");
+  GlobalVariable *OutputFd = TheModule->getNamedGlobal("output_fd");
+  Value *Offset = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "offset");
+  Builder->CreateStore(Builder->getInt64(0), Offset);
+  Value *Len = Builder->CreateLoad(Builder->getInt64Ty(), OutputLen, "len");
+  Value *Fd = Builder->CreateLoad(Builder->getInt32Ty(), OutputFd, "fd");
+  Builder->CreateBr(WriteLoopCond);
+
+  Builder->SetInsertPoint(WriteLoopCond);
+  Value *OffsetVal = Builder->CreateLoad(Builder->getInt64Ty(), Offset, "offset_val");
+  Value *Cmp1 = Builder->CreateICmpULT(OffsetVal, Len, "cmp1");
+  Builder->CreateCondBr(Cmp1, WriteLoopBody, WriteDone);
+
+  Builder->SetInsertPoint(WriteLoopBody);
+  Value *Chunk = Builder->CreateGEP(Builder->getInt8Ty(), OutputBuffer, OffsetVal, "chunk");
+  Value *Remaining = Builder->CreateSub(Len, OffsetVal, "remaining");
+  Function *WriteFunc = TheModule->getFunction("write");
+  Value *Written = Builder->CreateCall(WriteFunc, {Fd, Chunk, Remaining}, "written");
+  Value *Cmp2 = Builder->CreateICmpSGT(Written, Builder->getInt64(0), "cmp2");
+  Builder->CreateCondBr(Cmp2, WriteOk, WriteFail);
+
+  Builder->SetInsertPoint(WriteOk);
+  Value *OffsetNext = Builder->CreateAdd(OffsetVal, Written, "offset_next");
+  Builder->CreateStore(OffsetNext, Offset);
+  Builder->CreateBr(WriteLoopCond);
+
+  // Nobody is left to tell if the output itself is broken.
+  Builder->SetInsertPoint(WriteFail);
+  Function *ExitFunc = TheModule->getFunction("exit");
+  Builder->CreateCall(ExitFunc, {Builder->getInt64(-1)});
+  Builder->CreateUnreachable();
+
+  Builder->SetInsertPoint(WriteDone);
+  Builder->CreateStore(Builder->getInt64(0), OutputLen);
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  emitWritePrimeFunction - write_prime(value) appends value in the format
+ *  of .str_val to the output buffer, flushing it first if it might not fit.
+ *  The digits are produced back to front into a scratch array and copied
+ *  over in one go.
+ */
+void emitWritePrimeFunction() {
+  FunctionType *WritePrimeType = FunctionType::get(Builder->getVoidTy(), {Builder->getInt64Ty()}, false);
+  Function *WritePrimeFunc = Function::Create(
+      WritePrimeType, Function::ExternalLinkage, "write_prime", *TheModule);
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", WritePrimeFunc);
+  BasicBlock *Flush = BasicBlock::Create(*Context, "flush", WritePrimeFunc);
+  BasicBlock *DigitLoop = BasicBlock::Create(*Context, "digit_loop", WritePrimeFunc);
+  BasicBlock *DigitsDone = BasicBlock::Create(*Context, "digits_done", WritePrimeFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Value *Prime = WritePrimeFunc->arg_begin();
+  Prime->setName("prime");
+  // 20 digits for the largest i64, a space and a newline.
+  const uint64_t MaxDigits = 20;
+  Type *DigitsType = ArrayType::get(Builder->getInt8Ty(), MaxDigits);
+  Value *Digits = Builder->CreateAlloca(DigitsType, nullptr, "digits");
+  Value *Rest = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "rest");
+  Value *Pos = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "pos");
+  Builder->CreateStore(Prime, Rest);
+  Builder->CreateStore(Builder->getInt64(MaxDigits), Pos);
+  GlobalVariable *OutputBuffer = TheModule->getNamedGlobal("output_buffer");
+  GlobalVariable *OutputLen = TheModule->getNamedGlobal("output_len");
+  Value *Len = Builder->CreateLoad(Builder->getInt64Ty(), OutputLen, "len");
+  Value *MightOverflow = Builder->CreateICmpUGT(Len, Builder->getInt64(OutputBufferBytes - MaxDigits - 2), "might_overflow");
+  Builder->CreateCondBr(MightOverflow, Flush, DigitLoop);
+
+  Builder->SetInsertPoint(Flush);
+  Function *FlushOutputFunc = TheModule->getFunction("flush_output");
+  Builder->CreateCall(FlushOutputFunc, {});
+  Builder->CreateBr(DigitLoop);
+
+  Builder->SetInsertPoint(DigitLoop);
+  Value *RestVal = Builder->CreateLoad(Builder->getInt64Ty(), Rest, "rest_val");
+  Value *PosVal = Builder->CreateLoad(Builder->getInt64Ty(), Pos, "pos_val");
+  Value *PosNext = Builder->CreateSub(PosVal, Builder->getInt64(1), "pos_next");
+  Value *Digit1 = Builder->CreateURem(RestVal, Builder->getInt64(10), "digit_1");
+  Value *Digit2 = Builder->CreateTrunc(Digit1, Builder->getInt8Ty(), "digit_2");
+  Value *Digit = Builder->CreateAdd(Digit2, Builder->getInt8('0'), "digit");
+  Value *DigitPtr = Builder->CreateGEP(DigitsType, Digits, {Builder->getInt64(0), PosNext}, "digit_ptr");
+  Builder->CreateStore(Digit, DigitPtr);
+  Value *RestNext = Builder->CreateUDiv(RestVal, Builder->getInt64(10), "rest_next");
+  Builder->CreateStore(RestNext, Rest);
+  Builder->CreateStore(PosNext, Pos);
+  Value *HasMore = Builder->CreateICmpNE(RestNext, Builder->getInt64(0), "has_more");
+  Builder->CreateCondBr(HasMore, DigitLoop, DigitsDone);
+
+  Builder->SetInsertPoint(DigitsDone);
+  Value *Start = Builder->CreateLoad(Builder->getInt64Ty(), OutputLen, "start");
+  Value *NumDigits = Builder->CreateSub(Builder->getInt64(MaxDigits), PosNext, "num_digits");
+  Value *Dst = Builder->CreateGEP(Builder->getInt8Ty(), OutputBuffer, Start, "dst");
+  Builder->CreateMemCpy(Dst, MaybeAlign(1), DigitPtr, MaybeAlign(1), NumDigits);
+  Value *SpacePos = Builder->CreateAdd(Start, NumDigits, "space_pos");
+  Value *SpacePtr = Builder->CreateGEP(Builder->getInt8Ty(), OutputBuffer, SpacePos, "space_ptr");
+  Builder->CreateStore(Builder->getInt8(' '), SpacePtr);
+  Value *NewlinePtr = Builder->CreateGEP(Builder->getInt8Ty(), SpacePtr, Builder->getInt64(1), "newline_ptr");
+  Builder->CreateStore(Builder->getInt8('\n'), NewlinePtr);
+  Value *End = Builder->CreateAdd(SpacePos, Builder->getInt64(2), "end");
+  Builder->CreateStore(End, OutputLen);
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  emitPresieveFunction - presieve(words, num_words) ors the presieve
+ *  pattern into the first num_words words of the bitmap, a vector of
+ *  words at a time, and then clears the bits of the presieve primes, which
+ *  the pattern strikes as multiples of themselves.
+ */
+void emitPresieveFunction() {
+  FunctionType *PresieveType = FunctionType::get(
+      Builder->getVoidTy(),
+      {Builder->getInt64Ty()->getPointerTo(),
+        Builder->getInt64Ty()},
+      false
+  );
+
+  Function *PresieveFunc = Function::Create(
+      PresieveType, Function::ExternalLinkage, "presieve", *TheModule);
+
+  unsigned Lanes = 1;
+  switch (Presieve) {
+  case PresieveKind::None:
+  case PresieveKind::Generic:
+    break;
+  case PresieveKind::SSE2:
+    Lanes = 2;
+    break;
+  case PresieveKind::AVX2:
+    Lanes = 4;
+    PresieveFunc->addFnAttr("target-features", "+avx2");
+    break;
+  case PresieveKind::AVX512:
+    Lanes = 8;
+    PresieveFunc->addFnAttr("target-features", "+avx512f");
+    break;
+  }
+  Type *ChunkType = Builder->getInt64Ty();
+  if (Lanes > 1) {
+    ChunkType = FixedVectorType::get(Builder->getInt64Ty(), Lanes);
+  }
+
+  BasicBlock *Entry = BasicBlock::Create(*Context, "entry", PresieveFunc);
+  BasicBlock *ChunkLoopCond = BasicBlock::Create(*Context, "chunk_loop_cond", PresieveFunc);
+  BasicBlock *ChunkLoopBody = BasicBlock::Create(*Context, "chunk_loop_body", PresieveFunc);
+  BasicBlock *TailLoopCond = BasicBlock::Create(*Context, "tail_loop_cond", PresieveFunc);
+  BasicBlock *TailLoopBody = BasicBlock::Create(*Context, "tail_loop_body", PresieveFunc);
+  BasicBlock *ClearPrimes = BasicBlock::Create(*Context, "clear_primes", PresieveFunc);
+
+  Builder->SetInsertPoint(Entry);
+  Function::arg_iterator Args = PresieveFunc->arg_begin();
+  Value *Words = Args++;
+  Words->setName("words");
+  Value *NumWords = Args++;
+  NumWords->setName("num_words");
+  Value *W = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "w");
+  Value *PatternOffset = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "pattern_offset");
+  Builder->CreateStore(Builder->getInt64(0), W);
+  Builder->CreateStore(Builder->getInt64(0), PatternOffset);
+  Builder->CreateBr(ChunkLoopCond);
+
+  GlobalVariable *Pattern = TheModule->getNamedGlobal("presieve_pattern");
+  // Ors Step words of the pattern into the bitmap at w, then advances w and
+  // the pattern offset, which wraps around at the end of the period.
+  auto EmitOrPattern = [&](Type *Ty, uint64_t Step, Value *WVal) {
+    Value *PatternOffsetVal = Builder->CreateLoad(Builder->getInt64Ty(), PatternOffset, "pattern_offset_val");
+    Value *Src = Builder->CreateGEP(Builder->getInt64Ty(), Pattern, PatternOffsetVal, "src");
+    Value *PatternChunk = Builder->CreateAlignedLoad(Ty, Src, Align(8), "pattern_chunk");
+    Value *Dst = Builder->CreateGEP(Builder->getInt64Ty(), Words, WVal, "dst");
+    Value *WordChunk = Builder->CreateAlignedLoad(Ty, Dst, Align(8), "word_chunk");
+    Value *Struck = Builder->CreateOr(WordChunk, PatternChunk, "struck");
+    Builder->CreateAlignedStore(Struck, Dst, Align(8));
+    Value *WNext = Builder->CreateAdd(WVal, Builder->getInt64(Step), "w_next");
+    Builder->CreateStore(WNext, W);
+    Value *Advanced = Builder->CreateAdd(PatternOffsetVal, Builder->getInt64(Step), "advanced");
+    Value *Wraps = Builder->CreateICmpUGE(Advanced, Builder->getInt64(PresievePeriodWords), "wraps");
+    Value *Wrapped = Builder->CreateSub(Advanced, Builder->getInt64(PresievePeriodWords), "wrapped");
+    Value *PatternOffsetNext = Builder->CreateSelect(Wraps, Wrapped, Advanced, "pattern_offset_next");
+    Builder->CreateStore(PatternOffsetNext, PatternOffset);
+  };
+
+  Builder->SetInsertPoint(ChunkLoopCond);
+  Value *WVal = Builder->CreateLoad(Builder->getInt64Ty(), W, "w_val");
+  Value *ChunkEnd = Builder->CreateAdd(WVal, Builder->getInt64(Lanes), "chunk_end");
+  Value *Cmp1 = Builder->CreateICmpULE(ChunkEnd, NumWords, "cmp1");
+  Builder->CreateCondBr(Cmp1, ChunkLoopBody, TailLoopCond);
+
+  Builder->SetInsertPoint(ChunkLoopBody);
+  EmitOrPattern(ChunkType, Lanes, WVal);
+  Builder->CreateBr(ChunkLoopCond);
+
+  Builder->SetInsertPoint(TailLoopCond);
+  Value *TailWVal = Builder->CreateLoad(Builder->getInt64Ty(), W, "tail_w_val");
+  Value *Cmp2 = Builder->CreateICmpULT(TailWVal, NumWords, "cmp2");
+  Builder->CreateCondBr(Cmp2, TailLoopBody, ClearPrimes);
+
+  Builder->SetInsertPoint(TailLoopBody);
+  EmitOrPattern(Builder->getInt64Ty(), 1, TailWVal);
+  Builder->CreateBr(TailLoopCond);
+
+  // All presieve primes are below 64, the first word always exists.
+  Builder->SetInsertPoint(ClearPrimes);
+  Function *SetBitFunc = TheModule->getFunction("set_bit");
+  for (uint64_t Prime : PresievePrimes) {
+    Builder->CreateCall(SetBitFunc, {Builder->getInt64(Prime), Words, Builder->getInt1(false)});
+  }
+  Builder->CreateRetVoid();
+
+  verify();
+}
+
+/**
+ *  emitPrintPrime - Emit code at the insertion point that prints Prime the
+ *  way -output asks for.
+ */
+void emitPrintPrime(Value *Prime) {
+  if (Output == OutputKind::Buffered) {
+    Function *WritePrimeFunc = TheModule->getFunction("write_prime");
+    Builder->CreateCall(WritePrimeFunc, {Prime});
+    return;
+  }
+  Function *PrintfFunc = TheModule->getFunction("printf");
+  GlobalVariable *StrVal = TheModule->getNamedGlobal(".str_val");
+  Value *StrValPtr = Builder->CreatePointerCast(StrVal, Builder->getInt8Ty()->getPointerTo());
+  Builder->CreateCall(PrintfFunc, {StrValPtr, Prime});
+}
+
 void emitCalcPrimesFunction() {
   FunctionType *CalcPrimesType = FunctionType::get(
       Builder->getVoidTy(),
@@ -362,7 +1617,48 @@ void emitCalcPrimesFunction() {
   Value *Primes = Args++;
   Primes->setName("primes");
   Value *I = Builder->CreateAlloca(Builder->getInt64Ty(), nullptr, "i");
-  Builder->CreateStore(Builder->getInt64(2), I);
+  // The primes that divide the wheel are not stored in the bitmap.
+  SmallVector<uint64_t, 3> WheelPrimes;
+  uint64_t FirstPrime = 2;
+  if (Layout == BitmapLayout::Odd) {
+    WheelPrimes = {2};
+    FirstPrime = 3;
+  } else if (Layout == BitmapLayout::Wheel30) {
+    WheelPrimes = {2, 3, 5};
+    FirstPrime = 7;
+  }
+  if (Output == OutputKind::Buffered) {
+    // The array size message is still in the buffer of stdio.
+    Function *FflushFunc = TheModule->getFunction("fflush");
+    Builder->CreateCall(FflushFunc, {ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo())});
+  }
+  for (uint64_t WheelPrime : WheelPrimes) {
+    BasicBlock *PrintWheelPrime = BasicBlock::Create(*Context, "print_wheel_prime", CalcPrimesFunc, CalcPrimesLoopCond);
+    BasicBlock *WheelPrimeDone = BasicBlock::Create(*Context, "wheel_prime_done", CalcPrimesFunc, CalcPrimesLoopCond);
+    Value *IsBelowN = Builder->CreateICmpSLT(Builder->getInt64(WheelPrime), N, "is_below_n");
+    Builder->CreateCondBr(IsBelowN, PrintWheelPrime, WheelPrimeDone);
+
+    Builder->SetInsertPoint(PrintWheelPrime);
+    emitPrintPrime(Builder->getInt64(WheelPrime));
+    Builder->CreateBr(WheelPrimeDone);
+
+    Builder->SetInsertPoint(WheelPrimeDone);
+  }
+  Builder->CreateStore(Builder->getInt64(FirstPrime), I);
+  if (Presieve != PresieveKind::None) {
+    Value *NumWords1 = Builder->CreateUDiv(N, Builder->getInt64(64), "num_words_1");
+    Value *NumWords = Builder->CreateAdd(NumWords1, Builder->getInt64(1), "num_words");
+    Function *PresieveFunc = TheModule->getFunction("presieve");
+    Builder->CreateCall(PresieveFunc, {Primes, NumWords});
+  }
+  if (Mode == SieveMode::Segmented) {
+    // All composites are struck up front, the loop only walks the primes.
+    Function *SieveSegmentedFunc = TheModule->getFunction("sieve_segmented");
+    Builder->CreateCall(SieveSegmentedFunc, {N, Primes});
+  } else if (Mode == SieveMode::Parallel) {
+    Function *SieveParallelFunc = TheModule->getFunction("sieve_parallel");
+    Builder->CreateCall(SieveParallelFunc, {N, Primes});
+  }
   Builder->CreateBr(CalcPrimesLoopCond);
 
   Builder->SetInsertPoint(CalcPrimesLoopCond);
@@ -371,12 +1667,25 @@ void emitCalcPrimesFunction() {
   Builder->CreateCondBr(Cmp1, CalcPrimesLoopBody, CalcPrimesDone);
 
   Builder->SetInsertPoint(CalcPrimesLoopBody);
-  Function *PrintfFunc = TheModule->getFunction("printf");
-  GlobalVariable *StrVal = TheModule->getNamedGlobal(".str_val");
-  Value *StrValPtr = Builder->CreatePointerCast(StrVal, Builder->getInt8Ty()->getPointerTo());
-  Builder->CreateCall(PrintfFunc, {StrValPtr, IVal});
-  Function *SieveFunc = TheModule->getFunction("sieve");
-  Builder->CreateCall(SieveFunc, {IVal, Primes, N});
+  emitPrintPrime(IVal);
+  if (Mode == SieveMode::Classic) {
+    Function *SieveFunc = TheModule->getFunction("sieve");
+    if (Presieve != PresieveKind::None) {
+      // The multiples of the presieve primes are struck already.
+      BasicBlock *CalcPrimesSieve = BasicBlock::Create(*Context, "calc_primes_sieve", CalcPrimesFunc, CalcPrimesDone);
+      BasicBlock *CalcPrimesNext = BasicBlock::Create(*Context, "calc_primes_next", CalcPrimesFunc, CalcPrimesDone);
+      Value *IsPresieved = Builder->CreateICmpULE(IVal, Builder->getInt64(ArrayRef<uint64_t>(PresievePrimes).back()), "is_presieved");
+      Builder->CreateCondBr(IsPresieved, CalcPrimesNext, CalcPrimesSieve);
+
+      Builder->SetInsertPoint(CalcPrimesSieve);
+      Builder->CreateCall(SieveFunc, {IVal, Primes, N});
+      Builder->CreateBr(CalcPrimesNext);
+
+      Builder->SetInsertPoint(CalcPrimesNext);
+    } else {
+      Builder->CreateCall(SieveFunc, {IVal, Primes, N});
+    }
+  }
   Function *NextPrimeFunc = TheModule->getFunction("next_prime");
   Value *NextPrime = Builder->CreateCall(NextPrimeFunc, {IVal, Primes, N}, "next_prime");
   Builder->CreateStore(NextPrime, I);
@@ -384,6 +1693,10 @@ void emitCalcPrimesFunction() {
   Builder->CreateCondBr(Cmp2, CalcPrimesDone, CalcPrimesLoopCond);
 
   Builder->SetInsertPoint(CalcPrimesDone);
+  if (Output == OutputKind::Buffered) {
+    Function *FlushOutputFunc = TheModule->getFunction("flush_output");
+    Builder->CreateCall(FlushOutputFunc, {});
+  }
   Builder->CreateRetVoid();
 
   verify();
@@ -391,8 +1704,8 @@ void emitCalcPrimesFunction() {
 
 void emitMainFunction() {
   FunctionType *MainType = FunctionType::get(
-      Builder->getInt64Ty(),
-      {Builder->getInt64Ty(),
+      Builder->getInt32Ty(),
+      {Builder->getInt32Ty(),
         Builder->getInt8Ty()->getPointerTo()},
       false
   );
@@ -412,14 +1725,37 @@ void emitMainFunction() {
   Argc->setName("argc");
   Value *Argv = Args++;
   Argv->setName("argv");
-  Value *ArgcCheck = Builder->CreateICmpEQ(Argc, Builder->getInt64(2), "argc_check");
+  Value *ArgcCheck = Builder->CreateICmpEQ(Argc, Builder->getInt32(2), "argc_check");
+  Value *HasFd = nullptr;
+  if (Output == OutputKind::Buffered) {
+    HasFd = Builder->CreateICmpEQ(Argc, Builder->getInt32(3), "has_fd");
+    ArgcCheck = Builder->CreateOr(ArgcCheck, HasFd, "argc_check_fd");
+  }
   Builder->CreateCondBr(ArgcCheck, ParseInput, Error);
 
   Builder->SetInsertPoint(ParseInput);
+  if (HasFd) {
+    // The output goes to stdout unless a file descriptor follows n.
+    BasicBlock *ParseFd = BasicBlock::Create(*Context, "parse_fd", MainFunc, MainBody);
+    BasicBlock *ParseN = BasicBlock::Create(*Context, "parse_n", MainFunc, MainBody);
+    Builder->CreateCondBr(HasFd, ParseFd, ParseN);
+
+    Builder->SetInsertPoint(ParseFd);
+    Value *FdPtr = Builder->CreateGEP(Builder->getInt8Ty()->getPointerTo(), Argv, Builder->getInt64(2), "fd_ptr");
+    Value *FdArg = Builder->CreateLoad(Builder->getInt8Ty()->getPointerTo(), FdPtr, "fd_arg");
+    Function *StrtoullFunc = TheModule->getFunction("strtoull");
+    Value *Fd1 = Builder->CreateCall(StrtoullFunc, {FdArg, ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo()), Builder->getInt32(10)}, "fd_1");
+    Value *Fd = Builder->CreateTrunc(Fd1, Builder->getInt32Ty(), "fd");
+    Builder->CreateStore(Fd, TheModule->getNamedGlobal("output_fd"));
+    Builder->CreateBr(ParseN);
+
+    Builder->SetInsertPoint(ParseN);
+  }
   Value *NPtr = Builder->CreateGEP(Builder->getInt8Ty()->getPointerTo(), Argv, Builder->getInt64(1), "n_ptr");
   Value *NArg = Builder->CreateLoad(Builder->getInt8Ty()->getPointerTo(), NPtr, "n_arg");
-  Function *AtoiFunc = TheModule->getFunction("atoi");
-  Value *N = Builder->CreateCall(AtoiFunc, {NArg}, "n");
+  // Values of 2^63 and above are negative here and rejected as well.
+  Function *StrtoullFunc = TheModule->getFunction("strtoull");
+  Value *N = Builder->CreateCall(StrtoullFunc, {NArg, ConstantPointerNull::get(Builder->getInt8Ty()->getPointerTo()), Builder->getInt32(10)}, "n");
   Value *NValid = Builder->CreateICmpSGT(N, Builder->getInt64(2), "n_valid");
   Builder->CreateCondBr(NValid, MainBody, Error);
 
@@ -431,9 +1767,9 @@ void emitMainFunction() {
   Builder->CreateBr(Cleanup);
 
   Builder->SetInsertPoint(Cleanup);
-  Function *FreeFunc = TheModule->getFunction("free");
-  Builder->CreateCall(FreeFunc, {Primes});
-  Builder->CreateRet(Builder->getInt64(0));
+  Function *FreeArrayFunc = TheModule->getFunction("free_array");
+  Builder->CreateCall(FreeArrayFunc, {Primes, N});
+  Builder->CreateRet(Builder->getInt32(0));
 
   Builder->SetInsertPoint(Error);
   Function *PrintfFunc = TheModule->getFunction("printf");
@@ -447,21 +1783,248 @@ void emitMainFunction() {
   verify();
 }
 
-int main() {
+/**
+ *  optimizeForJit - Run the -jit-passes pipeline, or the default pipeline of
+ *  -jit-opt, on TheModule for the target machine TM.
+ */
+static Error optimizeForJit(TargetMachine &TM, OptimizationLevel Level) {
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(&TM);
+  trainOpt::registerPassBuilderCallbacks(PB);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (!JitPasses.empty()) {
+    if (Error E = PB.parsePassPipeline(MPM, JitPasses)) {
+      return E;
+    }
+  } else if (Level == OptimizationLevel::O0) {
+    return Error::success();
+  } else {
+    MPM = PB.buildPerModuleDefaultPipeline(Level);
+  }
+  MPM.run(*TheModule, MAM);
+  return Error::success();
+}
+
+/**
+ *  runJit - Compile TheModule with LLJIT and time JitRuns calls of the
+ *  -jit-entry function. stdout is flushed inside the timed region, so
+ *  buffered printf output counts as part of the run.
+ */
+static Error runJit() {
+  static const OptimizationLevel Levels[] = {
+      OptimizationLevel::O0, OptimizationLevel::O1, OptimizationLevel::O2,
+      OptimizationLevel::O3};
+  static const CodeGenOptLevel CodeGenLevels[] = {
+      CodeGenOptLevel::None, CodeGenOptLevel::Less, CodeGenOptLevel::Default,
+      CodeGenOptLevel::Aggressive};
+  if (JitOptLevel > 3) {
+    return createStringError(inconvertibleErrorCode(),
+                             "-jit-opt must be between 0 and 3");
+  }
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  Expected<orc::JITTargetMachineBuilder> JTMB =
+      orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB) {
+    return JTMB.takeError();
+  }
+  JTMB->setCodeGenOptLevel(CodeGenLevels[JitOptLevel]);
+  Expected<std::unique_ptr<TargetMachine>> TM = JTMB->createTargetMachine();
+  if (!TM) {
+    return TM.takeError();
+  }
+  TheModule->setDataLayout((*TM)->createDataLayout());
+  TheModule->setTargetTriple((*TM)->getTargetTriple().str());
+  if (Error E = optimizeForJit(**TM, Levels[JitOptLevel])) {
+    return E;
+  }
+
+  Expected<std::unique_ptr<orc::LLJIT>> J =
+      orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*JTMB)).create();
+  if (!J) {
+    return J.takeError();
+  }
+  // printf, malloc and friends come from the C library of this process.
+  Expected<std::unique_ptr<orc::DynamicLibrarySearchGenerator>> ProcessSymbols =
+      orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*J)->getDataLayout().getGlobalPrefix());
+  if (!ProcessSymbols) {
+    return ProcessSymbols.takeError();
+  }
+  (*J)->getMainJITDylib().addGenerator(std::move(*ProcessSymbols));
+  if (Error E = (*J)->addIRModule(
+          orc::ThreadSafeModule(std::move(TheModule), std::move(Context)))) {
+    return E;
+  }
+
+  using MainFn = int (*)(int, char **);
+  using InitArrayFn = void *(*)(int64_t);
+  using CalcPrimesFn = void (*)(int64_t, void *);
+  using FreeArrayFn = void (*)(void *, int64_t);
+  MainFn Main = nullptr;
+  InitArrayFn InitArray = nullptr;
+  CalcPrimesFn CalcPrimes = nullptr;
+  FreeArrayFn FreeArray = nullptr;
+  if (JitEntry == JitEntryKind::Main) {
+    Expected<orc::ExecutorAddr> Addr = (*J)->lookup("main");
+    if (!Addr) {
+      return Addr.takeError();
+    }
+    Main = Addr->toPtr<MainFn>();
+  } else {
+    Expected<orc::ExecutorAddr> InitArrayAddr = (*J)->lookup("init_array");
+    if (!InitArrayAddr) {
+      return InitArrayAddr.takeError();
+    }
+    Expected<orc::ExecutorAddr> CalcPrimesAddr = (*J)->lookup("calc_primes");
+    if (!CalcPrimesAddr) {
+      return CalcPrimesAddr.takeError();
+    }
+    Expected<orc::ExecutorAddr> FreeArrayAddr = (*J)->lookup("free_array");
+    if (!FreeArrayAddr) {
+      return FreeArrayAddr.takeError();
+    }
+    InitArray = InitArrayAddr->toPtr<InitArrayFn>();
+    CalcPrimes = CalcPrimesAddr->toPtr<CalcPrimesFn>();
+    FreeArray = FreeArrayAddr->toPtr<FreeArrayFn>();
+  }
+
+  std::string ProgName = "sieve";
+  std::string NArg = std::to_string(JitN);
+  char *Argv[] = {ProgName.data(), NArg.data(), nullptr};
+  std::vector<double> Millis;
+  for (unsigned Run = 0; Run < JitRuns; ++Run) {
+    void *Primes = nullptr;
+    if (InitArray) {
+      Primes = InitArray(JitN);
+      fflush(stdout);
+    }
+    auto Start = std::chrono::steady_clock::now();
+    if (Main) {
+      Main(2, Argv);
+    } else {
+      CalcPrimes(JitN, Primes);
+    }
+    fflush(stdout);
+    auto End = std::chrono::steady_clock::now();
+    if (FreeArray) {
+      FreeArray(Primes, JitN);
+    }
+    Millis.push_back(
+        std::chrono::duration<double, std::milli>(End - Start).count());
+  }
+
+  std::sort(Millis.begin(), Millis.end());
+  std::vector<unsigned> Percentiles(JitPercentiles.begin(),
+                                    JitPercentiles.end());
+  if (Percentiles.empty()) {
+    Percentiles = {90, 99};
+  }
+  errs() << "runs: " << Millis.size() << ", n: " << JitN << "\n";
+  if (Millis.empty()) {
+    return Error::success();
+  }
+  errs() << format("min: %.3f ms\n", Millis.front());
+  errs() << format("median: %.3f ms\n", Millis[(Millis.size() - 1) / 2]);
+  // Nearest rank percentiles.
+  for (unsigned Percentile : Percentiles) {
+    size_t Rank = std::ceil(std::min(Percentile, 100u) / 100.0 * Millis.size());
+    errs() << format("p%u: %.3f ms\n", Percentile,
+                     Millis[std::max<size_t>(Rank, 1) - 1]);
+  }
+  return Error::success();
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "sieve of Eratosthenes IR generator\n");
+  if (Layout != BitmapLayout::All &&
+      (Bitmap != BitmapKind::Words || Mode != SieveMode::Classic)) {
+    errs() << argv[0] << ": -layout=odd and -layout=wheel30 need -bitmap=words -mode=classic\n";
+    return 1;
+  }
+  if (Presieve != PresieveKind::None &&
+      (Bitmap != BitmapKind::Words || Mode != SieveMode::Classic ||
+       Layout != BitmapLayout::All)) {
+    errs() << argv[0] << ": -presieve needs -bitmap=words -mode=classic -layout=all\n";
+    return 1;
+  }
+  // An empty segment never advances, the generated program would not end.
+  if (Mode == SieveMode::Segmented && SegmentBytes == 0) {
+    errs() << argv[0] << ": -mode=segmented needs a positive -segment-bytes\n";
+    return 1;
+  }
+  if (Mode == SieveMode::Parallel &&
+      (Threads == 0 || SegmentBytes == 0 || SegmentBytes % 8 != 0)) {
+    errs() << argv[0] << ": -mode=parallel needs at least one thread and a positive multiple of 8 as -segment-bytes\n";
+    return 1;
+  }
+  if (OutputBufferBytes < 22) {
+    errs() << argv[0] << ": -output-buffer-bytes must fit one prime, i.e. be at least 22\n";
+    return 1;
+  }
+
   Context = std::make_unique<LLVMContext>();
   TheModule = std::make_unique<Module>("MSU CMC - TOPT 2024, 527, Buklov Boris", *Context);
   Builder = std::make_unique<IRBuilder<>>(*Context);
 
   emitExternalFunctions();  
   emitConstants();
-  emitSetBitFunction();
-  emitCheckBitFunction();
-  emitInitArrayFunction();
-  emitSieveFunction();
-  emitNextPrimeFunction();
+  if (Bitmap == BitmapKind::Bytes) {
+    emitSetBitFunction();
+    emitCheckBitFunction();
+    emitInitArrayFunction();
+    emitFreeArrayFunction();
+    emitSieveFunction();
+    emitNextPrimeFunction();
+  } else {
+    emitWordSetBitFunction();
+    emitInitArrayFunction();
+    emitFreeArrayFunction();
+    if (Layout == BitmapLayout::All) {
+      emitSieveFunction();
+    } else {
+      emitLayoutSieveFunction();
+    }
+    emitWordNextPrimeFunction();
+  }
+  if (Mode == SieveMode::Segmented) {
+    emitIntSqrtFunction();
+    emitSegmentedSieveFunction();
+  } else if (Mode == SieveMode::Parallel) {
+    emitIntSqrtFunction();
+    emitSieveWorkerFunction();
+    emitParallelSieveFunction();
+  }
+  if (Presieve != PresieveKind::None) {
+    emitPresieveFunction();
+  }
+  if (Output == OutputKind::Buffered) {
+    emitFlushOutputFunction();
+    emitWritePrimeFunction();
+  }
   emitCalcPrimesFunction();
   emitMainFunction();
 
+  if (Jit) {
+    if (Error E = runJit()) {
+      errs() << argv[0] << ": " << toString(std::move(E)) << "\n";
+      return 1;
+    }
+    return 0;
+  }
+
   TheModule->print(outs(), nullptr);
 
   return 0;
@@ -0,0 +1,337 @@
+//===- topt-bench.cpp - Compile time benchmarks of the topt passes --------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Times single topt passes on a corpus of modules. Every repetition runs the
+// pass on a fresh clone of the module, so each one sees the same input and
+// nothing but the pass itself is timed. The results are printed as JSON meant
+// to be compared between commits.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/NoFolder.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "topt/Passes/Passes.h"
+#include "topt/Support/AllocationCounter.h"
+
+#include <chrono>
+#include <sys/resource.h>
+
+using namespace llvm;
+
+static cl::list<std::string> InputFilenames(cl::Positional, cl::ZeroOrMore,
+                                            cl::desc("<input IR files>"));
+
+static cl::list<unsigned> SyntheticInsts(
+    "synthetic-insts", cl::CommaSeparated,
+    cl::desc("Add a generated module of about <n> instructions to the corpus "
+             "for each given size"),
+    cl::value_desc("n,..."));
+
+static cl::list<std::string> BenchPasses(
+    "bench-passes", cl::CommaSeparated,
+    cl::desc("Passes to time, each on its own (default: "
+             "topt-sccp,topt-sscp,topt-lvn)"),
+    cl::value_desc("pass,..."));
+
+static cl::opt<unsigned>
+    Repetitions("repetitions",
+                cl::desc("Number of timed runs per pass and module"),
+                cl::init(5));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Output JSON filename"),
+                                           cl::init("-"),
+                                           cl::value_desc("filename"));
+
+namespace {
+/** One module of the corpus. */
+struct CorpusEntry {
+  std::string Name;
+  std::unique_ptr<Module> M;
+};
+
+/** The measurements of one pass on one corpus module. */
+struct BenchResult {
+  std::string Module;
+  std::string Pass;
+  uint64_t Functions = 0;
+  uint64_t Insts = 0;
+  uint64_t InstsAfter = 0;
+  SmallVector<uint64_t, 8> WallNanos;
+  uint64_t Allocations = 0;
+  long PeakRSSKB = 0;
+  long PeakRSSDeltaKB = 0;
+};
+
+/**
+ *  PassRunner - One topt pass parsed from its pipeline name, with the
+ *  analysis managers it needs.
+ */
+class PassRunner {
+public:
+  static Expected<std::unique_ptr<PassRunner>> create(StringRef PassName);
+
+  /**
+   *  run - Run the pass on M, function passes on every defined function.
+   *  Returns the time spent in the pass, analyses it requested included.
+   */
+  std::chrono::nanoseconds run(Module &M);
+
+private:
+  PassRunner()
+      : PB(/*TM=*/nullptr, PipelineTuningOptions(), /*PGOOpt=*/std::nullopt) {
+    trainOpt::registerPassBuilderCallbacks(PB);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  }
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB;
+  ModulePassManager MPM;
+};
+} // namespace
+
+Expected<std::unique_ptr<PassRunner>> PassRunner::create(StringRef PassName) {
+  std::unique_ptr<PassRunner> Runner(new PassRunner());
+  if (Error Err = Runner->PB.parsePassPipeline(Runner->MPM, PassName)) {
+    return std::move(Err);
+  }
+  return std::move(Runner);
+}
+
+std::chrono::nanoseconds PassRunner::run(Module &M) {
+  auto Start = std::chrono::steady_clock::now();
+  MPM.run(M, MAM);
+  std::chrono::nanoseconds Time = std::chrono::steady_clock::now() - Start;
+  // The next clone may reuse the addresses of this one.
+  LAM.clear();
+  FAM.clear();
+  CGAM.clear();
+  MAM.clear();
+  return Time;
+}
+
+static long getMaxRSSKB() {
+  rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage)) {
+    return 0;
+  }
+  return Usage.ru_maxrss;
+}
+
+static uint64_t countDefinedFunctions(const Module &M) {
+  return count_if(M, [](const Function &F) { return !F.isDeclaration(); });
+}
+
+/**
+ *  buildSyntheticModule - A single function of about NumInsts instructions
+ *  made of CFG diamonds. Every diamond has constant arithmetic and a branch
+ *  on it for the constant propagation passes to fold, plus a repeated
+ *  expression for LVN. The NoFolder keeps IRBuilder from folding anything
+ *  itself.
+ */
+static std::unique_ptr<Module> buildSyntheticModule(LLVMContext &Context,
+                                                    unsigned NumInsts) {
+  auto M = std::make_unique<Module>("synthetic-" + std::to_string(NumInsts),
+                                    Context);
+  IRBuilder<NoFolder> Builder(Context);
+  Type *I64 = Builder.getInt64Ty();
+  FunctionType *FT = FunctionType::get(I64, {I64, I64}, /*isVarArg=*/false);
+  Function *F =
+      Function::Create(FT, Function::ExternalLinkage, "synthetic", M.get());
+  Argument *A = F->getArg(0);
+  Argument *B = F->getArg(1);
+  A->setName("a");
+  B->setName("b");
+
+  BasicBlock *Entry = BasicBlock::Create(Context, "entry", F);
+  Builder.SetInsertPoint(Entry);
+  Value *Acc = Builder.CreateAdd(A, B, "acc");
+
+  // Each diamond below adds 12 instructions.
+  for (unsigned Diamond = 0, Size = 1; Size < NumInsts; ++Diamond, Size += 12) {
+    uint64_t K = Diamond % 97 + 1;
+    Value *Base = Builder.CreateAdd(Acc, Builder.getInt64(K), "base");
+    Value *Prod1 = Builder.CreateMul(Base, B, "prod1");
+    Value *Prod2 = Builder.CreateMul(Base, B, "prod2");
+    Value *Const = Builder.CreateAdd(Builder.getInt64(K), Builder.getInt64(3),
+                                     "const");
+    Value *Cond = Builder.CreateICmpEQ(Const, Builder.getInt64(K + 3), "cond");
+
+    BasicBlock *Then = BasicBlock::Create(Context, "then", F);
+    BasicBlock *Else = BasicBlock::Create(Context, "else", F);
+    BasicBlock *Merge = BasicBlock::Create(Context, "merge", F);
+    Builder.CreateCondBr(Cond, Then, Else);
+
+    Builder.SetInsertPoint(Then);
+    Value *ThenVal = Builder.CreateAdd(Prod1, Const, "then_val");
+    Builder.CreateBr(Merge);
+
+    Builder.SetInsertPoint(Else);
+    Value *ElseVal = Builder.CreateSub(Prod2, Const, "else_val");
+    Builder.CreateBr(Merge);
+
+    Builder.SetInsertPoint(Merge);
+    PHINode *Phi = Builder.CreatePHI(I64, 2, "merged");
+    Phi->addIncoming(ThenVal, Then);
+    Phi->addIncoming(ElseVal, Else);
+    Acc = Builder.CreateXor(Acc, Phi, "acc");
+  }
+  Builder.CreateRet(Acc);
+
+  assert(!verifyModule(*M, &errs()) && "Synthetic module is broken");
+  return M;
+}
+
+static BenchResult runBenchmark(const CorpusEntry &Entry, StringRef PassName,
+                                PassRunner &Runner) {
+  BenchResult R;
+  R.Module = Entry.Name;
+  R.Pass = PassName.str();
+  R.Functions = countDefinedFunctions(*Entry.M);
+  R.Insts = Entry.M->getInstructionCount();
+
+  long RSSBefore = getMaxRSSKB();
+  uint64_t MinAllocations = UINT64_MAX;
+  for (unsigned Rep = 0; Rep < Repetitions; ++Rep) {
+    std::unique_ptr<Module> Clone = CloneModule(*Entry.M);
+    uint64_t AllocationsBefore = trainOpt::getThreadAllocationCount();
+    R.WallNanos.push_back(Runner.run(*Clone).count());
+    // The first repetition also pays for one time initialization, the
+    // smallest count is the steady state.
+    MinAllocations = std::min(MinAllocations,
+                              trainOpt::getThreadAllocationCount() -
+                                  AllocationsBefore);
+    R.InstsAfter = Clone->getInstructionCount();
+  }
+  R.Allocations = MinAllocations;
+  R.PeakRSSKB = getMaxRSSKB();
+  R.PeakRSSDeltaKB = R.PeakRSSKB - RSSBefore;
+  llvm::sort(R.WallNanos);
+  return R;
+}
+
+static void writeResults(ArrayRef<BenchResult> Results, raw_ostream &OS) {
+  json::OStream J(OS, 2);
+  J.object([&] {
+    J.attribute("llvm_version", LLVM_VERSION_STRING);
+    J.attribute("repetitions", static_cast<int64_t>(Repetitions));
+    J.attribute("allocation_counting",
+                trainOpt::isAllocationCountingSupported());
+    J.attributeArray("benchmarks", [&] {
+      for (const BenchResult &R : Results) {
+        uint64_t Median = R.WallNanos[R.WallNanos.size() / 2];
+        J.object([&] {
+          J.attribute("module", R.Module);
+          J.attribute("pass", R.Pass);
+          J.attribute("functions", R.Functions);
+          J.attribute("insts", R.Insts);
+          J.attribute("insts_after", R.InstsAfter);
+          J.attribute("min_ns", R.WallNanos.front());
+          J.attribute("median_ns", Median);
+          J.attribute("max_ns", R.WallNanos.back());
+          J.attribute("ns_per_inst",
+                      R.Insts ? static_cast<double>(Median) / R.Insts : 0.0);
+          J.attribute("allocations", R.Allocations);
+          J.attribute("peak_rss_kb", static_cast<int64_t>(R.PeakRSSKB));
+          J.attribute("peak_rss_delta_kb",
+                      static_cast<int64_t>(R.PeakRSSDeltaKB));
+        });
+      }
+    });
+  });
+  OS << "\n";
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+
+  cl::ParseCommandLineOptions(argc, argv,
+                              "compile time benchmarks of the topt passes\n");
+
+  if (Repetitions == 0) {
+    errs() << argv[0] << ": -repetitions must be at least 1\n";
+    return 1;
+  }
+  if (InputFilenames.empty() && SyntheticInsts.empty()) {
+    errs() << argv[0] << ": no input files and no -synthetic-insts given\n";
+    return 1;
+  }
+
+  LLVMContext Context;
+  std::vector<CorpusEntry> Corpus;
+  for (const std::string &Filename : InputFilenames) {
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M = parseIRFile(Filename, Err, Context);
+    if (!M) {
+      Err.print(argv[0], errs());
+      return 1;
+    }
+    Corpus.push_back({Filename, std::move(M)});
+  }
+  for (unsigned NumInsts : SyntheticInsts) {
+    std::unique_ptr<Module> M = buildSyntheticModule(Context, NumInsts);
+    std::string Name = M->getModuleIdentifier();
+    Corpus.push_back({std::move(Name), std::move(M)});
+  }
+
+  SmallVector<std::string, 4> PassNames(BenchPasses.begin(),
+                                        BenchPasses.end());
+  if (PassNames.empty()) {
+    PassNames = {"topt-sccp", "topt-sscp", "topt-lvn"};
+  }
+
+  std::vector<BenchResult> Results;
+  for (const std::string &PassName : PassNames) {
+    Expected<std::unique_ptr<PassRunner>> Runner = PassRunner::create(PassName);
+    if (!Runner) {
+      errs() << argv[0] << ": " << toString(Runner.takeError()) << "\n";
+      return 1;
+    }
+    for (const CorpusEntry &Entry : Corpus) {
+      Results.push_back(runBenchmark(Entry, PassName, **Runner));
+    }
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_TextWithCRLF);
+  if (EC) {
+    errs() << argv[0] << ": " << OutputFilename << ": " << EC.message()
+           << "\n";
+    return 1;
+  }
+  writeResults(Results, Out.os());
+  Out.keep();
+  return 0;
+}
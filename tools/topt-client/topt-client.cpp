@@ -0,0 +1,228 @@
+//===- topt-client.cpp - Send optimization requests to topt --serve -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// Sends one module to a running `topt -serve -socket=<path>` and writes the
+// optimized result, like a plain topt invocation would. With -bench=N the
+// request is repeated N times and the latency is reported instead, optionally
+// next to N cold runs of a topt binary on the same input.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/InitLLVM.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "ServeProtocol.h"
+
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace llvm;
+using namespace llvm::trainOpt;
+
+static cl::opt<std::string> SocketPath("socket", cl::Required,
+                                       cl::desc("Socket of the topt server"),
+                                       cl::value_desc("path"));
+
+static cl::opt<std::string>
+    PassPipeline("passes",
+                 cl::desc("A textual description of the pass pipeline"));
+
+static cl::alias PassPipeline2("p", cl::aliasopt(PassPipeline),
+                               cl::desc("Alias for -passes"));
+
+static cl::opt<std::string> InputFilename(cl::Positional,
+                                          cl::desc("<input module>"),
+                                          cl::init("-"),
+                                          cl::value_desc("filename"));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Override output filename"),
+                                           cl::init("-"),
+                                           cl::value_desc("filename"));
+
+static cl::opt<bool> EmitBitcode("emit-bc",
+                                 cl::desc("Ask for bitcode instead of IR"));
+
+static cl::opt<bool>
+    Shutdown("shutdown",
+             cl::desc("Ask the server to exit after answering the request"));
+
+static cl::opt<unsigned> BenchIterations(
+    "bench",
+    cl::desc("Send the request N times and report the latency instead of "
+             "writing the output"),
+    cl::init(0), cl::value_desc("N"));
+
+static cl::opt<std::string> ColdTopt(
+    "bench-cold-topt",
+    cl::desc("With -bench, also time N cold runs of this topt binary"),
+    cl::value_desc("path"));
+
+static int connectToServer() {
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path)) {
+    errs() << "topt-client: socket path is too long\n";
+    return -1;
+  }
+  memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+
+  int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (FD < 0 ||
+      ::connect(FD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr))) {
+    errs() << "topt-client: " << SocketPath << ": " << strerror(errno) << "\n";
+    if (FD >= 0) {
+      ::close(FD);
+    }
+    return -1;
+  }
+  return FD;
+}
+
+static bool roundTrip(int FD, const serve::Request &Req,
+                      serve::Response &Resp) {
+  if (Error E = serve::writeRequest(FD, Req)) {
+    errs() << "topt-client: " << toString(std::move(E)) << "\n";
+    return false;
+  }
+  if (Error E = serve::readResponse(FD, Resp)) {
+    errs() << "topt-client: " << toString(std::move(E)) << "\n";
+    return false;
+  }
+  if (Resp.Status != serve::ResponseStatus::Ok) {
+    errs() << Resp.Payload;
+    return false;
+  }
+  return true;
+}
+
+static void printLatencies(StringRef Label, std::vector<double> Millis) {
+  llvm::sort(Millis);
+  auto Percentile = [&](double P) {
+    return Millis[std::min<size_t>(Millis.size() - 1, P * Millis.size())];
+  };
+  outs() << Label << ": " << Millis.size() << " runs, min "
+         << format("%.3f", Millis.front()) << " ms, median "
+         << format("%.3f", Percentile(0.5)) << " ms, p90 "
+         << format("%.3f", Percentile(0.9)) << " ms, max "
+         << format("%.3f", Millis.back()) << " ms\n";
+}
+
+static double millisSince(std::chrono::steady_clock::time_point Start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - Start)
+      .count();
+}
+
+static bool timeColdRuns(std::vector<double> &Millis) {
+  std::string PassesArg = "-passes=" + PassPipeline;
+  SmallVector<StringRef, 8> Args = {ColdTopt, PassesArg, InputFilename, "-o",
+                                    "/dev/null"};
+  if (EmitBitcode) {
+    Args.push_back("-emit-bc");
+  }
+  for (unsigned I = 0; I < BenchIterations; ++I) {
+    std::string ErrMsg;
+    auto Start = std::chrono::steady_clock::now();
+    int RC = sys::ExecuteAndWait(ColdTopt, Args, /*Env=*/std::nullopt,
+                                 /*Redirects=*/{}, /*SecondsToWait=*/0,
+                                 /*MemoryLimit=*/0, &ErrMsg);
+    Millis.push_back(millisSince(Start));
+    if (RC != 0) {
+      errs() << "topt-client: cold run of " << ColdTopt << " failed"
+             << (ErrMsg.empty() ? "" : ": " + ErrMsg) << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "client for the persistent topt server\n");
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> InputOrErr =
+      MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (std::error_code EC = InputOrErr.getError()) {
+    errs() << "topt-client: " << InputFilename << ": " << EC.message() << "\n";
+    return 1;
+  }
+  if (!ColdTopt.empty() && InputFilename == "-") {
+    errs() << "topt-client: -bench-cold-topt needs an input file\n";
+    return 1;
+  }
+
+  serve::Request Req;
+  Req.Pipeline = PassPipeline;
+  Req.Module = (*InputOrErr)->getBuffer().str();
+  if (EmitBitcode) {
+    Req.Flags |= serve::EmitBitcode;
+  }
+
+  int FD = connectToServer();
+  if (FD < 0) {
+    return 1;
+  }
+  auto CloseFD = make_scope_exit([FD] { ::close(FD); });
+
+  serve::Response Resp;
+  if (BenchIterations) {
+    std::vector<double> Warm;
+    for (unsigned I = 0; I < BenchIterations; ++I) {
+      auto Start = std::chrono::steady_clock::now();
+      if (!roundTrip(FD, Req, Resp)) {
+        return 1;
+      }
+      Warm.push_back(millisSince(Start));
+    }
+    printLatencies("warm (topt -serve)", Warm);
+
+    if (!ColdTopt.empty()) {
+      std::vector<double> Cold;
+      if (!timeColdRuns(Cold)) {
+        return 1;
+      }
+      printLatencies("cold (topt)       ", Cold);
+    }
+  }
+
+  if (Shutdown) {
+    Req.Flags |= serve::Shutdown;
+  }
+  if (!BenchIterations || Shutdown) {
+    if (!roundTrip(FD, Req, Resp)) {
+      return 1;
+    }
+  }
+  if (BenchIterations) {
+    return 0;
+  }
+
+  std::error_code EC;
+  ToolOutputFile Out(OutputFilename, EC,
+                     EmitBitcode ? sys::fs::OF_None : sys::fs::OF_Text);
+  if (EC) {
+    errs() << EC.message() << '\n';
+    return 1;
+  }
+  Out.os() << Resp.Payload;
+  Out.keep();
+  return 0;
+}
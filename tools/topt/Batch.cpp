@@ -0,0 +1,125 @@
+//===- Batch.cpp - Optimize many modules in one topt process --------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The batch list names one "<input> <output>" pair per line. Blank lines and
+// lines starting with '#' are ignored. Every worker thread owns one
+// OptimizationPipeline and claims jobs from a shared counter, each module is
+// parsed into a fresh LLVMContext.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Support/LineIterator.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Driver.h"
+
+#include <atomic>
+
+using namespace llvm;
+
+namespace llvm::trainOpt {
+namespace {
+struct BatchJob {
+  std::string Input;
+  std::string Output;
+  /// Diagnostics of this job, printed once the whole batch is done.
+  std::string Diag;
+  bool Succeeded = false;
+};
+} // namespace
+
+static bool readBatchList(StringRef ProgName, StringRef BatchFilename,
+                          std::vector<BatchJob> &Jobs) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> ListOrErr =
+      MemoryBuffer::getFileOrSTDIN(BatchFilename);
+  if (std::error_code EC = ListOrErr.getError()) {
+    errs() << ProgName << ": " << BatchFilename << ": " << EC.message()
+           << "\n";
+    return false;
+  }
+
+  for (line_iterator Line(**ListOrErr, /*SkipBlanks=*/true, '#');
+       !Line.is_at_eof(); ++Line) {
+    SmallVector<StringRef, 2> Fields;
+    SplitString(*Line, Fields);
+    if (Fields.size() != 2) {
+      errs() << ProgName << ": " << BatchFilename << ":" << Line.line_number()
+             << ": expected '<input> <output>'\n";
+      return false;
+    }
+    BatchJob &Job = Jobs.emplace_back();
+    Job.Input = Fields[0].str();
+    Job.Output = Fields[1].str();
+  }
+  return true;
+}
+
+int runBatch(StringRef ProgName, StringRef BatchFilename,
+             StringRef PipelineText, const ModuleOptions &Opts,
+             unsigned NumThreads, PassProfiler *Profiler) {
+  std::vector<BatchJob> Jobs;
+  if (!readBatchList(ProgName, BatchFilename, Jobs)) {
+    return 1;
+  }
+  if (Jobs.empty()) {
+    return 0;
+  }
+
+  // Parse the pipeline once up front, so a typo is reported once and not for
+  // every module. The result becomes the pipeline of the first worker.
+  auto FirstOrErr = OptimizationPipeline::create(PipelineText, Profiler);
+  if (!FirstOrErr) {
+    errs() << ProgName << ": " << toString(FirstOrErr.takeError()) << "\n";
+    return 1;
+  }
+
+  unsigned NumWorkers = std::min<unsigned>(
+      Jobs.size(), hardware_concurrency(NumThreads).compute_thread_count());
+  std::vector<std::unique_ptr<OptimizationPipeline>> Pipelines(NumWorkers);
+  Pipelines[0] = std::move(*FirstOrErr);
+
+  std::atomic<size_t> NextJob{0};
+  auto Worker = [&](unsigned WorkerIdx) {
+    std::unique_ptr<OptimizationPipeline> &Pipeline = Pipelines[WorkerIdx];
+    if (!Pipeline) {
+      Pipeline =
+          cantFail(OptimizationPipeline::create(PipelineText, Profiler));
+    }
+    for (size_t Idx = NextJob++; Idx < Jobs.size(); Idx = NextJob++) {
+      BatchJob &Job = Jobs[Idx];
+      raw_string_ostream Diag(Job.Diag);
+      Job.Succeeded = optimizeFile(ProgName, Job.Input, Job.Output, *Pipeline,
+                                   Opts, Diag);
+    }
+  };
+
+  if (NumWorkers == 1) {
+    Worker(0);
+  } else {
+    DefaultThreadPool Pool(hardware_concurrency(NumWorkers));
+    for (unsigned WorkerIdx = 0; WorkerIdx < NumWorkers; ++WorkerIdx) {
+      Pool.async(Worker, WorkerIdx);
+    }
+    Pool.wait();
+  }
+
+  int ExitCode = 0;
+  for (const BatchJob &Job : Jobs) {
+    errs() << Job.Diag;
+    if (!Job.Succeeded) {
+      ExitCode = 1;
+    }
+  }
+  return ExitCode;
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,234 @@
+//===- Driver.cpp - Reusable parts of the topt driver ---------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeWriterPass.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IRPrinter/IRPrintingPasses.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/SystemUtils.h>
+#include <llvm/Support/ToolOutputFile.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "topt/Passes/Passes.h"
+
+#include "Driver.h"
+#include "ModuleCache.h"
+#include "PassProfiler.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-cache"
+
+STATISTIC(NumModuleCacheHits, "Number of modules taken from the module cache");
+STATISTIC(NumModuleCacheMisses,
+          "Number of modules not found in the module cache");
+
+namespace llvm::trainOpt {
+OptimizationPipeline::OptimizationPipeline()
+    : PB(/*TM=*/nullptr, PipelineTuningOptions(), /*PGOOpt=*/std::nullopt,
+         &PIC) {
+  registerPassBuilderCallbacks(PB);
+
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerMachineFunctionAnalyses(MFAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+}
+
+Expected<std::unique_ptr<OptimizationPipeline>>
+OptimizationPipeline::create(StringRef PipelineText, PassProfiler *Profiler) {
+  std::unique_ptr<OptimizationPipeline> Pipeline(new OptimizationPipeline());
+  Pipeline->Text = PipelineText.str();
+  if (Profiler) {
+    Profiler->registerCallbacks(Pipeline->PIC);
+  }
+  if (Error Err = Pipeline->PB.parsePassPipeline(Pipeline->MPM, PipelineText)) {
+    return std::move(Err);
+  }
+  // Only pipelines without module or CGSCC passes can run on single
+  // functions, anything else simply has no function form.
+  FunctionPassManager FPM;
+  if (Error Err = Pipeline->PB.parsePassPipeline(FPM, PipelineText)) {
+    consumeError(std::move(Err));
+  } else {
+    Pipeline->FPM = std::move(FPM);
+  }
+  return std::move(Pipeline);
+}
+
+void OptimizationPipeline::run(Module &M) {
+  MPM.run(M, MAM);
+  clearAnalyses();
+}
+
+void OptimizationPipeline::runOnFunctions(ArrayRef<Function *> Functions) {
+  assert(isFunctionPipeline() && "Pipeline has no function form");
+  for (Function *F : Functions) {
+    FPM->run(*F, FAM);
+  }
+  clearAnalyses();
+}
+
+void OptimizationPipeline::clearAnalyses() {
+  // The results are keyed by IR addresses which the next module may reuse.
+  LAM.clear();
+  FAM.clear();
+  CGAM.clear();
+  MAM.clear();
+}
+
+/**
+ *  materializeModule - Read the lazily loaded function bodies the pipeline is
+ *  going to work on. Without OnlyFunctions that is the whole module, with it
+ *  only the listed functions are materialized and the remaining definitions
+ *  become declarations.
+ */
+static Error materializeModule(Module &M,
+                               ArrayRef<std::string> OnlyFunctions) {
+  if (OnlyFunctions.empty()) {
+    return M.materializeAll();
+  }
+
+  StringSet<> Selected;
+  for (const std::string &Name : OnlyFunctions) {
+    if (!M.getFunction(Name)) {
+      return createStringError(inconvertibleErrorCode(),
+                               "function '" + Name + "' is not in the module");
+    }
+    Selected.insert(Name);
+  }
+
+  for (Function &F : M) {
+    if (F.isDeclaration()) {
+      continue;
+    }
+    if (Selected.contains(F.getName())) {
+      if (Error E = F.materialize()) {
+        return E;
+      }
+      continue;
+    }
+    // Never touches the bitcode of the body, only drops the lazy state.
+    F.deleteBody();
+    F.setComdat(nullptr);
+  }
+  return M.materializeMetadata();
+}
+
+static void writeModule(Module &M, raw_ostream &Out, bool EmitBitcode) {
+  ModuleAnalysisManager MAM;
+  if (EmitBitcode) {
+    BitcodeWriterPass(Out).run(M, MAM);
+  } else {
+    PrintModulePass(Out).run(M, MAM);
+  }
+}
+
+bool optimizeBuffer(StringRef ProgName, std::unique_ptr<MemoryBuffer> Input,
+                    OptimizationPipeline &Pipeline, const ModuleOptions &Opts,
+                    raw_ostream &Out, raw_ostream &Diag) {
+  LLVMContext Context;
+  SMDiagnostic Err;
+
+  // Bitcode function bodies are only read on demand, textual IR is parsed as
+  // a whole.
+  std::unique_ptr<Module> M = getLazyIRModule(
+      std::move(Input), Err, Context, /*ShouldLazyLoadMetadata=*/true);
+  if (!M) {
+    Err.print(ProgName.str().c_str(), Diag);
+    return false;
+  }
+  if (Error E = materializeModule(*M, Opts.OnlyFunctions)) {
+    Diag << ProgName << ": " << M->getModuleIdentifier() << ": "
+         << toString(std::move(E)) << "\n";
+    return false;
+  }
+
+  if (Opts.FunctionCache) {
+    if (Error E = optimizeFunctionsIncrementally(ProgName, *M, Pipeline,
+                                                 *Opts.FunctionCache, Diag)) {
+      Diag << ProgName << ": " << M->getModuleIdentifier() << ": "
+           << toString(std::move(E)) << "\n";
+      return false;
+    }
+  } else {
+    Pipeline.run(*M);
+  }
+  writeModule(*M, Out, Opts.EmitBitcode);
+  return true;
+}
+
+bool optimizeFile(StringRef ProgName, StringRef InputFilename,
+                  StringRef OutputFilename, OptimizationPipeline &Pipeline,
+                  const ModuleOptions &Opts, raw_ostream &Diag) {
+  std::error_code EC;
+  auto Out = std::make_unique<ToolOutputFile>(
+      OutputFilename, EC,
+      Opts.EmitBitcode ? sys::fs::OF_None : sys::fs::OF_TextWithCRLF);
+  if (EC) {
+    Diag << EC.message() << '\n';
+    return false;
+  }
+  if (Opts.EmitBitcode && CheckBitcodeOutputToConsole(Out->os())) {
+    return false;
+  }
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> InputOrErr =
+      MemoryBuffer::getFileOrSTDIN(InputFilename);
+  if (std::error_code InputEC = InputOrErr.getError()) {
+    SMDiagnostic(InputFilename, SourceMgr::DK_Error,
+                 "Could not open input file: " + InputEC.message())
+        .print(ProgName.str().c_str(), Diag);
+    return false;
+  }
+
+  if (!Opts.Cache) {
+    if (!optimizeBuffer(ProgName, std::move(*InputOrErr), Pipeline, Opts,
+                        Out->os(), Diag)) {
+      return false;
+    }
+    Out->keep();
+    return true;
+  }
+
+  std::string Key = Opts.Cache->computeKey(**InputOrErr, Pipeline.getText(),
+                                           Opts);
+  if (std::unique_ptr<MemoryBuffer> Cached = Opts.Cache->lookup(Key)) {
+    ++NumModuleCacheHits;
+    Out->os() << Cached->getBuffer();
+    Out->keep();
+    return true;
+  }
+  ++NumModuleCacheMisses;
+
+  SmallString<0> Result;
+  raw_svector_ostream ResultOS(Result);
+  if (!optimizeBuffer(ProgName, std::move(*InputOrErr), Pipeline, Opts,
+                      ResultOS, Diag)) {
+    return false;
+  }
+  // A cache that cannot be written only costs time in later runs.
+  if (Error E = Opts.Cache->store(Key, Result)) {
+    Diag << ProgName << ": warning: cannot cache the output of "
+         << InputFilename << ": " << toString(std::move(E)) << "\n";
+  }
+  Out->os() << Result;
+  Out->keep();
+  return true;
+}
+} // namespace llvm::trainOpt
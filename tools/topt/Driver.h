@@ -0,0 +1,159 @@
+//===- Driver.h - Reusable parts of the topt driver -----------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// The single file, batch and server modes of topt share the code that turns
+// one input module into one output module. It lives here.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TOPT_TOOLS_TOPT_DRIVER_H
+#define TOPT_TOOLS_TOPT_DRIVER_H
+
+#include <llvm/Analysis/CGSCCPassManager.h>
+#include <llvm/Analysis/LoopAnalysisManager.h>
+#include <llvm/CodeGen/MachinePassManager.h>
+#include <llvm/IR/PassManager.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Error.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class Function;
+class MemoryBuffer;
+class Module;
+class raw_ostream;
+
+namespace trainOpt {
+class ModuleCache;
+class PassProfiler;
+
+/**
+ *  ModuleOptions - Per module settings shared by every topt mode.
+ */
+struct ModuleOptions {
+  /// Write bitcode instead of textual IR.
+  bool EmitBitcode = false;
+  /// Only materialize and optimize these functions, empty means all.
+  std::vector<std::string> OnlyFunctions;
+  /// Reuse and record outputs of optimizeFile here, if set.
+  ModuleCache *Cache = nullptr;
+  /// Reuse and record optimized function bodies here, if set. Needs a
+  /// pipeline of function passes.
+  ModuleCache *FunctionCache = nullptr;
+};
+
+/**
+ *  OptimizationPipeline - A PassBuilder with the topt passes registered, its
+ *  analysis managers and one parsed pass pipeline.
+ *
+ *  Setting this up is the module independent part of a topt run, so one
+ *  instance is meant to optimize many modules. It must only be used by one
+ *  thread at a time.
+ */
+class OptimizationPipeline {
+public:
+  /**
+   *  create - Parse PipelineText. If Profiler is given, every pass the
+   *  pipeline runs is recorded by it.
+   */
+  static Expected<std::unique_ptr<OptimizationPipeline>>
+  create(StringRef PipelineText, PassProfiler *Profiler = nullptr);
+
+  /**
+   *  run - Run the pipeline on M and drop every analysis result computed for
+   *  it, so the next module starts from a clean state.
+   */
+  void run(Module &M);
+
+  /**
+   *  runOnFunctions - Run the function form of the pipeline on each of
+   *  Functions only, then drop the analysis results like run.
+   */
+  void runOnFunctions(ArrayRef<Function *> Functions);
+
+  /**
+   *  isFunctionPipeline - Whether the pipeline consists of function passes
+   *  only, which runOnFunctions requires.
+   */
+  bool isFunctionPipeline() const { return FPM.has_value(); }
+
+  StringRef getText() const { return Text; }
+
+private:
+  OptimizationPipeline();
+
+  void clearAnalyses();
+
+  std::string Text;
+  LoopAnalysisManager LAM;
+  MachineFunctionAnalysisManager MFAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+
+  PassInstrumentationCallbacks PIC;
+  PassBuilder PB;
+  ModulePassManager MPM;
+  std::optional<FunctionPassManager> FPM;
+};
+
+/**
+ *  optimizeBuffer - Parse Input, run Pipeline on it and write the result to
+ *  Out. Errors are reported to Diag prefixed with ProgName.
+ *  Returns false if the module could not be optimized.
+ */
+bool optimizeBuffer(StringRef ProgName, std::unique_ptr<MemoryBuffer> Input,
+                    OptimizationPipeline &Pipeline, const ModuleOptions &Opts,
+                    raw_ostream &Out, raw_ostream &Diag);
+
+/**
+ *  optimizeFile - Same as optimizeBuffer, but reads InputFilename and writes
+ *  OutputFilename ("-" means stdin/stdout). The output file is only kept if
+ *  the module was optimized successfully. With Opts.Cache set, a cached
+ *  output for the same input is copied instead of running the pipeline.
+ */
+bool optimizeFile(StringRef ProgName, StringRef InputFilename,
+                  StringRef OutputFilename, OptimizationPipeline &Pipeline,
+                  const ModuleOptions &Opts, raw_ostream &Diag);
+
+/**
+ *  optimizeFunctionsIncrementally - Run the function pipeline of Pipeline on
+ *  the defined functions of M that have no entry in Cache yet and splice the
+ *  cached bodies into all others. Newly optimized functions are added to
+ *  Cache, failures to do so are reported to Diag as warnings.
+ */
+Error optimizeFunctionsIncrementally(StringRef ProgName, Module &M,
+                                     OptimizationPipeline &Pipeline,
+                                     const ModuleCache &Cache,
+                                     raw_ostream &Diag);
+
+/**
+ *  runBatch - Optimize every "<input> <output>" pair listed in BatchFilename
+ *  on up to NumThreads worker threads (0 means one per hardware thread).
+ *  Diagnostics are printed in the order of the list once all jobs are done.
+ *  Returns the process exit code.
+ */
+int runBatch(StringRef ProgName, StringRef BatchFilename,
+             StringRef PipelineText, const ModuleOptions &Opts,
+             unsigned NumThreads, PassProfiler *Profiler = nullptr);
+
+/**
+ *  runServer - Answer optimization requests (see ServeProtocol.h) on the Unix
+ *  domain socket SocketPath, or on stdin/stdout if it is empty, until a
+ *  client asks for a shutdown. Socket connections are served by up to
+ *  NumThreads threads. Returns the process exit code.
+ */
+int runServer(StringRef ProgName, StringRef SocketPath, unsigned NumThreads);
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_TOOLS_TOPT_DRIVER_H
@@ -0,0 +1,595 @@
+//===- FunctionCache.cpp - Incremental optimization of single functions ---===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// A function is keyed by everything a function pass can observe about it:
+// its printed body and signature, its attributes and those of its call sites,
+// the metadata it references, the declarations of the globals it references
+// (initializers included), and the data layout, triple and struct types of
+// the module. Slot numbers of unnamed values and metadata are part of the
+// printed body, so renumbering causes misses, never wrong hits.
+//
+// An entry is the bitcode of a module holding the optimized function plus
+// declarations of the globals it references. It is read into the context of
+// the module being optimized and cloned over the old body.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/InstrTypes.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+#include <llvm/Support/BLAKE3.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+
+#include "Driver.h"
+#include "ModuleCache.h"
+
+using namespace llvm;
+
+#define DEBUG_TYPE "topt-cache"
+
+STATISTIC(NumFunctionCacheHits,
+          "Number of function bodies taken from the function cache");
+STATISTIC(NumFunctionCacheMisses,
+          "Number of function bodies not found in the function cache");
+STATISTIC(NumUncacheableFunctions,
+          "Number of functions the function cache cannot represent");
+
+namespace llvm::trainOpt {
+namespace {
+using Digest = BLAKE3Result<16>;
+
+/** Feeds length prefixed fields into a BLAKE3 hasher. */
+class FieldHasher {
+public:
+  void add(StringRef Field) {
+    uint8_t Size[8];
+    support::endian::write64le(Size, Field.size());
+    Hasher.update(Size);
+    Hasher.update(Field);
+  }
+  void add(const Digest &D) { add(toStringRef(D)); }
+  Digest final() { return Hasher.final<16>(); }
+
+private:
+  BLAKE3 Hasher;
+};
+
+/** The module level values and metadata a function body refers to. */
+struct FunctionReferences {
+  SetVector<GlobalValue *> Globals;
+  SetVector<const MDNode *> Metadata;
+  bool Cacheable = true;
+};
+
+/** A cacheable function and its key. */
+struct FunctionEntry {
+  Function *F;
+  std::string Key;
+};
+
+/**
+ *  ModuleHasher - Memoized hashes of the module wide parts of function keys,
+ *  so each global and metadata node is printed once per module.
+ */
+class ModuleHasher {
+public:
+  explicit ModuleHasher(Module &M);
+
+  /**
+   *  hashFunction - Hash of F and everything in Refs, or nothing if F cannot
+   *  be cached.
+   */
+  std::optional<Digest> hashFunction(Function &F,
+                                     const FunctionReferences &Refs);
+
+private:
+  const Digest &hashGlobal(const GlobalValue &G);
+  std::optional<Digest> hashMetadata(const MDNode &N);
+
+  Module &M;
+  ModuleSlotTracker MST;
+  Digest ModuleDigest;
+  DenseMap<const GlobalValue *, Digest> Globals;
+  DenseMap<const MDNode *, std::optional<Digest>> Nodes;
+};
+
+/**
+ *  EntryTypeRemapper - Maps the identified struct types of a cache entry read
+ *  into the context of M back to the types of M.
+ *
+ *  The bitcode reader has to rename every struct type of the entry, because
+ *  M already owns a type of the same name, by appending ".<number>".
+ */
+class EntryTypeRemapper : public ValueMapTypeRemapper {
+public:
+  /** Returns false if some struct type of Entry has no counterpart in M. */
+  bool init(Module &M, Module &Entry);
+
+  Type *remapType(Type *Ty) override;
+
+private:
+  DenseMap<Type *, Type *> Map;
+};
+} // namespace
+
+static void printAttributes(AttributeList Attrs, raw_ostream &OS) {
+  for (unsigned Index : Attrs.indexes()) {
+    OS << Index << ": " << Attrs.getAsString(Index) << "\n";
+  }
+}
+
+/**
+ *  collectReferences - Find the globals and metadata F refers to. Functions
+ *  referring to anything that cannot be looked up by name in another module
+ *  or that use debug info, which would need distinct metadata to be shared,
+ *  are not cacheable.
+ */
+static FunctionReferences collectReferences(Function &F) {
+  FunctionReferences Refs;
+  SmallPtrSet<const Constant *, 32> Visited;
+
+  auto AddConstant = [&](auto &Self, Constant *C) -> void {
+    if (!Visited.insert(C).second) {
+      return;
+    }
+    if (auto *G = dyn_cast<GlobalValue>(C)) {
+      if (!G->hasName()) {
+        Refs.Cacheable = false;
+      }
+      Refs.Globals.insert(G);
+      return;
+    }
+    if (isa<BlockAddress>(C) || isa<DSOLocalEquivalent>(C) ||
+        isa<NoCFIValue>(C)) {
+      Refs.Cacheable = false;
+      return;
+    }
+    for (Value *Op : C->operands()) {
+      Self(Self, cast<Constant>(Op));
+    }
+  };
+
+  SmallVector<std::pair<unsigned, MDNode *>, 4> Attachments;
+  auto AddAttachments = [&] {
+    for (const auto &[Kind, N] : Attachments) {
+      Refs.Metadata.insert(N);
+    }
+  };
+
+  Refs.Cacheable = F.hasName();
+  Refs.Globals.insert(&F);
+  if (F.hasPersonalityFn()) {
+    AddConstant(AddConstant, F.getPersonalityFn());
+  }
+  if (F.hasPrefixData()) {
+    AddConstant(AddConstant, F.getPrefixData());
+  }
+  if (F.hasPrologueData()) {
+    AddConstant(AddConstant, F.getPrologueData());
+  }
+  F.getAllMetadata(Attachments);
+  AddAttachments();
+
+  for (BasicBlock &BB : F) {
+    for (Instruction &I : BB) {
+      if (I.hasDbgRecords()) {
+        Refs.Cacheable = false;
+      }
+      for (Value *Op : I.operands()) {
+        if (auto *C = dyn_cast<Constant>(Op)) {
+          AddConstant(AddConstant, C);
+          continue;
+        }
+        auto *MV = dyn_cast<MetadataAsValue>(Op);
+        if (!MV) {
+          continue;
+        }
+        Metadata *MD = MV->getMetadata();
+        if (auto *N = dyn_cast<MDNode>(MD)) {
+          Refs.Metadata.insert(N);
+        } else if (auto *CM = dyn_cast<ConstantAsMetadata>(MD)) {
+          AddConstant(AddConstant, CM->getValue());
+        } else if (!isa<MDString>(MD)) {
+          // Function local metadata and argument lists of debug intrinsics.
+          Refs.Cacheable = false;
+        }
+      }
+      Attachments.clear();
+      I.getAllMetadata(Attachments);
+      AddAttachments();
+    }
+  }
+  return Refs;
+}
+
+ModuleHasher::ModuleHasher(Module &M) : M(M), MST(&M) {
+  FieldHasher H;
+  H.add(M.getDataLayoutStr());
+  H.add(M.getTargetTriple());
+  // Bodies print struct types by name only, so hash all of their bodies.
+  for (StructType *ST : M.getIdentifiedStructTypes()) {
+    std::string Text;
+    raw_string_ostream OS(Text);
+    ST->print(OS);
+    H.add(Text);
+  }
+  ModuleDigest = H.final();
+}
+
+const Digest &ModuleHasher::hashGlobal(const GlobalValue &G) {
+  auto It = Globals.find(&G);
+  if (It != Globals.end()) {
+    return It->second;
+  }
+
+  std::string Text;
+  raw_string_ostream OS(Text);
+  if (const auto *F = dyn_cast<Function>(&G)) {
+    // Function passes only see the declaration of other functions.
+    OS << F->getName() << " " << F->getLinkage() << " "
+       << F->getCallingConv() << "\n";
+    F->getFunctionType()->print(OS);
+    OS << "\n";
+    printAttributes(F->getAttributes(), OS);
+  } else {
+    // Variables with their initializer, aliases with their aliasee.
+    G.print(OS, MST);
+  }
+  FieldHasher H;
+  H.add(Text);
+  return Globals[&G] = H.final();
+}
+
+std::optional<Digest> ModuleHasher::hashMetadata(const MDNode &N) {
+  auto [It, Inserted] = Nodes.try_emplace(&N);
+  if (!Inserted) {
+    // Still empty while N is being hashed, so cycles make F uncacheable.
+    return It->second;
+  }
+  // Distinct nodes, e.g. debug info scopes or loop IDs, are identities of
+  // this module and cannot be recreated from an entry.
+  if (N.isDistinct()) {
+    return std::nullopt;
+  }
+
+  FieldHasher H;
+  std::string Text;
+  raw_string_ostream OS(Text);
+  N.print(OS, MST, &M);
+  H.add(Text);
+  for (const MDOperand &Op : N.operands()) {
+    if (const auto *Child = dyn_cast_or_null<MDNode>(Op.get())) {
+      std::optional<Digest> ChildDigest = hashMetadata(*Child);
+      if (!ChildDigest) {
+        return std::nullopt;
+      }
+      H.add(*ChildDigest);
+    }
+  }
+  Digest D = H.final();
+  Nodes[&N] = D;
+  return D;
+}
+
+std::optional<Digest>
+ModuleHasher::hashFunction(Function &F, const FunctionReferences &Refs) {
+  if (!Refs.Cacheable) {
+    return std::nullopt;
+  }
+
+  FieldHasher H;
+  H.add(ModuleDigest);
+
+  std::string Text;
+  raw_string_ostream OS(Text);
+  static_cast<const Value &>(F).print(OS, MST);
+  // The body refers to attribute groups by number only.
+  printAttributes(F.getAttributes(), OS);
+  for (Instruction &I : instructions(F)) {
+    if (auto *CB = dyn_cast<CallBase>(&I)) {
+      printAttributes(CB->getAttributes(), OS);
+    }
+  }
+  H.add(Text);
+
+  for (GlobalValue *G : Refs.Globals) {
+    H.add(hashGlobal(*G));
+  }
+  for (const MDNode *N : Refs.Metadata) {
+    std::optional<Digest> D = hashMetadata(*N);
+    if (!D) {
+      return std::nullopt;
+    }
+    H.add(*D);
+  }
+  return H.final();
+}
+
+bool EntryTypeRemapper::init(Module &M, Module &Entry) {
+  for (StructType *ST : Entry.getIdentifiedStructTypes()) {
+    StringRef Name = ST->getName();
+    size_t Dot = Name.rfind('.');
+    StructType *Original = nullptr;
+    if (Dot != StringRef::npos && Dot + 1 < Name.size() &&
+        all_of(Name.substr(Dot + 1), isDigit)) {
+      Original = StructType::getTypeByName(M.getContext(), Name.take_front(Dot));
+    }
+    if (!Original) {
+      return false;
+    }
+    Map[ST] = Original;
+  }
+  // Both types must agree on their bodies once the struct types are mapped.
+  for (const auto &[From, To] : Map) {
+    auto *FromST = cast<StructType>(From);
+    auto *ToST = cast<StructType>(To);
+    if (FromST->isOpaque() != ToST->isOpaque() ||
+        FromST->isPacked() != ToST->isPacked() ||
+        FromST->getNumElements() != ToST->getNumElements()) {
+      return false;
+    }
+    for (unsigned I = 0, E = FromST->getNumElements(); I != E; ++I) {
+      if (remapType(FromST->getElementType(I)) != ToST->getElementType(I)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+Type *EntryTypeRemapper::remapType(Type *Ty) {
+  if (Type *Mapped = Map.lookup(Ty)) {
+    return Mapped;
+  }
+
+  Type *Result = Ty;
+  if (auto *ST = dyn_cast<StructType>(Ty); ST && ST->isLiteral()) {
+    SmallVector<Type *, 8> Elements;
+    for (Type *Element : ST->elements()) {
+      Elements.push_back(remapType(Element));
+    }
+    Result = StructType::get(Ty->getContext(), Elements, ST->isPacked());
+  } else if (auto *AT = dyn_cast<ArrayType>(Ty)) {
+    Result = ArrayType::get(remapType(AT->getElementType()),
+                            AT->getNumElements());
+  } else if (auto *FT = dyn_cast<FunctionType>(Ty)) {
+    SmallVector<Type *, 8> Params;
+    for (Type *Param : FT->params()) {
+      Params.push_back(remapType(Param));
+    }
+    Result = FunctionType::get(remapType(FT->getReturnType()), Params,
+                               FT->isVarArg());
+  }
+  Map[Ty] = Result;
+  return Result;
+}
+
+/** Attributes like byval carry types, which must be remapped as well. */
+static AttributeList remapAttributes(AttributeList Attrs, LLVMContext &Ctx,
+                                     ValueMapTypeRemapper &TypeMapper) {
+  for (unsigned Index : Attrs.indexes()) {
+    for (int Kind = Attribute::FirstTypeAttr; Kind <= Attribute::LastTypeAttr;
+         ++Kind) {
+      auto TypedAttr = static_cast<Attribute::AttrKind>(Kind);
+      if (Type *Ty = Attrs.getAttributeAtIndex(Index, TypedAttr)
+                         .getValueAsType()) {
+        Attrs = Attrs.replaceAttributeTypeAtIndex(
+            Ctx, Index, TypedAttr, TypeMapper.remapType(Ty));
+      }
+    }
+  }
+  return Attrs;
+}
+
+/**
+ *  spliceEntry - Replace the body of F by the one in the cache entry Buffer.
+ *  Returns false and leaves F untouched if the entry does not fit into the
+ *  module of F.
+ */
+static bool spliceEntry(Function &F, MemoryBufferRef Buffer) {
+  Module &M = *F.getParent();
+  Expected<std::unique_ptr<Module>> EntryOrErr =
+      parseBitcodeFile(Buffer, M.getContext());
+  if (!EntryOrErr) {
+    consumeError(EntryOrErr.takeError());
+    return false;
+  }
+  Module &Entry = **EntryOrErr;
+
+  Function *Cached = Entry.getFunction(F.getName());
+  EntryTypeRemapper TypeMapper;
+  if (!Cached || Cached->isDeclaration() || !TypeMapper.init(M, Entry) ||
+      TypeMapper.remapType(Cached->getFunctionType()) !=
+          F.getFunctionType()) {
+    return false;
+  }
+
+  ValueToValueMapTy VMap;
+  SmallVector<Function *, 4> NewDeclarations;
+  auto DropNewDeclarations = [&] {
+    for (Function *D : NewDeclarations) {
+      D->eraseFromParent();
+    }
+  };
+  for (GlobalValue &G : Entry.global_values()) {
+    if (&G == Cached) {
+      VMap[&G] = &F;
+      continue;
+    }
+    GlobalValue *Target = M.getNamedValue(G.getName());
+    if (!Target) {
+      // The pipeline introduced a call to an intrinsic or library function
+      // the module does not declare yet.
+      auto *Callee = dyn_cast<Function>(&G);
+      if (!Callee) {
+        DropNewDeclarations();
+        return false;
+      }
+      Function *D = Function::Create(
+          cast<FunctionType>(TypeMapper.remapType(Callee->getFunctionType())),
+          GlobalValue::ExternalLinkage, Callee->getAddressSpace(),
+          Callee->getName(), &M);
+      D->setCallingConv(Callee->getCallingConv());
+      D->setAttributes(remapAttributes(Callee->getAttributes(),
+                                       M.getContext(), TypeMapper));
+      NewDeclarations.push_back(D);
+      Target = D;
+    }
+    if (Target->getType() != G.getType()) {
+      DropNewDeclarations();
+      return false;
+    }
+    VMap[&G] = Target;
+  }
+  for (auto [CachedArg, Arg] : zip(Cached->args(), F.args())) {
+    VMap[&CachedArg] = &Arg;
+  }
+
+  F.dropAllReferences();
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(&F, Cached, VMap, CloneFunctionChangeType::DifferentModule,
+                    Returns, "", nullptr, &TypeMapper);
+  return true;
+}
+
+/**
+ *  createEntry - Write the cache entry for the optimized F: a module with F
+ *  and declarations of everything it refers to. Returns false if F can no
+ *  longer be represented, e.g. because a pass attached distinct metadata.
+ */
+static bool createEntry(Function &F, raw_ostream &OS) {
+  FunctionReferences Refs = collectReferences(F);
+  if (!Refs.Cacheable || any_of(Refs.Metadata, [](const MDNode *N) {
+        return N->isDistinct();
+      })) {
+    return false;
+  }
+
+  Module &M = *F.getParent();
+  Module Entry(M.getModuleIdentifier(), M.getContext());
+  Entry.setDataLayout(M.getDataLayout());
+  Entry.setTargetTriple(M.getTargetTriple());
+
+  ValueToValueMapTy VMap;
+  Function *Clone = Function::Create(F.getFunctionType(),
+                                     GlobalValue::ExternalLinkage,
+                                     F.getAddressSpace(), F.getName(), &Entry);
+  for (GlobalValue *G : Refs.Globals) {
+    if (G == &F) {
+      VMap[G] = Clone;
+      continue;
+    }
+    GlobalValue *D;
+    if (auto *FTy = dyn_cast<FunctionType>(G->getValueType())) {
+      auto *Callee = Function::Create(FTy, GlobalValue::ExternalLinkage,
+                                      G->getAddressSpace(), G->getName(),
+                                      &Entry);
+      if (const auto *GF = dyn_cast<Function>(G)) {
+        Callee->setCallingConv(GF->getCallingConv());
+        Callee->setAttributes(GF->getAttributes());
+      }
+      D = Callee;
+    } else {
+      auto *GV = dyn_cast<GlobalVariable>(G);
+      D = new GlobalVariable(
+          Entry, G->getValueType(), GV && GV->isConstant(),
+          GlobalValue::ExternalLinkage, /*Initializer=*/nullptr, G->getName(),
+          /*InsertBefore=*/nullptr, G->getThreadLocalMode(),
+          G->getAddressSpace());
+    }
+    VMap[G] = D;
+  }
+  for (auto [Arg, CloneArg] : zip(F.args(), Clone->args())) {
+    VMap[&Arg] = &CloneArg;
+  }
+
+  SmallVector<ReturnInst *, 4> Returns;
+  CloneFunctionInto(Clone, &F, VMap, CloneFunctionChangeType::DifferentModule,
+                    Returns);
+  WriteBitcodeToFile(Entry, OS);
+  return true;
+}
+
+Error optimizeFunctionsIncrementally(StringRef ProgName, Module &M,
+                                     OptimizationPipeline &Pipeline,
+                                     const ModuleCache &Cache,
+                                     raw_ostream &Diag) {
+  if (!Pipeline.isFunctionPipeline()) {
+    return createStringError(inconvertibleErrorCode(),
+                             "the function cache needs a pipeline of "
+                             "function passes only");
+  }
+
+  // Keys are computed up front: splicing changes the slot numbers the
+  // printed bodies depend on.
+  std::vector<FunctionEntry> Entries;
+  std::vector<Function *> Uncacheable;
+  {
+    ModuleHasher Hasher(M);
+    for (Function &F : M) {
+      if (F.isDeclaration()) {
+        continue;
+      }
+      std::optional<Digest> D = Hasher.hashFunction(F, collectReferences(F));
+      if (!D) {
+        ++NumUncacheableFunctions;
+        Uncacheable.push_back(&F);
+        continue;
+      }
+      Entries.push_back({&F, Cache.computeKey({"function", Pipeline.getText(),
+                                               toStringRef(*D)})});
+    }
+  }
+
+  std::vector<Function *> Misses = Uncacheable;
+  std::vector<const FunctionEntry *> StoreEntries;
+  for (const FunctionEntry &E : Entries) {
+    std::unique_ptr<MemoryBuffer> Buffer = Cache.lookup(E.Key);
+    if (Buffer && spliceEntry(*E.F, Buffer->getMemBufferRef())) {
+      ++NumFunctionCacheHits;
+      continue;
+    }
+    ++NumFunctionCacheMisses;
+    Misses.push_back(E.F);
+    StoreEntries.push_back(&E);
+  }
+
+  Pipeline.runOnFunctions(Misses);
+
+  for (const FunctionEntry *E : StoreEntries) {
+    SmallString<0> Bitcode;
+    raw_svector_ostream OS(Bitcode);
+    if (!createEntry(*E->F, OS)) {
+      continue;
+    }
+    if (Error Err = Cache.store(E->Key, Bitcode)) {
+      Diag << ProgName << ": warning: cannot cache the optimized body of "
+           << E->F->getName() << ": " << toString(std::move(Err)) << "\n";
+    }
+  }
+  return Error::success();
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,150 @@
+//===- ModuleCache.cpp - Content addressed cache of optimized modules -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/BLAKE3.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/FormatVariadic.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Driver.h"
+#include "ModuleCache.h"
+
+#include <chrono>
+
+using namespace llvm;
+
+namespace llvm::trainOpt {
+/**
+ *  computeBuildID - Identify the running topt binary by path, size and
+ *  modification time, so a rebuilt topt never sees entries of an old one.
+ */
+static Expected<std::string> computeBuildID(StringRef ProgName) {
+  std::string Path = sys::fs::getMainExecutable(
+      ProgName.str().c_str(), reinterpret_cast<void *>(&computeBuildID));
+  sys::fs::file_status Status;
+  if (Path.empty() || sys::fs::status(Path, Status)) {
+    return createStringError(inconvertibleErrorCode(),
+                             "cannot locate the topt binary to identify it");
+  }
+  return formatv("{0}:{1}:{2}:{3}", LLVM_VERSION_STRING, Path,
+                 Status.getSize(),
+                 Status.getLastModificationTime().time_since_epoch().count())
+      .str();
+}
+
+Expected<std::unique_ptr<ModuleCache>>
+ModuleCache::open(StringRef Dir, StringRef PolicyText, StringRef ProgName,
+                  StringRef PassOptions) {
+  Expected<CachePruningPolicy> PolicyOrErr =
+      parseCachePruningPolicy(PolicyText);
+  if (!PolicyOrErr) {
+    return PolicyOrErr.takeError();
+  }
+  if (std::error_code EC = sys::fs::create_directories(Dir)) {
+    return createFileError(Dir, EC);
+  }
+  Expected<std::string> BuildID = computeBuildID(ProgName);
+  if (!BuildID) {
+    return BuildID.takeError();
+  }
+  return std::unique_ptr<ModuleCache>(
+      new ModuleCache(Dir, *PolicyOrErr, std::move(*BuildID), PassOptions));
+}
+
+std::string ModuleCache::computeKey(MemoryBufferRef Input,
+                                    StringRef PipelineText,
+                                    const ModuleOptions &Opts) const {
+  SmallVector<StringRef, 8> Fields = {"module", PipelineText,
+                                      Opts.EmitBitcode ? "bc" : "ll"};
+  for (const std::string &Name : Opts.OnlyFunctions) {
+    Fields.push_back(Name);
+  }
+  // The input name ends up in the ModuleID of the output.
+  Fields.push_back(Input.getBufferIdentifier());
+  Fields.push_back(Input.getBuffer());
+  return computeKey(Fields);
+}
+
+std::string ModuleCache::computeKey(ArrayRef<StringRef> Fields) const {
+  BLAKE3 Hasher;
+  // Length prefixes keep the boundaries between the fields unambiguous.
+  auto AddField = [&Hasher](StringRef Field) {
+    uint8_t Size[8];
+    support::endian::write64le(Size, Field.size());
+    Hasher.update(Size);
+    Hasher.update(Field);
+  };
+  AddField(BuildID);
+  AddField(PassOptions);
+  for (StringRef Field : Fields) {
+    AddField(Field);
+  }
+  return toHex(Hasher.final<16>(), /*LowerCase=*/true);
+}
+
+std::string ModuleCache::getEntryPath(StringRef Key) const {
+  // The pruner only ever deletes files with the "llvmcache-" prefix.
+  SmallString<128> Path(Dir);
+  sys::path::append(Path, "llvmcache-" + Key);
+  return std::string(Path);
+}
+
+std::unique_ptr<MemoryBuffer> ModuleCache::lookup(StringRef Key) const {
+  std::string Path = getEntryPath(Key);
+  Expected<sys::fs::file_t> FDOrErr = sys::fs::openNativeFileForRead(Path);
+  if (!FDOrErr) {
+    consumeError(FDOrErr.takeError());
+    return nullptr;
+  }
+  sys::fs::file_t FD = *FDOrErr;
+  auto CloseFD = make_scope_exit([&FD] { sys::fs::closeFile(FD); });
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+      MemoryBuffer::getOpenFile(FD, Path, /*FileSize=*/-1,
+                                /*RequiresNullTerminator=*/false);
+  if (!BufferOrErr) {
+    return nullptr;
+  }
+  // Pruning evicts the least recently used entries first, so mark this one
+  // as used. A failure only makes the entry look older than it is.
+  (void)sys::fs::setLastAccessAndModificationTime(
+      FD, std::chrono::system_clock::now());
+  return std::move(*BufferOrErr);
+}
+
+Error ModuleCache::store(StringRef Key, StringRef Output) const {
+  SmallString<128> Model(Dir);
+  sys::path::append(Model, "tmp-%%%%%%%%%%%%");
+  Expected<sys::fs::TempFile> Temp = sys::fs::TempFile::create(Model);
+  if (!Temp) {
+    return Temp.takeError();
+  }
+
+  raw_fd_ostream OS(Temp->FD, /*shouldClose=*/false);
+  OS << Output;
+  OS.flush();
+  if (OS.has_error()) {
+    std::error_code EC = OS.error();
+    OS.clear_error();
+    return joinErrors(createFileError(Temp->TmpName, EC), Temp->discard());
+  }
+
+  if (Error E = Temp->keep(getEntryPath(Key))) {
+    return E;
+  }
+  pruneCache(Dir, Policy);
+  return Error::success();
+}
+} // namespace llvm::trainOpt
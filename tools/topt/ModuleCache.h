@@ -0,0 +1,89 @@
+//===- ModuleCache.h - Content addressed cache of optimized modules -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TOPT_TOOLS_TOPT_MODULECACHE_H
+#define TOPT_TOOLS_TOPT_MODULECACHE_H
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBufferRef.h>
+
+#include <memory>
+#include <string>
+
+namespace llvm {
+class MemoryBuffer;
+
+namespace trainOpt {
+struct ModuleOptions;
+
+/**
+ *  ModuleCache - On disk cache of topt outputs.
+ *
+ *  An entry is keyed by a hash of the input name and bytes, the pipeline
+ *  text, the options given to the passes, the output options and the
+ *  identity of the topt binary. Entries are written to a temporary file and
+ *  renamed into place, so parallel topt processes sharing a directory only
+ *  ever see complete entries. Hits refresh the timestamps of the entry, and
+ *  the directory is pruned by least recent use with LLVM's cache pruning
+ *  policy.
+ */
+class ModuleCache {
+public:
+  /**
+   *  open - Create Dir if needed. PolicyText uses the syntax of
+   *  parseCachePruningPolicy, e.g. "cache_size_bytes=1g:prune_interval=5m".
+   *  ProgName is used to locate the topt binary for the build ID.
+   *  PassOptions are the command line arguments that may change the output
+   *  of the passes.
+   */
+  static Expected<std::unique_ptr<ModuleCache>>
+  open(StringRef Dir, StringRef PolicyText, StringRef ProgName,
+       StringRef PassOptions);
+
+  std::string computeKey(MemoryBufferRef Input, StringRef PipelineText,
+                         const ModuleOptions &Opts) const;
+
+  /**
+   *  computeKey - Key for any other kind of entry, made of Fields, the build
+   *  ID and the pass options. Callers put a distinct tag into the first
+   *  field.
+   */
+  std::string computeKey(ArrayRef<StringRef> Fields) const;
+
+  /**
+   *  lookup - Return the entry for Key, memory mapped if it is large enough,
+   *  or null on a miss.
+   */
+  std::unique_ptr<MemoryBuffer> lookup(StringRef Key) const;
+
+  /**
+   *  store - Atomically add the entry for Key and prune the cache if the
+   *  pruning interval has passed.
+   */
+  Error store(StringRef Key, StringRef Output) const;
+
+private:
+  ModuleCache(StringRef Dir, CachePruningPolicy Policy, std::string BuildID,
+              StringRef PassOptions)
+      : Dir(Dir), Policy(Policy), BuildID(std::move(BuildID)),
+        PassOptions(PassOptions) {}
+
+  std::string getEntryPath(StringRef Key) const;
+
+  std::string Dir;
+  CachePruningPolicy Policy;
+  std::string BuildID;
+  std::string PassOptions;
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_TOOLS_TOPT_MODULECACHE_H
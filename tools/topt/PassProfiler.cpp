@@ -0,0 +1,231 @@
+//===- PassProfiler.cpp - Per pass and per function cost records ----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/Any.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/LazyCallGraph.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Passes/StandardInstrumentations.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "topt/Support/AllocationCounter.h"
+
+#include "PassProfiler.h"
+
+#include <chrono>
+#include <sys/resource.h>
+
+using namespace llvm;
+
+namespace llvm::trainOpt {
+namespace {
+/** Size and name of the IR unit a pass runs on. */
+struct IRUnitInfo {
+  std::string Module;
+  std::string Kind;
+  std::string Name;
+  uint64_t Insts = 0;
+  uint64_t Blocks = 0;
+};
+
+/** State captured right before a pass starts. */
+struct Frame {
+  PassProfiler::Record R;
+  std::chrono::steady_clock::time_point Start;
+  long MaxRSSKB = 0;
+  uint64_t Allocations = 0;
+};
+} // namespace
+
+static void countFunction(const Function &F, IRUnitInfo &Info) {
+  Info.Insts += F.getInstructionCount();
+  Info.Blocks += F.size();
+}
+
+static IRUnitInfo describeIR(Any IR) {
+  IRUnitInfo Info;
+  if (const auto *F = llvm::any_cast<const Function *>(&IR)) {
+    Info.Module = (*F)->getParent()->getModuleIdentifier();
+    Info.Kind = "function";
+    Info.Name = (*F)->getName().str();
+    countFunction(**F, Info);
+  } else if (const auto *M = llvm::any_cast<const Module *>(&IR)) {
+    Info.Module = (*M)->getModuleIdentifier();
+    Info.Kind = "module";
+    Info.Name = (*M)->getModuleIdentifier();
+    for (const Function &F : **M) {
+      countFunction(F, Info);
+    }
+  } else if (const auto *L = llvm::any_cast<const Loop *>(&IR)) {
+    const Function *F = (*L)->getHeader()->getParent();
+    Info.Module = F->getParent()->getModuleIdentifier();
+    Info.Kind = "loop";
+    Info.Name = (F->getName() + ":" + (*L)->getName()).str();
+    for (const BasicBlock *BB : (*L)->blocks()) {
+      Info.Insts += BB->size();
+      ++Info.Blocks;
+    }
+  } else if (const auto *C =
+                 llvm::any_cast<const LazyCallGraph::SCC *>(&IR)) {
+    Info.Kind = "scc";
+    Info.Name = (*C)->getName();
+    for (const LazyCallGraph::Node &N : **C) {
+      Info.Module = N.getFunction().getParent()->getModuleIdentifier();
+      countFunction(N.getFunction(), Info);
+    }
+  }
+  return Info;
+}
+
+static long getMaxRSSKB() {
+  rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage)) {
+    return 0;
+  }
+  return Usage.ru_maxrss;
+}
+
+/** Pass managers and adaptors only wrap the passes we want to see. */
+static bool isWrapperPass(StringRef PassID) {
+  return isSpecialPass(PassID, {"PassManager", "PassAdaptor",
+                                "AnalysisManagerProxy", "DevirtSCCRepeatedPass",
+                                "ModuleInlinerWrapperPass"});
+}
+
+/** Passes nest (module pass, adaptor, function pass), one stack per thread. */
+static SmallVectorImpl<Frame> &getFrameStack() {
+  static thread_local SmallVector<Frame, 8> Stack;
+  return Stack;
+}
+
+void PassProfiler::registerCallbacks(PassInstrumentationCallbacks &PIC) {
+  PIC.registerBeforeNonSkippedPassCallback([](StringRef PassID, Any IR) {
+    if (isWrapperPass(PassID)) {
+      return;
+    }
+    IRUnitInfo Info = describeIR(IR);
+    Frame &F = getFrameStack().emplace_back();
+    F.R.Module = std::move(Info.Module);
+    F.R.Pass = PassID.str();
+    F.R.IRKind = std::move(Info.Kind);
+    F.R.IRName = std::move(Info.Name);
+    F.R.InstsBefore = Info.Insts;
+    F.R.BlocksBefore = Info.Blocks;
+    F.MaxRSSKB = getMaxRSSKB();
+    F.Allocations = getThreadAllocationCount();
+    F.Start = std::chrono::steady_clock::now();
+  });
+
+  auto Finish = [this](StringRef PassID, const Any *IR) {
+    if (isWrapperPass(PassID)) {
+      return;
+    }
+    auto End = std::chrono::steady_clock::now();
+    uint64_t Allocations = getThreadAllocationCount();
+    SmallVectorImpl<Frame> &Stack = getFrameStack();
+    assert(!Stack.empty() && Stack.back().R.Pass == PassID &&
+           "Unbalanced pass instrumentation callbacks");
+    Frame F = Stack.pop_back_val();
+
+    F.R.WallNanos =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(End - F.Start)
+            .count();
+    F.R.Allocations = Allocations - F.Allocations;
+    F.R.PeakRSSDeltaKB = getMaxRSSKB() - F.MaxRSSKB;
+    // An invalidated IR unit is gone, its size after the pass is zero.
+    if (IR) {
+      IRUnitInfo Info = describeIR(*IR);
+      F.R.InstsAfter = Info.Insts;
+      F.R.BlocksAfter = Info.Blocks;
+    }
+    addRecord(std::move(F.R));
+  };
+
+  PIC.registerAfterPassCallback(
+      [Finish](StringRef PassID, Any IR, const PreservedAnalyses &) {
+        Finish(PassID, &IR);
+      });
+  PIC.registerAfterPassInvalidatedCallback(
+      [Finish](StringRef PassID, const PreservedAnalyses &) {
+        Finish(PassID, nullptr);
+      });
+}
+
+void PassProfiler::addRecord(Record R) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Records.push_back(std::move(R));
+}
+
+void PassProfiler::writeJSON(raw_ostream &OS) const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  struct Summary {
+    uint64_t Runs = 0;
+    uint64_t WallNanos = 0;
+    uint64_t Allocations = 0;
+  };
+  StringMap<Summary> PerPass;
+  for (const Record &R : Records) {
+    Summary &S = PerPass[R.Pass];
+    ++S.Runs;
+    S.WallNanos += R.WallNanos;
+    S.Allocations += R.Allocations;
+  }
+  std::vector<const StringMapEntry<Summary> *> Sorted;
+  for (const auto &Entry : PerPass) {
+    Sorted.push_back(&Entry);
+  }
+  llvm::sort(Sorted, [](const auto *A, const auto *B) {
+    return A->second.WallNanos > B->second.WallNanos;
+  });
+
+  json::OStream J(OS, 2);
+  J.object([&] {
+    J.attribute("allocation_counting", isAllocationCountingSupported());
+    J.attributeArray("passes", [&] {
+      for (const Record &R : Records) {
+        J.object([&] {
+          J.attribute("module", R.Module);
+          J.attribute("pass", R.Pass);
+          J.attribute("ir_kind", R.IRKind);
+          J.attribute("ir_name", R.IRName);
+          J.attribute("wall_ns", R.WallNanos);
+          J.attribute("insts_before", R.InstsBefore);
+          J.attribute("insts_after", R.InstsAfter);
+          J.attribute("blocks_before", R.BlocksBefore);
+          J.attribute("blocks_after", R.BlocksAfter);
+          J.attribute("peak_rss_delta_kb", R.PeakRSSDeltaKB);
+          J.attribute("allocations", R.Allocations);
+        });
+      }
+    });
+    J.attributeArray("summary", [&] {
+      for (const auto *Entry : Sorted) {
+        J.object([&] {
+          J.attribute("pass", Entry->first());
+          J.attribute("runs", Entry->second.Runs);
+          J.attribute("wall_ns", Entry->second.WallNanos);
+          J.attribute("allocations", Entry->second.Allocations);
+        });
+      }
+    });
+    J.attributeObject("statistics", [&] {
+      for (const auto &[Name, Value] : GetStatistics()) {
+        J.attribute(Name, Value);
+      }
+    });
+  });
+  OS << "\n";
+}
+} // namespace llvm::trainOpt
@@ -0,0 +1,67 @@
+//===- PassProfiler.h - Per pass and per function cost records ------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TOPT_TOOLS_TOPT_PASSPROFILER_H
+#define TOPT_TOOLS_TOPT_PASSPROFILER_H
+
+#include <llvm/ADT/StringRef.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class PassInstrumentationCallbacks;
+class raw_ostream;
+
+namespace trainOpt {
+/**
+ *  PassProfiler - Records one entry per pass run on one IR unit (function,
+ *  loop, SCC or module): wall time, instruction and block counts before and
+ *  after the pass, the growth of the peak RSS and the number of heap
+ *  allocations the pass made.
+ *
+ *  One profiler can be attached to any number of pipelines, also ones running
+ *  on different threads. The peak RSS is a process wide number, so with
+ *  several threads it is only an upper bound for a single pass.
+ */
+class PassProfiler {
+public:
+  struct Record {
+    std::string Module;
+    std::string Pass;
+    std::string IRKind;
+    std::string IRName;
+    uint64_t WallNanos = 0;
+    uint64_t InstsBefore = 0;
+    uint64_t InstsAfter = 0;
+    uint64_t BlocksBefore = 0;
+    uint64_t BlocksAfter = 0;
+    int64_t PeakRSSDeltaKB = 0;
+    uint64_t Allocations = 0;
+  };
+
+  void registerCallbacks(PassInstrumentationCallbacks &PIC);
+
+  /**
+   *  writeJSON - Print all records, a per pass summary ordered by total time
+   *  and all LLVM statistics as one JSON object.
+   */
+  void writeJSON(raw_ostream &OS) const;
+
+private:
+  void addRecord(Record R);
+
+  mutable std::mutex Mutex;
+  std::vector<Record> Records;
+};
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_TOOLS_TOPT_PASSPROFILER_H
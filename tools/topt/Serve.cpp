@@ -0,0 +1,259 @@
+//===- Serve.cpp - Persistent topt server ---------------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// topt --serve answers (pipeline, module) requests framed as described in
+// ServeProtocol.h, either on stdin/stdout or on a Unix domain socket. Parsed
+// pipelines are kept in a pool keyed by their text, so a warm request pays
+// only for parsing, optimizing and writing its module.
+//
+//===----------------------------------------------------------------------===//
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "Driver.h"
+#include "ServeProtocol.h"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+using namespace llvm;
+
+namespace llvm::trainOpt {
+namespace {
+/**
+ *  PipelinePool - Idle OptimizationPipelines by pipeline text. A pipeline is
+ *  taken out of the pool for the duration of one request, so concurrent
+ *  requests for the same pipeline get separate instances.
+ */
+class PipelinePool {
+public:
+  Expected<std::unique_ptr<OptimizationPipeline>> acquire(StringRef Text) {
+    {
+      std::lock_guard<std::mutex> Lock(Mutex);
+      auto It = Idle.find(Text);
+      if (It != Idle.end() && !It->second.empty()) {
+        std::unique_ptr<OptimizationPipeline> Pipeline =
+            std::move(It->second.back());
+        It->second.pop_back();
+        return std::move(Pipeline);
+      }
+    }
+    return OptimizationPipeline::create(Text);
+  }
+
+  void release(StringRef Text, std::unique_ptr<OptimizationPipeline> P) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Idle[Text].push_back(std::move(P));
+  }
+
+private:
+  std::mutex Mutex;
+  StringMap<std::vector<std::unique_ptr<OptimizationPipeline>>> Idle;
+};
+
+class Server {
+public:
+  explicit Server(StringRef ProgName) : ProgName(ProgName) {}
+
+  serve::Response handle(const serve::Request &Req);
+
+  /**
+   *  serveConnection - Answer requests on In/Out until the peer closes the
+   *  connection or asks the server to shut down.
+   */
+  void serveConnection(int In, int Out);
+
+  /**
+   *  addConnection - Track the socket FD so a shutdown can end it. Returns
+   *  false if the server is already shutting down.
+   */
+  bool addConnection(int FD);
+  void removeConnection(int FD);
+
+  /**
+   *  requestShutdown - Stop reading from every open connection. Idle clients
+   *  would otherwise keep their connection, and the server, alive; requests
+   *  already read are still answered.
+   */
+  void requestShutdown();
+
+  std::atomic<bool> ShutdownRequested{false};
+
+private:
+  std::string ProgName;
+  PipelinePool Pipelines;
+  std::mutex ConnectionsMutex;
+  DenseSet<int> Connections;
+};
+} // namespace
+
+serve::Response Server::handle(const serve::Request &Req) {
+  serve::Response Resp;
+  auto PipelineOrErr = Pipelines.acquire(Req.Pipeline);
+  if (!PipelineOrErr) {
+    raw_string_ostream(Resp.Payload)
+        << ProgName << ": " << toString(PipelineOrErr.takeError()) << "\n";
+    Resp.Status = serve::ResponseStatus::Error;
+    return Resp;
+  }
+
+  ModuleOptions Opts;
+  Opts.EmitBitcode = Req.Flags & serve::EmitBitcode;
+
+  // std::string keeps its contents null terminated, as the IR lexer expects.
+  std::unique_ptr<MemoryBuffer> Input = MemoryBuffer::getMemBuffer(
+      Req.Module, "<request>", /*RequiresNullTerminator=*/true);
+  std::string Output;
+  raw_string_ostream OS(Output);
+  std::string Errors;
+  raw_string_ostream ErrorOS(Errors);
+  if (optimizeBuffer(ProgName, std::move(Input), **PipelineOrErr, Opts, OS,
+                     ErrorOS)) {
+    Resp.Payload = std::move(Output);
+  } else {
+    Resp.Status = serve::ResponseStatus::Error;
+    Resp.Payload = std::move(Errors);
+  }
+  Pipelines.release(Req.Pipeline, std::move(*PipelineOrErr));
+  return Resp;
+}
+
+void Server::serveConnection(int In, int Out) {
+  serve::Request Req;
+  while (true) {
+    Expected<bool> Got = serve::readRequest(In, Req);
+    if (!Got) {
+      errs() << ProgName << ": " << toString(Got.takeError()) << "\n";
+      return;
+    }
+    if (!*Got) {
+      return;
+    }
+    if (Error E = serve::writeResponse(Out, handle(Req))) {
+      // A client that left without reading its response only ends its own
+      // connection.
+      handleAllErrors(std::move(E), [&](const ErrorInfoBase &EIB) {
+        if (EIB.convertToErrorCode() != std::errc::broken_pipe) {
+          errs() << ProgName << ": " << EIB.message() << "\n";
+        }
+      });
+      return;
+    }
+    if (Req.Flags & serve::Shutdown) {
+      requestShutdown();
+      return;
+    }
+  }
+}
+
+bool Server::addConnection(int FD) {
+  std::lock_guard<std::mutex> Lock(ConnectionsMutex);
+  if (ShutdownRequested) {
+    return false;
+  }
+  Connections.insert(FD);
+  return true;
+}
+
+void Server::removeConnection(int FD) {
+  std::lock_guard<std::mutex> Lock(ConnectionsMutex);
+  Connections.erase(FD);
+}
+
+void Server::requestShutdown() {
+  std::lock_guard<std::mutex> Lock(ConnectionsMutex);
+  ShutdownRequested = true;
+  // Blocked reads see the end of the connection, writes still go through.
+  for (int FD : Connections) {
+    ::shutdown(FD, SHUT_RD);
+  }
+}
+
+static int serveSocket(Server &S, StringRef ProgName, StringRef SocketPath,
+                       unsigned NumThreads) {
+  sockaddr_un Addr = {};
+  Addr.sun_family = AF_UNIX;
+  if (SocketPath.size() >= sizeof(Addr.sun_path)) {
+    errs() << ProgName << ": socket path is too long: " << SocketPath << "\n";
+    return 1;
+  }
+  memcpy(Addr.sun_path, SocketPath.data(), SocketPath.size());
+
+  // A socket file left behind by a previous server would make bind fail.
+  // Anything else at that path is not ours to remove.
+  struct stat Status;
+  if (::lstat(Addr.sun_path, &Status) == 0) {
+    if (!S_ISSOCK(Status.st_mode)) {
+      errs() << ProgName << ": " << SocketPath
+             << ": file exists and is not a socket\n";
+      return 1;
+    }
+    ::unlink(Addr.sun_path);
+  }
+
+  int ListenFD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (ListenFD < 0) {
+    errs() << ProgName << ": socket: " << strerror(errno) << "\n";
+    return 1;
+  }
+  if (::bind(ListenFD, reinterpret_cast<sockaddr *>(&Addr), sizeof(Addr)) ||
+      ::listen(ListenFD, SOMAXCONN)) {
+    errs() << ProgName << ": " << SocketPath << ": " << strerror(errno)
+           << "\n";
+    ::close(ListenFD);
+    return 1;
+  }
+
+  DefaultThreadPool Pool(hardware_concurrency(NumThreads));
+  while (!S.ShutdownRequested) {
+    int FD = sys::RetryAfterSignal(-1, ::accept, ListenFD, nullptr, nullptr);
+    if (FD < 0) {
+      if (!S.ShutdownRequested) {
+        errs() << ProgName << ": accept: " << strerror(errno) << "\n";
+      }
+      break;
+    }
+    if (!S.addConnection(FD)) {
+      ::close(FD);
+      break;
+    }
+    Pool.async([&S, FD, ListenFD] {
+      S.serveConnection(FD, FD);
+      // Before the FD may be reused by another connection.
+      S.removeConnection(FD);
+      ::close(FD);
+      // Wake up the accept loop so it notices the shutdown.
+      if (S.ShutdownRequested) {
+        ::shutdown(ListenFD, SHUT_RDWR);
+      }
+    });
+  }
+  Pool.wait();
+  ::close(ListenFD);
+  ::unlink(Addr.sun_path);
+  return 0;
+}
+
+int runServer(StringRef ProgName, StringRef SocketPath, unsigned NumThreads) {
+  Server S(ProgName);
+  if (SocketPath.empty()) {
+    S.serveConnection(STDIN_FILENO, STDOUT_FILENO);
+    return 0;
+  }
+  return serveSocket(S, ProgName, SocketPath, NumThreads);
+}
+} // namespace llvm::trainOpt
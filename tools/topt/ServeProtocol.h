@@ -0,0 +1,197 @@
+//===- ServeProtocol.h - Framing used by topt --serve and its client ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// A connection carries any number of request/response pairs. All integers are
+// little endian.
+//
+//   request:  u32 magic, u32 flags, u32 pipeline size, u64 module size,
+//             pipeline text, module bytes (textual IR or bitcode)
+//   response: u32 status, u64 payload size,
+//             payload (optimized module on success, diagnostics otherwise)
+//
+// Sizes above MaxPipelineSize and MaxModuleSize are rejected before anything
+// is allocated for them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef TOPT_TOOLS_TOPT_SERVEPROTOCOL_H
+#define TOPT_TOOLS_TOPT_SERVEPROTOCOL_H
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Endian.h>
+#include <llvm/Support/Errno.h>
+#include <llvm/Support/Error.h>
+
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace llvm {
+namespace trainOpt {
+namespace serve {
+constexpr uint32_t RequestMagic = 0x54504f54; // "TOPT"
+
+enum RequestFlags : uint32_t {
+  /// Answer with bitcode instead of textual IR.
+  EmitBitcode = 1 << 0,
+  /// Stop the server once this request is answered.
+  Shutdown = 1 << 1,
+};
+
+enum class ResponseStatus : uint32_t { Ok = 0, Error = 1 };
+
+constexpr uint32_t MaxPipelineSize = 1 << 20;
+/// Also the limit of a response payload.
+constexpr uint64_t MaxModuleSize = uint64_t(1) << 30;
+
+struct Request {
+  uint32_t Flags = 0;
+  std::string Pipeline;
+  std::string Module;
+};
+
+struct Response {
+  ResponseStatus Status = ResponseStatus::Ok;
+  std::string Payload;
+};
+
+/**
+ *  readFull - Read exactly Size bytes. Returns false on end of file before
+ *  the first byte, an error on a short read or a failed read.
+ */
+inline Expected<bool> readFull(int FD, char *Buf, size_t Size) {
+  size_t Done = 0;
+  while (Done < Size) {
+    ssize_t N = sys::RetryAfterSignal(-1, ::read, FD, Buf + Done, Size - Done);
+    if (N < 0) {
+      return errorCodeToError(std::error_code(errno, std::generic_category()));
+    }
+    if (N == 0) {
+      if (Done == 0) {
+        return false;
+      }
+      return createStringError(inconvertibleErrorCode(),
+                               "connection closed in the middle of a frame");
+    }
+    Done += N;
+  }
+  return true;
+}
+
+/**
+ *  writeFull - Write all of Data. On a socket whose peer went away this fails
+ *  with EPIPE instead of raising SIGPIPE, which would end the whole process.
+ */
+inline Error writeFull(int FD, StringRef Data) {
+  while (!Data.empty()) {
+    ssize_t N = sys::RetryAfterSignal(-1, ::send, FD, Data.data(),
+                                      Data.size(), MSG_NOSIGNAL);
+    // stdin/stdout may be pipes or files.
+    if (N < 0 && errno == ENOTSOCK) {
+      N = sys::RetryAfterSignal(-1, ::write, FD, Data.data(), Data.size());
+    }
+    if (N < 0) {
+      return errorCodeToError(std::error_code(errno, std::generic_category()));
+    }
+    Data = Data.drop_front(N);
+  }
+  return Error::success();
+}
+
+inline Error writeRequest(int FD, const Request &Req) {
+  char Header[20];
+  support::endian::write32le(Header, RequestMagic);
+  support::endian::write32le(Header + 4, Req.Flags);
+  support::endian::write32le(Header + 8, Req.Pipeline.size());
+  support::endian::write64le(Header + 12, Req.Module.size());
+  if (Error E = writeFull(FD, StringRef(Header, sizeof(Header)))) {
+    return E;
+  }
+  if (Error E = writeFull(FD, Req.Pipeline)) {
+    return E;
+  }
+  return writeFull(FD, Req.Module);
+}
+
+/**
+ *  readRequest - Returns false if the peer closed the connection cleanly
+ *  instead of sending another request.
+ */
+inline Expected<bool> readRequest(int FD, Request &Req) {
+  char Header[20];
+  Expected<bool> Got = readFull(FD, Header, sizeof(Header));
+  if (!Got || !*Got) {
+    return Got;
+  }
+  if (support::endian::read32le(Header) != RequestMagic) {
+    return createStringError(inconvertibleErrorCode(),
+                             "not a topt request (bad magic)");
+  }
+  Req.Flags = support::endian::read32le(Header + 4);
+  uint32_t PipelineSize = support::endian::read32le(Header + 8);
+  uint64_t ModuleSize = support::endian::read64le(Header + 12);
+  if (PipelineSize > MaxPipelineSize || ModuleSize > MaxModuleSize) {
+    return createStringError(inconvertibleErrorCode(), "request is too large");
+  }
+  Req.Pipeline.resize(PipelineSize);
+  Req.Module.resize(ModuleSize);
+  for (std::string *Part : {&Req.Pipeline, &Req.Module}) {
+    Got = readFull(FD, Part->data(), Part->size());
+    if (!Got) {
+      return Got.takeError();
+    }
+    if (!*Got && !Part->empty()) {
+      return createStringError(inconvertibleErrorCode(),
+                               "connection closed in the middle of a frame");
+    }
+  }
+  return true;
+}
+
+inline Error writeResponse(int FD, const Response &Resp) {
+  char Header[12];
+  support::endian::write32le(Header, static_cast<uint32_t>(Resp.Status));
+  support::endian::write64le(Header + 4, Resp.Payload.size());
+  if (Error E = writeFull(FD, StringRef(Header, sizeof(Header)))) {
+    return E;
+  }
+  return writeFull(FD, Resp.Payload);
+}
+
+inline Error readResponse(int FD, Response &Resp) {
+  char Header[12];
+  Expected<bool> Got = readFull(FD, Header, sizeof(Header));
+  if (!Got) {
+    return Got.takeError();
+  }
+  if (!*Got) {
+    return createStringError(inconvertibleErrorCode(),
+                             "server closed the connection");
+  }
+  Resp.Status = static_cast<ResponseStatus>(support::endian::read32le(Header));
+  uint64_t PayloadSize = support::endian::read64le(Header + 4);
+  if (PayloadSize > MaxModuleSize) {
+    return createStringError(inconvertibleErrorCode(), "response is too large");
+  }
+  Resp.Payload.resize(PayloadSize);
+  Got = readFull(FD, Resp.Payload.data(), Resp.Payload.size());
+  if (!Got) {
+    return Got.takeError();
+  }
+  if (!*Got && !Resp.Payload.empty()) {
+    return createStringError(inconvertibleErrorCode(),
+                             "server closed the connection");
+  }
+  return Error::success();
+}
+} // namespace serve
+} // namespace trainOpt
+} // namespace llvm
+
+#endif // TOPT_TOOLS_TOPT_SERVEPROTOCOL_H
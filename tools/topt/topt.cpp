@@ -1,134 +1,233 @@
-#include <llvm/Analysis/CGSCCPassManager.h>
-#include <llvm/Analysis/LoopAnalysisManager.h>
-#include <llvm/Bitcode/BitcodeReader.h>
-#include <llvm/CodeGen/MachinePassManager.h>
-#include <llvm/IR/BasicBlock.h>
-#include <llvm/IR/Constants.h>
-#include <llvm/IR/DerivedTypes.h>
-#include <llvm/IR/Function.h>
-#include <llvm/IR/GlobalObject.h>
-#include <llvm/IR/IRPrintingPasses.h>
-#include <llvm/IR/LLVMContext.h>
-#include <llvm/IR/LegacyPassNameParser.h>
-#include <llvm/IR/Module.h>
-#include <llvm/IR/PassManager.h>
-#include <llvm/IR/Type.h>
-#include <llvm/IRPrinter/IRPrintingPasses.h>
-#include <llvm/IRReader/IRReader.h>
-#include <llvm/InitializePasses.h>
-#include <llvm/PassInfo.h>
-#include <llvm/PassRegistry.h>
-#include <llvm/Passes/PassBuilder.h>
-#include <llvm/Passes/PassPlugin.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/Statistic.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Debug.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/InitLLVM.h>
-#include <llvm/Support/SourceMgr.h>
 #include <llvm/Support/ToolOutputFile.h>
 #include <llvm/Support/raw_ostream.h>
-#include <llvm/TargetParser/Triple.h>
 
-#include "topt/DataFlow/SCCP.h"
-#include "topt/DataFlow/SSCP.h"
-#include "topt/LocalOpt/LVN.h"
+#include "Driver.h"
+#include "ModuleCache.h"
+#include "PassProfiler.h"
 
 #define DEBUG_TYPE "main"
 
 using namespace llvm;
 
+/// Options of topt itself, as opposed to those of the passes it runs.
+static cl::OptionCategory DriverCategory("topt driver options");
+
 static cl::opt<std::string> PassPipeline(
     "passes",
     cl::desc(
         "A textual description of the pass pipeline. To have analysis passes "
-        "available before a certain pass, add 'require<foo-analysis>'."));
+        "available before a certain pass, add 'require<foo-analysis>'."),
+    cl::cat(DriverCategory));
 
 static cl::alias PassPipeline2("p", cl::aliasopt(PassPipeline),
-                               cl::desc("Alias for -passes"));
+                               cl::desc("Alias for -passes"),
+                               cl::cat(DriverCategory));
 
 static cl::opt<std::string> InputFilename(cl::Positional,
                                           cl::desc("<input bitcode file>"),
                                           cl::init("-"),
-                                          cl::value_desc("filename"));
+                                          cl::value_desc("filename"),
+                                          cl::cat(DriverCategory));
 
 static cl::opt<std::string> OutputFilename("o",
                                            cl::desc("Override output filename"),
-                                           cl::value_desc("filename"));
-
-static void registerPassBuilderCallbacks(PassBuilder &PB) {
-  PB.registerPipelineParsingCallback(
-      [](StringRef Name, FunctionPassManager &PM,
-         ArrayRef<PassBuilder::PipelineElement>) {
-        if (Name == "topt-sccp") {
-          PM.addPass(trainOpt::SCCPPass{});
-          return true;
-        }
-        if (Name == "topt-sscp") {
-          PM.addPass(trainOpt::SSCPPass{});
-          return true;
-        }
-        if (Name == "topt-lvn") {
-          PM.addPass(trainOpt::LVNPass{});
-          return true;
-        }
-        return false;
-      });
+                                           cl::value_desc("filename"),
+                                           cl::cat(DriverCategory));
+
+static cl::opt<bool>
+    EmitBitcode("emit-bc",
+                cl::desc("Write the optimized module as LLVM bitcode instead "
+                         "of textual IR"),
+                cl::cat(DriverCategory));
+
+static cl::list<std::string> OnlyFunctions(
+    "only-functions", cl::CommaSeparated,
+    cl::desc("Only materialize and optimize the given functions. Bodies of "
+             "all other functions are never read and are dropped from the "
+             "output"),
+    cl::value_desc("function,..."), cl::cat(DriverCategory));
+
+static cl::opt<std::string> BatchFilename(
+    "batch",
+    cl::desc("Optimize every '<input> <output>' pair listed in <file> (one "
+             "pair per line) in this process instead of a single input"),
+    cl::value_desc("file"), cl::cat(DriverCategory));
+
+static cl::opt<unsigned>
+    NumThreads("j",
+               cl::desc("Number of worker threads for -batch and -serve, 0 "
+                        "uses all hardware threads"),
+               cl::init(0), cl::cat(DriverCategory));
+
+static cl::opt<bool>
+    Serve("serve",
+          cl::desc("Run as a server answering optimization requests on "
+                   "-socket, or on stdin/stdout if no socket is given"),
+          cl::cat(DriverCategory));
+
+static cl::opt<std::string>
+    SocketPath("socket", cl::desc("Unix domain socket for -serve"),
+               cl::value_desc("path"), cl::cat(DriverCategory));
+
+static cl::opt<std::string> ProfilePasses(
+    "profile-passes",
+    cl::desc("Write the wall time, IR size before and after, peak RSS growth "
+             "and allocation count of every pass on every function, plus all "
+             "statistics, as JSON to <file>"),
+    cl::value_desc("file"), cl::cat(DriverCategory));
+
+static cl::opt<std::string> CacheDir(
+    "cache-dir",
+    cl::desc("Look up optimized modules in <dir> before running the pipeline "
+             "and store new results there. The directory may be shared by "
+             "concurrent topt processes"),
+    cl::value_desc("dir"), cl::cat(DriverCategory));
+
+static cl::opt<std::string> FunctionCacheDir(
+    "function-cache-dir",
+    cl::desc("Cache optimized function bodies in <dir> and only run the "
+             "pipeline on functions that changed since they were cached. "
+             "Needs a pipeline of function passes"),
+    cl::value_desc("dir"), cl::cat(DriverCategory));
+
+static cl::opt<std::string> CachePolicy(
+    "cache-policy",
+    cl::desc("Pruning policy of -cache-dir and -function-cache-dir, e.g. "
+             "'cache_size_bytes=1g:prune_after=24h:prune_interval=5m'"),
+    cl::init("cache_size_bytes=1g"), cl::value_desc("policy"),
+    cl::cat(DriverCategory));
+
+/**
+ *  getPassOptions - The command line arguments that may change what the
+ *  passes do, in order: every option that is not one of topt's own, with its
+ *  value. Cached outputs are only valid for the same arguments.
+ */
+static std::string getPassOptions(int argc, char **argv) {
+  StringMap<cl::Option *> &Registered = cl::getRegisteredOptions();
+  std::string Text;
+  for (int i = 1; i < argc; ++i) {
+    StringRef Arg = argv[i];
+    if (!Arg.starts_with("-")) {
+      continue;
+    }
+    auto [Name, Value] = Arg.ltrim('-').split('=');
+    cl::Option *O = Registered.lookup(Name);
+    if (!O || is_contained(O->Categories, &DriverCategory)) {
+      continue;
+    }
+    Text += Arg;
+    Text += '\0';
+    // "-name value" has its value in the next argument.
+    if (!Arg.contains('=') && O->getValueExpectedFlag() == cl::ValueRequired &&
+        i + 1 < argc) {
+      Text += argv[++i];
+      Text += '\0';
+    }
+  }
+  return Text;
+}
+
+/**
+ *  writeProfile - Print the -profile-passes report. Returns false if the file
+ *  could not be written.
+ */
+static bool writeProfile(const trainOpt::PassProfiler &Profiler) {
+  std::error_code EC;
+  ToolOutputFile Out(ProfilePasses, EC, sys::fs::OF_TextWithCRLF);
+  if (EC) {
+    errs() << "topt: " << ProfilePasses << ": " << EC.message() << "\n";
+    return false;
+  }
+  Profiler.writeJSON(Out.os());
+  Out.keep();
+  return true;
+}
+
+static bool openCache(StringRef Dir, StringRef ProgName,
+                      StringRef PassOptions,
+                      std::unique_ptr<trainOpt::ModuleCache> &Cache) {
+  auto CacheOrErr =
+      trainOpt::ModuleCache::open(Dir, CachePolicy, ProgName, PassOptions);
+  if (!CacheOrErr) {
+    errs() << "topt: " << Dir << ": " << toString(CacheOrErr.takeError())
+           << "\n";
+    return false;
+  }
+  Cache = std::move(*CacheOrErr);
+  return true;
 }
 
 int main(int argc, char **argv) {
   InitLLVM X(argc, argv);
-  LLVMContext Context;
 
   cl::ParseCommandLineOptions(
       argc, argv, "llvm .ll -> .ll trainig optimizer and analysis printer\n");
 
-  SMDiagnostic Err;
-  if (OutputFilename.empty()) {
-    OutputFilename = "-";
-  }
+  trainOpt::ModuleOptions Opts;
+  Opts.EmitBitcode = EmitBitcode;
+  Opts.OnlyFunctions.assign(OnlyFunctions.begin(), OnlyFunctions.end());
 
-  std::error_code EC;
-  std::unique_ptr<ToolOutputFile> Out = std::make_unique<ToolOutputFile>(
-      OutputFilename, EC, sys::fs::OF_TextWithCRLF);
-  if (EC) {
-    errs() << EC.message() << '\n';
-    return 1;
+  if (Serve) {
+    return trainOpt::runServer(argv[0], SocketPath, NumThreads);
   }
 
-  // Load the input module...
-  std::unique_ptr<Module> M = parseIRFile(InputFilename, Err, Context);
-  if (!M) {
-    Err.print(argv[0], dbgs());
-    return 1;
+  std::string PassOptions = getPassOptions(argc, argv);
+  std::unique_ptr<trainOpt::ModuleCache> Cache;
+  if (!CacheDir.empty()) {
+    if (!openCache(CacheDir, argv[0], PassOptions, Cache)) {
+      return 1;
+    }
+    Opts.Cache = Cache.get();
+  }
+  std::unique_ptr<trainOpt::ModuleCache> FunctionCache;
+  if (!FunctionCacheDir.empty()) {
+    if (!openCache(FunctionCacheDir, argv[0], PassOptions, FunctionCache)) {
+      return 1;
+    }
+    Opts.FunctionCache = FunctionCache.get();
   }
 
-  FunctionPassManager FPM;
-  ModulePassManager MPM;
-
-  LoopAnalysisManager LAM;
-  MachineFunctionAnalysisManager MFAM;
-  FunctionAnalysisManager FAM;
-  CGSCCAnalysisManager CGAM;
-  ModuleAnalysisManager MAM;
+  std::unique_ptr<trainOpt::PassProfiler> Profiler;
+  if (!ProfilePasses.empty()) {
+    EnableStatistics(/*DoPrintOnExit=*/false);
+    Profiler = std::make_unique<trainOpt::PassProfiler>();
+  }
 
-  PassBuilder PB;
-  registerPassBuilderCallbacks(PB);
+  if (!BatchFilename.empty()) {
+    int ExitCode = trainOpt::runBatch(argv[0], BatchFilename, PassPipeline,
+                                      Opts, NumThreads, Profiler.get());
+    if (Profiler && !writeProfile(*Profiler)) {
+      return 1;
+    }
+    return ExitCode;
+  }
 
-  PB.registerFunctionAnalyses(FAM);
-  PB.registerModuleAnalyses(MAM);
-  PB.registerLoopAnalyses(LAM);
-  PB.registerCGSCCAnalyses(CGAM);
-  PB.registerMachineFunctionAnalyses(MFAM);
-  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  if (OutputFilename.empty()) {
+    OutputFilename = "-";
+  }
 
-  if (Error Err = PB.parsePassPipeline(MPM, PassPipeline)) {
-    errs() << "topt: " << toString(std::move(Err)) << "\n";
+  auto PipelineOrErr =
+      trainOpt::OptimizationPipeline::create(PassPipeline, Profiler.get());
+  if (!PipelineOrErr) {
+    errs() << "topt: " << toString(PipelineOrErr.takeError()) << "\n";
     return 1;
   }
 
-  MPM.addPass(PrintModulePass(Out->os()));
-  MPM.run(*M, MAM);
+  if (!trainOpt::optimizeFile(argv[0], InputFilename, OutputFilename,
+                              **PipelineOrErr, Opts, dbgs())) {
+    return 1;
+  }
+  if (Profiler && !writeProfile(*Profiler)) {
+    return 1;
+  }
 
-  Out->keep();
   LLVM_DEBUG(dbgs() << "Hello train-opt! Training Optimizer!\n");
   return 0;
 }
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Measure how the time of the topt passes grows with the input size.
+
+Generates one module per size with irgen, times the passes on it with
+topt-bench and prints, per pass, the time per instruction and the growth
+exponent between neighbouring sizes. An exponent clearly above 1 means the
+pass is superlinear in that range. With matplotlib installed the times are
+also plotted on log-log axes.
+
+Example:
+  utils/scale-passes.py --bin-dir build/bin --out-dir scale \\
+      -- -phi-fanin=16 -nesting-depth=2
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+
+
+def parse_args():
+    parser = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter
+    )
+    parser.add_argument(
+        "--bin-dir",
+        default="build/bin",
+        help="directory containing irgen and topt-bench (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--sizes",
+        default="1000,10000,100000,1000000,10000000",
+        help="comma separated instruction counts (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--passes",
+        default="topt-sccp,topt-sscp,topt-lvn",
+        help="comma separated passes to time (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--repetitions",
+        type=int,
+        default=3,
+        help="timed runs per pass and size (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--out-dir",
+        default="scale-passes",
+        help="where modules, results and the plot go (default: %(default)s)",
+    )
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=1.15,
+        help="growth exponent reported as superlinear (default: %(default)s)",
+    )
+    parser.add_argument(
+        "irgen_args",
+        nargs="*",
+        help="extra irgen options describing the shape of the modules",
+    )
+    return parser.parse_args()
+
+
+def run(cmd):
+    print("+ " + " ".join(cmd), file=sys.stderr)
+    subprocess.run(cmd, check=True)
+
+
+def measure(args, size):
+    module = os.path.join(args.out_dir, "irgen-%d.bc" % size)
+    result = os.path.join(args.out_dir, "bench-%d.json" % size)
+    run(
+        [os.path.join(args.bin_dir, "irgen"), "-insts=%d" % size, "-emit-bc",
+         "-o", module] + args.irgen_args
+    )
+    run(
+        [os.path.join(args.bin_dir, "topt-bench"), module,
+         "-bench-passes=" + args.passes,
+         "-repetitions=%d" % args.repetitions, "-o", result]
+    )
+    with open(result) as f:
+        return json.load(f)["benchmarks"]
+
+
+def plot(series, path):
+    try:
+        import matplotlib
+
+        matplotlib.use("Agg")
+        import matplotlib.pyplot as plt
+    except ImportError:
+        print("matplotlib not found, skipping the plot", file=sys.stderr)
+        return
+    fig, ax = plt.subplots()
+    for name, points in sorted(series.items()):
+        ax.plot([p[0] for p in points], [p[1] / 1e6 for p in points],
+                marker="o", label=name)
+    ax.set_xscale("log")
+    ax.set_yscale("log")
+    ax.set_xlabel("instructions")
+    ax.set_ylabel("median time [ms]")
+    ax.grid(True, which="both", alpha=0.3)
+    ax.legend()
+    fig.savefig(path, dpi=120)
+    print("plot written to " + path, file=sys.stderr)
+
+
+def main():
+    args = parse_args()
+    os.makedirs(args.out_dir, exist_ok=True)
+    sizes = [int(s) for s in args.sizes.split(",")]
+
+    # pass name -> [(instructions, median ns, allocations, peak rss kb)]
+    series = {}
+    for size in sizes:
+        for b in measure(args, size):
+            series.setdefault(b["pass"], []).append(
+                (b["insts"], b["median_ns"], b["allocations"], b["peak_rss_kb"])
+            )
+
+    superlinear = False
+    for name, points in sorted(series.items()):
+        print(name)
+        print("  %12s %14s %10s %8s %14s %12s"
+              % ("insts", "median ns", "ns/inst", "growth", "allocations",
+                 "peak rss kb"))
+        for i, (insts, ns, allocs, rss) in enumerate(points):
+            growth = ""
+            if i > 0:
+                prev_insts, prev_ns = points[i - 1][:2]
+                if prev_ns > 0 and insts > prev_insts:
+                    exponent = math.log(ns / prev_ns) / math.log(insts / prev_insts)
+                    growth = "%.2f" % exponent
+                    if exponent > args.threshold:
+                        growth += " !"
+                        superlinear = True
+            print("  %12d %14d %10.1f %8s %14d %12d"
+                  % (insts, ns, ns / max(insts, 1), growth, allocs, rss))
+
+    with open(os.path.join(args.out_dir, "scale.json"), "w") as f:
+        json.dump(series, f, indent=2)
+    plot(series, os.path.join(args.out_dir, "scale.png"))
+    if superlinear:
+        print("growth exponents marked with ! exceed %.2f" % args.threshold)
+
+
+if __name__ == "__main__":
+    main()